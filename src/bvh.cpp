@@ -0,0 +1,328 @@
+#include "gfxengine/bvh.hpp"
+
+#include "gfxengine/frame.hpp"
+#include "gfxengine/material.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// Leaves may grow up to this when splitting does not pay off
+static constexpr uint32_t MAX_SAH_LEAF_SIZE = 16;
+static constexpr uint32_t SAH_BINS = 12;
+
+// Splits past this depth are median splits, which bounds the depth by MAX_DEPTH
+static constexpr uint32_t MAX_SAH_DEPTH = 32;
+
+// Proportional to the chance of a random ray hitting the box, perimeter in 2D and surface area in 3D
+static float half_area(AABB2 const &box)
+{
+	vec2 const s = box.size();
+	return s.x + s.y;
+}
+
+static float half_area(AABB3 const &box)
+{
+	vec3 const s = box.size();
+	return s.x * s.y + s.y * s.z + s.z * s.x;
+}
+
+template <typename TBox>
+void BVH<TBox>::build(std::span<const Box> _boxes, uint32_t max_leaf_size)
+{
+	clear();
+
+	if (_boxes.empty())
+		return;
+
+	boxes.assign(_boxes.begin(), _boxes.end());
+	items.resize(boxes.size());
+	item_nodes.resize(boxes.size());
+
+	for (uint32_t i = 0; i < (uint32_t)items.size(); ++i)
+		items[i] = i;
+
+	nodes.reserve(boxes.size() * 2 / std::max(max_leaf_size, 1u) + 1);
+	parents.reserve(nodes.capacity());
+
+	build_node(0, (uint32_t)items.size(), 0, std::max(max_leaf_size, 1u));
+}
+
+template <typename TBox>
+uint32_t BVH<TBox>::build_node(uint32_t begin, uint32_t end, uint32_t depth, uint32_t max_leaf_size)
+{
+	uint32_t const index = (uint32_t)nodes.size();
+	uint32_t const count = end - begin;
+
+	nodes.emplace_back();
+	parents.push_back(NONE);
+
+	Box bounds = Box::empty();
+	Box centroids = Box::empty();
+
+	for (uint32_t i = begin; i != end; ++i)
+	{
+		bounds.add(boxes[items[i]]);
+		centroids.add(boxes[items[i]].center());
+	}
+
+	set_bounds(nodes[index], bounds);
+
+	auto make_leaf = [&]() {
+		nodes[index].offset = begin;
+		nodes[index].count = count;
+
+		for (uint32_t i = begin; i != end; ++i)
+			item_nodes[items[i]] = index;
+
+		return index;
+	};
+
+	if (count <= max_leaf_size)
+		return make_leaf();
+
+	size_t axis = 0;
+	Point const extent = centroids.size();
+
+	for (size_t a = 1; a < DIM; ++a)
+	{
+		if (extent[a] > extent[axis])
+			axis = a;
+	}
+
+	uint32_t mid = begin;
+
+	if (extent[axis] > 0.0f && depth < MAX_SAH_DEPTH)
+	{
+		struct Bin
+		{
+			Box bounds = Box::empty();
+			uint32_t count = 0;
+		};
+
+		Bin bins[SAH_BINS];
+		float const origin = centroids.min[axis];
+		float const scale = SAH_BINS / extent[axis];
+
+		auto bin_of = [&](uint32_t item) {
+			return std::min((uint32_t)((boxes[item].center()[axis] - origin) * scale), SAH_BINS - 1);
+		};
+
+		for (uint32_t i = begin; i != end; ++i)
+		{
+			Bin &bin = bins[bin_of(items[i])];
+			bin.bounds.add(boxes[items[i]]);
+			++bin.count;
+		}
+
+		// Cost of splitting after bin i, sweeping from the right then from the left
+		float right_cost[SAH_BINS];
+		Box right = Box::empty();
+		uint32_t right_count = 0;
+
+		for (uint32_t i = SAH_BINS - 1; i > 0; --i)
+		{
+			right.add(bins[i].bounds);
+			right_count += bins[i].count;
+			right_cost[i - 1] = right_count != 0 ? right_count * half_area(right) : 0.0f;
+		}
+
+		Box left = Box::empty();
+		uint32_t left_count = 0;
+		uint32_t best_split = SAH_BINS;
+		float best_cost = std::numeric_limits<float>::infinity();
+
+		for (uint32_t i = 0; i + 1 < SAH_BINS; ++i)
+		{
+			left.add(bins[i].bounds);
+			left_count += bins[i].count;
+
+			if (left_count == 0 || left_count == count)
+				continue;
+
+			float const cost = left_count * half_area(left) + right_cost[i];
+
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_split = i;
+			}
+		}
+
+		// One traversal step against testing every item, both relative to the node's area
+		float const area = half_area(bounds);
+		bool const worth_splitting = area <= 0.0f || 1.0f + best_cost / area < (float)count;
+
+		if (!worth_splitting && count <= MAX_SAH_LEAF_SIZE)
+			return make_leaf();
+
+		if (best_split != SAH_BINS)
+		{
+			mid = (uint32_t)(std::partition(items.begin() + begin, items.begin() + end, [&](uint32_t item) {
+				return bin_of(item) <= best_split;
+			}) - items.begin());
+		}
+	}
+
+	// Centroids on top of each other or too deep, halves keep the tree shallow
+	if (mid == begin || mid == end)
+	{
+		mid = begin + count / 2;
+
+		std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [&](uint32_t a, uint32_t b) {
+			return boxes[a].center()[axis] < boxes[b].center()[axis];
+		});
+	}
+
+	uint32_t const left_child = build_node(begin, mid, depth + 1, max_leaf_size);
+	uint32_t const right_child = build_node(mid, end, depth + 1, max_leaf_size);
+
+	parents[left_child] = index;
+	parents[right_child] = index;
+
+	nodes[index].offset = right_child;
+	nodes[index].count = 0;
+
+	return index;
+}
+
+// Recomputes the bounds from the items or children, true when they changed
+template <typename TBox>
+bool BVH<TBox>::fit_node(uint32_t index)
+{
+	Node &node = nodes[index];
+	Box bounds = Box::empty();
+
+	if (node.count != 0)
+	{
+		for (uint32_t i = node.offset; i != node.offset + node.count; ++i)
+			bounds.add(boxes[items[i]]);
+	}
+	else
+	{
+		for (uint32_t child : { index + 1, node.offset })
+		{
+			Node const &c = nodes[child];
+
+			for (size_t lane = 0; lane < DIM; ++lane)
+			{
+				bounds.min[lane] = std::min(bounds.min[lane], c.min[lane]);
+				bounds.max[lane] = std::max(bounds.max[lane], c.max[lane]);
+			}
+		}
+	}
+
+	Node fitted = node;
+	set_bounds(fitted, bounds);
+
+	if (memcmp(fitted.min, node.min, sizeof(node.min)) == 0 && memcmp(fitted.max, node.max, sizeof(node.max)) == 0)
+		return false;
+
+	set_bounds(node, bounds);
+	return true;
+}
+
+template <typename TBox>
+void BVH<TBox>::refit(std::span<const Box> _boxes)
+{
+	if (_boxes.size() != boxes.size())
+		throw 1;
+
+	std::copy(_boxes.begin(), _boxes.end(), boxes.begin());
+
+	// Children always come after their parent
+	for (size_t i = nodes.size(); i-- > 0;)
+		fit_node((uint32_t)i);
+}
+
+template <typename TBox>
+void BVH<TBox>::update(uint32_t item, Box const &box)
+{
+	boxes[item] = box;
+
+	for (uint32_t node = item_nodes[item]; node != NONE && fit_node(node); node = parents[node])
+	{
+	}
+}
+
+template <typename TBox>
+void BVH<TBox>::clear()
+{
+	nodes.clear();
+	items.clear();
+	boxes.clear();
+	parents.clear();
+	item_nodes.clear();
+}
+
+template class BVH<AABB2>;
+template class BVH<AABB3>;
+
+bool MeshBVH::read_triangles(ShaderValuesInfo const &attributes, FrameCacheVertices const &vertices, std::vector<Triangle3> &out)
+{
+	auto offset = attributes.find_position_offset();
+	size_t const stride = attributes.total_byte_size;
+
+	if (!offset || stride == 0 || vertices.topology != PrimitiveTopology::Triangles)
+		return false;
+
+	size_t const vertex_count = vertices.vertices.size() / stride;
+
+	auto position = [&](uint32_t index) {
+		vec3 p{};
+
+		if (index < vertex_count)
+			memcpy(&p, vertices.vertices.data() + index * stride + *offset, sizeof(p));
+
+		return p;
+	};
+
+	out.clear();
+	out.reserve(vertices.indices.size() / 3);
+
+	for (size_t i = 0; i + 3 <= vertices.indices.size(); i += 3)
+		out.push_back({ position(vertices.indices[i]), position(vertices.indices[i + 1]), position(vertices.indices[i + 2]) });
+
+	return true;
+}
+
+bool MeshBVH::build(ShaderValuesInfo const &attributes, FrameCacheVertices const &vertices)
+{
+	std::vector<Triangle3> new_triangles;
+
+	if (!read_triangles(attributes, vertices, new_triangles))
+		return false;
+
+	build(std::move(new_triangles));
+	return true;
+}
+
+void MeshBVH::build(std::vector<Triangle3> _triangles)
+{
+	triangles = std::move(_triangles);
+	bvh.build(std::span<const Triangle3>(triangles));
+}
+
+bool MeshBVH::refit(ShaderValuesInfo const &attributes, FrameCacheVertices const &vertices)
+{
+	std::vector<Triangle3> new_triangles;
+
+	if (!read_triangles(attributes, vertices, new_triangles) || new_triangles.size() != triangles.size())
+		return false;
+
+	triangles = std::move(new_triangles);
+
+	std::vector<AABB3> boxes;
+	boxes.reserve(triangles.size());
+
+	for (auto const &t : triangles)
+		boxes.push_back(t.bounds());
+
+	bvh.refit(boxes);
+	return true;
+}
+
+void MeshBVH::set_triangle(uint32_t index, Triangle3 const &triangle)
+{
+	triangles[index] = triangle;
+	bvh.update(index, triangle.bounds());
+}
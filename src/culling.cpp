@@ -0,0 +1,245 @@
+#include "gfxengine/culling.hpp"
+
+#include "gfxengine/material.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define GFXENGINE_CULLING_SSE 1
+#else
+#define GFXENGINE_CULLING_SSE 0
+#endif
+
+// Geometry this close to the eye plane is treated as visible, projecting it is unstable
+static constexpr float MIN_CLIP_W = 1e-5f;
+
+std::optional<AABB3> compute_vertex_bounds(ShaderValuesInfo const &attributes, std::span<const uint8_t> vertices)
+{
+	auto offset = attributes.find_position_offset();
+	size_t stride = attributes.total_byte_size;
+
+	if (!offset || stride == 0 || vertices.size() < stride)
+		return std::nullopt;
+
+	AABB3 box = AABB3::empty();
+
+	for (size_t v = *offset; v + sizeof(vec3) <= vertices.size(); v += stride)
+	{
+		vec3 p;
+		memcpy(&p, vertices.data() + v, sizeof(p));
+		box.add(p);
+	}
+
+	return box;
+}
+
+Frustum::Frustum(mat4 const &m)
+{
+	// Gribb-Hartmann, rows of the matrix combined for -w <= x, y, z <= w
+	auto row = [&](size_t i) {
+		return vec4(m.col0[i], m.col1[i], m.col2[i], m.col3[i]);
+	};
+
+	vec4 const r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+	vec4 const planes[8]{
+		r3 + r0, r3 - r0,
+		r3 + r1, r3 - r1,
+		r3 + r2, r3 - r2,
+		r3 - r2, r3 - r2,
+	};
+
+	for (size_t i = 0; i < 8; ++i)
+	{
+		a[i] = planes[i].x;
+		b[i] = planes[i].y;
+		c[i] = planes[i].z;
+		d[i] = planes[i].w;
+	}
+}
+
+bool Frustum::intersects(AABB3 const &box) const
+{
+	// The corner farthest along a plane's normal gives max(a*min.x, a*max.x) + ..., no per-plane selection needed
+#if GFXENGINE_CULLING_SSE
+	__m128 const min_x = _mm_set1_ps(box.min.x), max_x = _mm_set1_ps(box.max.x);
+	__m128 const min_y = _mm_set1_ps(box.min.y), max_y = _mm_set1_ps(box.max.y);
+	__m128 const min_z = _mm_set1_ps(box.min.z), max_z = _mm_set1_ps(box.max.z);
+
+	for (size_t i = 0; i < 8; i += 4)
+	{
+		__m128 const pa = _mm_load_ps(a + i);
+		__m128 const pb = _mm_load_ps(b + i);
+		__m128 const pc = _mm_load_ps(c + i);
+
+		__m128 dist = _mm_load_ps(d + i);
+		dist = _mm_add_ps(dist, _mm_max_ps(_mm_mul_ps(pa, min_x), _mm_mul_ps(pa, max_x)));
+		dist = _mm_add_ps(dist, _mm_max_ps(_mm_mul_ps(pb, min_y), _mm_mul_ps(pb, max_y)));
+		dist = _mm_add_ps(dist, _mm_max_ps(_mm_mul_ps(pc, min_z), _mm_mul_ps(pc, max_z)));
+
+		if (_mm_movemask_ps(_mm_cmplt_ps(dist, _mm_setzero_ps())) != 0)
+			return false;
+	}
+#else
+	for (size_t i = 0; i < 6; ++i)
+	{
+		float dist = d[i]
+			+ std::max(a[i] * box.min.x, a[i] * box.max.x)
+			+ std::max(b[i] * box.min.y, b[i] * box.max.y)
+			+ std::max(c[i] * box.min.z, c[i] * box.max.z);
+
+		if (dist < 0.0f)
+			return false;
+	}
+#endif
+
+	return true;
+}
+
+OcclusionBuffer::OcclusionBuffer(ivec2 _size)
+	: size{ _size }
+	, depth((size_t)_size.x * _size.y, 1.0f)
+{
+}
+
+void OcclusionBuffer::begin(mat4 const &_view_projection)
+{
+	view_projection = _view_projection;
+	std::fill(depth.begin(), depth.end(), 1.0f);
+}
+
+static vec4 transform(mat4 const &m, vec3 p)
+{
+	return m.col0 * p.x + m.col1 * p.y + m.col2 * p.z + m.col3;
+}
+
+void OcclusionBuffer::add_occluder(std::span<const vec3> positions, std::span<const uint32_t> indices)
+{
+	vec2 const half_size = vec2(size) * 0.5f;
+
+	for (size_t i = 0; i + 3 <= indices.size(); i += 3)
+	{
+		vec3 screen[3];
+		bool clipped = false;
+
+		for (size_t k = 0; k < 3; ++k)
+		{
+			vec4 clip = transform(view_projection, positions[indices[i + k]]);
+
+			// Skipping an occluder only makes culling less effective, never wrong
+			if (clip.w < MIN_CLIP_W)
+			{
+				clipped = true;
+				break;
+			}
+
+			screen[k] = vec3(
+				(clip.x / clip.w + 1.0f) * half_size.x,
+				(clip.y / clip.w + 1.0f) * half_size.y,
+				std::clamp(clip.z / clip.w * 0.5f + 0.5f, 0.0f, 1.0f));
+		}
+
+		if (clipped)
+			continue;
+
+		// Edge functions e(x, y) = A*x + B*y + C, flipped so that the inside is positive for either winding
+		float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+
+		if (area == 0.0f || !std::isfinite(area))
+			continue;
+
+		float const sign = area > 0.0f ? 1.0f : -1.0f;
+		float A[3], B[3], C[3];
+
+		for (size_t k = 0; k < 3; ++k)
+		{
+			vec3 const &p0 = screen[k];
+			vec3 const &p1 = screen[(k + 1) % 3];
+
+			A[k] = (p0.y - p1.y) * sign;
+			B[k] = (p1.x - p0.x) * sign;
+			C[k] = (p0.x * p1.y - p0.y * p1.x) * sign;
+		}
+
+		float const tri_depth = std::max({ screen[0].z, screen[1].z, screen[2].z });
+
+		int x0 = std::max(0, (int)std::floor(std::min({ screen[0].x, screen[1].x, screen[2].x })));
+		int y0 = std::max(0, (int)std::floor(std::min({ screen[0].y, screen[1].y, screen[2].y })));
+		int x1 = std::min(size.x - 1, (int)std::floor(std::max({ screen[0].x, screen[1].x, screen[2].x })));
+		int y1 = std::min(size.y - 1, (int)std::floor(std::max({ screen[0].y, screen[1].y, screen[2].y })));
+
+		for (int y = y0; y <= y1; ++y)
+		{
+			for (int x = x0; x <= x1; ++x)
+			{
+				float const cx = (float)x + 0.5f;
+				float const cy = (float)y + 0.5f;
+
+				// Sampled at pixel centers, shared edges are covered by both triangles so meshes stay watertight
+				if (A[0] * cx + B[0] * cy + C[0] >= 0.0f && A[1] * cx + B[1] * cy + C[1] >= 0.0f && A[2] * cx + B[2] * cy + C[2] >= 0.0f)
+				{
+					float &d = depth[(size_t)y * size.x + x];
+					d = std::min(d, tri_depth);
+				}
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::is_visible(AABB3 const &box) const
+{
+	vec2 const half_size = vec2(size) * 0.5f;
+
+	float min_x = std::numeric_limits<float>::max(), max_x = -std::numeric_limits<float>::max();
+	float min_y = std::numeric_limits<float>::max(), max_y = -std::numeric_limits<float>::max();
+	float min_depth = 1.0f;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner(
+			i & 1 ? box.max.x : box.min.x,
+			i & 2 ? box.max.y : box.min.y,
+			i & 4 ? box.max.z : box.min.z);
+
+		vec4 clip = transform(view_projection, corner);
+
+		// Reaches behind the eye, its screen rectangle is unbounded
+		if (clip.w < MIN_CLIP_W)
+			return true;
+
+		float x = (clip.x / clip.w + 1.0f) * half_size.x;
+		float y = (clip.y / clip.w + 1.0f) * half_size.y;
+
+		min_x = std::min(min_x, x);
+		max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y);
+		max_y = std::max(max_y, y);
+		min_depth = std::min(min_depth, clip.z / clip.w * 0.5f + 0.5f);
+	}
+
+	// One pixel margin, occluders only cover the pixel centers they were sampled at
+	int x0 = std::max(0, (int)std::floor(min_x) - 1);
+	int y0 = std::max(0, (int)std::floor(min_y) - 1);
+	int x1 = std::min(size.x - 1, (int)std::floor(max_x) + 1);
+	int y1 = std::min(size.y - 1, (int)std::floor(max_y) + 1);
+
+	// Off screen, the frustum test decides
+	if (x0 > x1 || y0 > y1)
+		return true;
+
+	for (int y = y0; y <= y1; ++y)
+	{
+		float const *row = depth.data() + (size_t)y * size.x;
+
+		for (int x = x0; x <= x1; ++x)
+		{
+			if (min_depth <= row[x])
+				return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,70 @@
+#include "gfxengine/dynamic_resolution.hpp"
+
+#include "gfxengine/graphics.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+DynamicResolution::DynamicResolution(DynamicResolutionParams const &params)
+{
+	set_params(params);
+}
+
+void DynamicResolution::set_params(DynamicResolutionParams const &_params)
+{
+	params = _params;
+	scale = std::clamp(scale, params.min_scale, params.max_scale);
+}
+
+float DynamicResolution::update(Graphics &graphics, double cpu_time)
+{
+	double gpu_time = graphics.get_gpu_frame_time();
+	float new_scale = update(gpu_time > 0.0 ? gpu_time : cpu_time);
+
+	if (new_scale != graphics.get_render_scale())
+		graphics.set_render_scale(new_scale);
+
+	return new_scale;
+}
+
+float DynamicResolution::update(double frame_time)
+{
+	if (frame_time <= 0.0)
+		return scale;
+
+	if (smoothed_time == 0.0)
+		smoothed_time = frame_time;
+	else
+		smoothed_time += (frame_time - smoothed_time) * 0.2;
+
+	if (cooldown > 0)
+	{
+		--cooldown;
+		return scale;
+	}
+
+	// Hold while between headroom and budget, otherwise aim for the middle of that band
+	if (smoothed_time <= params.frame_budget && smoothed_time >= params.frame_budget * params.headroom)
+		return scale;
+
+	double target = params.frame_budget * (1.0 + params.headroom) * 0.5;
+
+	// Cost follows the pixel count, which is scale squared
+	float desired = scale * (float)std::sqrt(target / smoothed_time);
+	desired = std::clamp(desired, scale - params.max_step_down, scale + params.max_step_up);
+	desired = std::clamp(desired, params.min_scale, params.max_scale);
+
+	// Steps of 1/64, tiny changes only make the image swim
+	desired = std::round(desired * 64.0f) / 64.0f;
+	desired = std::clamp(desired, params.min_scale, params.max_scale);
+
+	if (desired == scale)
+		return scale;
+
+	// Predict the new cost until measurements catch up
+	smoothed_time *= (desired * desired) / (scale * scale);
+	scale = desired;
+	cooldown = params.cooldown_frames;
+
+	return scale;
+}
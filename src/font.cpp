@@ -0,0 +1,504 @@
+#include "gfxengine/font.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+// Composite glyphs referencing each other deeper than this are treated as broken
+static constexpr int MAX_COMPONENT_DEPTH = 8;
+
+static uint32_t tag(char const (&name)[5])
+{
+	return (uint32_t)(uint8_t)name[0] << 24 | (uint32_t)(uint8_t)name[1] << 16 | (uint32_t)(uint8_t)name[2] << 8 | (uint32_t)(uint8_t)name[3];
+}
+
+Font Font::load_sync(std::string_view file_name)
+{
+	FILE *f = fopen(std::string(file_name).c_str(), "rb");
+
+	if (!f)
+		throw 1;
+
+	fseek(f, 0, SEEK_END);
+	size_t size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	std::vector<uint8_t> data(size);
+	size_t read = fread(data.data(), 1, size, f);
+	fclose(f);
+
+	if (read != size)
+		throw 1;
+
+	return Font(std::move(data));
+}
+
+Font Font::load(std::span<const uint8_t> file_data)
+{
+	return Font(std::vector<uint8_t>(file_data.begin(), file_data.end()));
+}
+
+uint16_t Font::u16(size_t offset) const
+{
+	if (offset + 2 > data.size())
+		throw 1;
+
+	return (uint16_t)(data[offset] << 8 | data[offset + 1]);
+}
+
+uint32_t Font::u32(size_t offset) const
+{
+	if (offset + 4 > data.size())
+		throw 1;
+
+	return (uint32_t)data[offset] << 24 | (uint32_t)data[offset + 1] << 16 | (uint32_t)data[offset + 2] << 8 | (uint32_t)data[offset + 3];
+}
+
+Font::Font(std::vector<uint8_t> _data)
+	: data{ std::move(_data) }
+{
+	uint32_t const version = u32(0);
+
+	// Fonts with CFF outlines ('OTTO') have no glyf table
+	if (version != 0x00010000 && version != tag("true"))
+		throw 1;
+
+	uint32_t head = 0;
+	uint32_t maxp = 0;
+	uint32_t hhea = 0;
+	uint32_t kern = 0;
+
+	uint16_t const table_count = u16(4);
+
+	for (uint16_t i = 0; i < table_count; ++i)
+	{
+		size_t const record = 12 + (size_t)i * 16;
+		uint32_t const name = u32(record);
+		uint32_t const offset = u32(record + 8);
+
+		if (name == tag("head")) head = offset;
+		else if (name == tag("maxp")) maxp = offset;
+		else if (name == tag("hhea")) hhea = offset;
+		else if (name == tag("hmtx")) hmtx = offset;
+		else if (name == tag("loca")) loca = offset;
+		else if (name == tag("glyf")) glyf = offset;
+		else if (name == tag("cmap")) cmap = offset;
+		else if (name == tag("kern")) kern = offset;
+	}
+
+	if (!head || !maxp || !hhea || !hmtx || !loca || !glyf || !cmap)
+		throw 1;
+
+	metrics.units_per_em = (float)u16(head + 18);
+	long_loca = i16(head + 50) != 0;
+	glyph_count = u16(maxp + 4);
+	metrics.ascent = (float)i16(hhea + 4);
+	metrics.descent = (float)i16(hhea + 6);
+	metrics.line_gap = (float)i16(hhea + 8);
+	metric_count = u16(hhea + 34);
+
+	if (metrics.units_per_em <= 0.0f || metric_count == 0)
+		throw 1;
+
+	// Unicode subtable, full repertoire before BMP only
+	uint32_t best = 0;
+	int best_rank = 0;
+	uint16_t const subtable_count = u16(cmap + 2);
+
+	for (uint16_t i = 0; i < subtable_count; ++i)
+	{
+		size_t const record = cmap + 4 + (size_t)i * 8;
+		uint16_t const platform = u16(record);
+		uint16_t const encoding = u16(record + 2);
+		uint32_t const offset = cmap + u32(record + 4);
+		uint16_t const format = u16(offset);
+
+		int rank = 0;
+
+		if (format == 12 && ((platform == 3 && encoding == 10) || platform == 0))
+			rank = 2;
+		else if (format == 4 && ((platform == 3 && encoding == 1) || platform == 0))
+			rank = 1;
+
+		if (rank > best_rank)
+		{
+			best = offset;
+			best_rank = rank;
+		}
+	}
+
+	if (!best)
+		throw 1;
+
+	cmap = best;
+	cmap_format = u16(cmap);
+
+	for (char32_t c = 0; c < 128; ++c)
+		ascii_glyphs[c] = lookup_glyph(c);
+
+	// First horizontal format 0 subtable of the old style kern table
+	if (kern && u16(kern) == 0)
+	{
+		size_t offset = kern + 4;
+		uint16_t const count = u16(kern + 2);
+
+		for (uint16_t i = 0; i < count; ++i)
+		{
+			uint16_t const length = u16(offset + 2);
+			uint16_t const coverage = u16(offset + 4);
+
+			if ((coverage >> 8) == 0 && (coverage & 0x7) == 1)
+			{
+				kern_pair_count = u16(offset + 6);
+				kern_pairs = (uint32_t)offset + 14;
+				break;
+			}
+
+			offset += length;
+		}
+	}
+}
+
+uint16_t Font::lookup_glyph(char32_t codepoint) const
+{
+	if (cmap_format == 12)
+	{
+		uint32_t const group_count = u32(cmap + 12);
+		uint32_t low = 0;
+		uint32_t high = group_count;
+
+		while (low < high)
+		{
+			uint32_t const mid = (low + high) / 2;
+			size_t const group = cmap + 16 + (size_t)mid * 12;
+
+			if (codepoint < u32(group))
+				high = mid;
+			else if (codepoint > u32(group + 4))
+				low = mid + 1;
+			else
+				return (uint16_t)(u32(group + 8) + (codepoint - u32(group)));
+		}
+
+		return 0;
+	}
+
+	if (codepoint > 0xFFFF)
+		return 0;
+
+	size_t const segment_count = u16(cmap + 6) / 2;
+	size_t const end_codes = cmap + 14;
+	size_t const start_codes = end_codes + segment_count * 2 + 2;
+	size_t const deltas = start_codes + segment_count * 2;
+	size_t const range_offsets = deltas + segment_count * 2;
+
+	// First segment ending at or after codepoint
+	size_t low = 0;
+	size_t high = segment_count;
+
+	while (low < high)
+	{
+		size_t const mid = (low + high) / 2;
+
+		if (u16(end_codes + mid * 2) < codepoint)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == segment_count)
+		return 0;
+
+	uint16_t const start = u16(start_codes + low * 2);
+
+	if (codepoint < start)
+		return 0;
+
+	uint16_t const delta = u16(deltas + low * 2);
+	uint16_t const range_offset = u16(range_offsets + low * 2);
+
+	if (range_offset == 0)
+		return (uint16_t)(codepoint + delta);
+
+	uint16_t const glyph = u16(range_offsets + low * 2 + range_offset + (codepoint - start) * 2);
+	return glyph ? (uint16_t)(glyph + delta) : 0;
+}
+
+float Font::get_advance(uint16_t glyph) const
+{
+	uint16_t const metric = std::min<uint16_t>(glyph, metric_count - 1);
+	return (float)u16(hmtx + (size_t)metric * 4);
+}
+
+float Font::get_kerning(uint16_t left, uint16_t right) const
+{
+	// Pairs are sorted by both glyphs as one 32-bit key
+	uint32_t const key = (uint32_t)left << 16 | right;
+	uint32_t low = 0;
+	uint32_t high = kern_pair_count;
+
+	while (low < high)
+	{
+		uint32_t const mid = (low + high) / 2;
+		uint32_t const pair = u32(kern_pairs + (size_t)mid * 6);
+
+		if (pair < key)
+			low = mid + 1;
+		else if (pair > key)
+			high = mid;
+		else
+			return (float)i16(kern_pairs + (size_t)mid * 6 + 4);
+	}
+
+	return 0.0f;
+}
+
+GlyphOutline Font::get_outline(uint16_t glyph) const
+{
+	GlyphOutline out;
+	append_outline(glyph, vec2(1.0f, 0.0f), vec2(0.0f, 1.0f), vec2(0.0f, 0.0f), out, 0);
+
+	if (!out.curves.empty())
+	{
+		out.min = out.curves[0].p0;
+		out.max = out.curves[0].p0;
+
+		// Control points bound the curves
+		for (GlyphCurve const &c : out.curves)
+		{
+			for (vec2 p : { c.p0, c.p1, c.p2 })
+			{
+				out.min = vec2(std::min(out.min.x, p.x), std::min(out.min.y, p.y));
+				out.max = vec2(std::max(out.max.x, p.x), std::max(out.max.y, p.y));
+			}
+		}
+	}
+
+	return out;
+}
+
+void Font::append_outline(uint16_t glyph, vec2 x_axis, vec2 y_axis, vec2 offset, GlyphOutline &out, int depth) const
+{
+	if (glyph >= glyph_count || depth > MAX_COMPONENT_DEPTH)
+		throw 1;
+
+	uint32_t const start = long_loca ? u32(loca + (size_t)glyph * 4) : u16(loca + (size_t)glyph * 2) * 2u;
+	uint32_t const end = long_loca ? u32(loca + (size_t)glyph * 4 + 4) : u16(loca + (size_t)glyph * 2 + 2) * 2u;
+
+	// Empty glyphs like space
+	if (end <= start)
+		return;
+
+	size_t p = glyf + start;
+	int16_t const contour_count = i16(p);
+	p += 10;
+
+	auto transform = [&](vec2 v) {
+		return x_axis * v.x + y_axis * v.y + offset;
+	};
+
+	if (contour_count < 0)
+	{
+		enum : uint16_t
+		{
+			ARGS_ARE_WORDS = 0x1,
+			ARGS_ARE_XY = 0x2,
+			HAVE_SCALE = 0x8,
+			MORE_COMPONENTS = 0x20,
+			HAVE_XY_SCALE = 0x40,
+			HAVE_2X2 = 0x80,
+		};
+
+		uint16_t flags;
+
+		do
+		{
+			flags = u16(p);
+			uint16_t const component = u16(p + 2);
+			p += 4;
+
+			vec2 move(0.0f, 0.0f);
+
+			if (flags & ARGS_ARE_WORDS)
+			{
+				move = vec2((float)i16(p), (float)i16(p + 2));
+				p += 4;
+			}
+			else
+			{
+				move = vec2((float)(int8_t)(u16(p) >> 8), (float)(int8_t)(u16(p) & 0xFF));
+				p += 2;
+			}
+
+			// Matching points instead of an offset isn't supported, the component stays in place
+			if (!(flags & ARGS_ARE_XY))
+				move = vec2(0.0f, 0.0f);
+
+			vec2 cx(1.0f, 0.0f);
+			vec2 cy(0.0f, 1.0f);
+
+			// F2Dot14
+			auto f2dot14 = [&](size_t at) {
+				return (float)i16(at) / 16384.0f;
+			};
+
+			if (flags & HAVE_SCALE)
+			{
+				float const s = f2dot14(p);
+				cx = vec2(s, 0.0f);
+				cy = vec2(0.0f, s);
+				p += 2;
+			}
+			else if (flags & HAVE_XY_SCALE)
+			{
+				cx = vec2(f2dot14(p), 0.0f);
+				cy = vec2(0.0f, f2dot14(p + 2));
+				p += 4;
+			}
+			else if (flags & HAVE_2X2)
+			{
+				cx = vec2(f2dot14(p), f2dot14(p + 2));
+				cy = vec2(f2dot14(p + 4), f2dot14(p + 6));
+				p += 8;
+			}
+
+			append_outline(component,
+				x_axis * cx.x + y_axis * cx.y,
+				x_axis * cy.x + y_axis * cy.y,
+				transform(move), out, depth + 1);
+		} while (flags & MORE_COMPONENTS);
+
+		return;
+	}
+
+	enum : uint8_t
+	{
+		ON_CURVE = 0x1,
+		X_SHORT = 0x2,
+		Y_SHORT = 0x4,
+		REPEAT = 0x8,
+		X_SAME_OR_POSITIVE = 0x10,
+		Y_SAME_OR_POSITIVE = 0x20,
+	};
+
+	size_t const contour_ends = p;
+	uint16_t const point_count = contour_count > 0 ? u16(contour_ends + (size_t)(contour_count - 1) * 2) + 1 : 0;
+	p += (size_t)contour_count * 2;
+	p += 2 + u16(p);
+
+	thread_local std::vector<uint8_t> flags;
+	thread_local std::vector<vec2> points;
+
+	flags.clear();
+
+	while (flags.size() < point_count)
+	{
+		if (p >= data.size())
+			throw 1;
+
+		uint8_t const f = data[p++];
+		size_t repeat = 1;
+
+		if (f & REPEAT)
+		{
+			if (p >= data.size())
+				throw 1;
+
+			repeat += data[p++];
+		}
+
+		flags.insert(flags.end(), std::min<size_t>(repeat, point_count - flags.size()), f);
+	}
+
+	points.resize(point_count);
+
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		uint8_t const is_short = axis == 0 ? X_SHORT : Y_SHORT;
+		uint8_t const same_or_positive = axis == 0 ? X_SAME_OR_POSITIVE : Y_SAME_OR_POSITIVE;
+		int32_t value = 0;
+
+		for (uint16_t i = 0; i < point_count; ++i)
+		{
+			if (flags[i] & is_short)
+			{
+				if (p >= data.size())
+					throw 1;
+
+				int32_t const delta = data[p++];
+				value += (flags[i] & same_or_positive) ? delta : -delta;
+			}
+			else if (!(flags[i] & same_or_positive))
+			{
+				value += i16(p);
+				p += 2;
+			}
+
+			points[i][axis] = (float)value;
+		}
+	}
+
+	size_t first = 0;
+
+	for (int16_t c = 0; c < contour_count; ++c)
+	{
+		size_t const last = u16(contour_ends + (size_t)c * 2);
+
+		if (last < first || last >= point_count)
+			throw 1;
+
+		size_t const count = last - first + 1;
+
+		auto point = [&](size_t i) {
+			return points[first + i % count];
+		};
+
+		auto on_curve = [&](size_t i) {
+			return (flags[first + i % count] & ON_CURVE) != 0;
+		};
+
+		// Start on a point on the curve, or halfway between two control points when there is none
+		size_t begin = 0;
+
+		while (begin < count && !on_curve(begin))
+			++begin;
+
+		vec2 const start_point = begin < count ? point(begin) : (point(0) + point(1)) * 0.5f;
+		begin = begin < count ? begin + 1 : 1;
+
+		vec2 current = start_point;
+		vec2 control;
+		bool has_control = false;
+
+		auto add = [&](vec2 to) {
+			if (has_control)
+				out.curves.push_back({ transform(current), transform(control), transform(to) });
+			else if (to != current)
+				out.curves.push_back({ transform(current), transform((current + to) * 0.5f), transform(to) });
+
+			current = to;
+		};
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			vec2 const v = point(begin + i);
+
+			if (on_curve(begin + i))
+			{
+				add(v);
+				has_control = false;
+				continue;
+			}
+
+			// Two control points in a row imply a point on the curve between them
+			if (has_control)
+				add((control + v) * 0.5f);
+
+			control = v;
+			has_control = true;
+		}
+
+		add(start_point);
+
+		first = last + 1;
+	}
+}
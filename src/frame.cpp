@@ -1,63 +1,221 @@
 #include "gfxengine/frame.hpp"
 
-static void copy_vertices_adjusted(std::shared_ptr<Material> const &material, std::vector<uint8_t> &vertices, std::vector<uint32_t> &indices, std::span<const uint8_t> _vertices, std::span<const uint32_t> _indices)
+#include "gfxengine/mesh_optimizer.hpp"
+
+// Submissions are merged into the previous range by offsetting their indices while it stays within this many
+// vertices, which keeps it drawable with 16-bit indices. Larger ones start a range at their base vertex instead.
+// 0xFFFF itself is the 16-bit primitive restart index.
+static constexpr size_t MAX_MERGED_RANGE_VERTICES = 0xFFFF;
+
+static bool is_strip(PrimitiveTopology topology)
+{
+	return topology == PrimitiveTopology::TriangleStrip || topology == PrimitiveTopology::LineStrip;
+}
+
+static void offset_indices(std::span<uint32_t> indices, uint32_t offset)
+{
+	for (uint32_t &i : indices)
+	{
+		if (i != PRIMITIVE_RESTART_INDEX)
+			i += offset;
+	}
+}
+
+// Appending to a strip would continue it, a restart keeps the new one separate
+static void separate_strips(std::vector<uint32_t> &indices, PrimitiveTopology topology)
+{
+	if (is_strip(topology) && !indices.empty() && indices.back() != PRIMITIVE_RESTART_INDEX)
+		indices.push_back(PRIMITIVE_RESTART_INDEX);
+}
+
+static void copy_vertices_adjusted(std::shared_ptr<Material> const &material, std::vector<uint8_t> &vertices, std::vector<uint32_t> &indices, std::span<const uint8_t> _vertices, std::span<const uint32_t> _indices, PrimitiveTopology topology)
 {
 	size_t prev_vertices = vertices.size() / material->attribute_info.total_byte_size;
+
+	separate_strips(indices, topology);
 	size_t prev_indices = indices.size();
 
 	vertices.insert(vertices.end(), _vertices.begin(), _vertices.end());
 	indices.insert(indices.end(), _indices.begin(), _indices.end());
 
-	size_t new_indices = indices.size();
-
-	for (size_t i = prev_indices; i != new_indices; ++i)
-		indices[i] += (uint32_t)prev_vertices;
+	offset_indices(std::span(indices).subspan(prev_indices), (uint32_t)prev_vertices);
 }
 
-void FrameCacheVertices::add_vertices(std::shared_ptr<Material> const &material, std::span<const uint8_t> _vertices, std::span<const uint32_t> _indices)
+void FrameCacheVertices::add_vertices(std::shared_ptr<Material> const &material, std::span<const uint8_t> _vertices, std::span<const uint32_t> _indices, PrimitiveTopology _topology)
 {
 	// TODO: assert same material attributes
-	copy_vertices_adjusted(material, vertices, indices, _vertices, _indices);
+	if (vertices.empty() && indices.empty())
+		topology = _topology;
+	else if (topology != _topology)
+		throw 1;
+
+	copy_vertices_adjusted(material, vertices, indices, _vertices, _indices, topology);
 }
 
-void Frame::add_vertices(std::shared_ptr<Material> const &material, std::span<const uint8_t> _vertices, std::span<const uint32_t> _indices)
+void FrameCacheVertices::optimize(ShaderValuesInfo const &attributes)
 {
-	if (!caches.empty())
-	{
-		for (FrameCacheVertices *c : caches)
-			c->add_vertices(material, _vertices, _indices);
+	size_t stride = attributes.total_byte_size;
 
+	if (stride == 0 || indices.empty() || topology != PrimitiveTopology::Triangles)
 		return;
-	}
 
+	optimize_vertex_cache(indices, vertices.size() / stride);
+	optimize_vertex_fetch(vertices, stride, indices);
+}
+
+static DrawTaskTypes::DrawMaterial &get_draw_material(std::vector<DrawTask> &tasks, std::shared_ptr<Material> const &material, PrimitiveTopology topology)
+{
 	if (!tasks.empty())
 	{
 		if (DrawTaskTypes::DrawMaterial *prev = std::get_if<DrawTaskTypes::DrawMaterial>(&tasks.back()))
 		{
-			if (prev->material == material)
-			{
-				copy_vertices_adjusted(material, prev->vertices, prev->indices, _vertices, _indices);
-				return;
-			}
+			if (prev->material == material && prev->topology == topology)
+				return *prev;
 		}
 	}
 
-	tasks.push_back(DrawTask(DrawTaskTypes::DrawMaterial{
-		.material = material,
-		.vertices = std::vector<uint8_t>(_vertices.begin(), _vertices.end()),
-		.indices = std::vector<uint32_t>(_indices.begin(), _indices.end()),
-	}));
+	tasks.push_back(DrawTask(DrawTaskTypes::DrawMaterial{ .material = material, .topology = topology }));
+	return std::get<DrawTaskTypes::DrawMaterial>(tasks.back());
+}
+
+template <typename TVertex>
+static VertexReservation<TVertex> reserve_back(std::vector<TVertex> &vertices, std::vector<uint32_t> &indices, size_t vertex_count, size_t index_count)
+{
+	size_t first_vertex = vertices.size();
+	size_t first_index = indices.size();
+
+	vertices.resize(first_vertex + vertex_count);
+	indices.resize(first_index + index_count);
+
+	return { std::span(vertices).subspan(first_vertex), std::span(indices).subspan(first_index) };
+}
+
+void Frame::add_vertices(std::shared_ptr<Material> const &material, std::span<const uint8_t> _vertices, std::span<const uint32_t> _indices, PrimitiveTopology topology)
+{
+	finish_reservation();
+
+	if (!caches.empty())
+	{
+		for (FrameCacheVertices *c : caches)
+			c->add_vertices(material, _vertices, _indices, topology);
+
+		return;
+	}
+
+	auto &draw = get_draw_material(tasks, material, topology);
+	uint32_t vertex_count = (uint32_t)(_vertices.size() / material->attribute_info.total_byte_size);
+	uint32_t first_vertex = (uint32_t)(draw.vertices.size() / material->attribute_info.total_byte_size);
+
+	draw.vertices.insert(draw.vertices.end(), _vertices.begin(), _vertices.end());
+
+	if (!draw.ranges.empty() && draw.ranges.back().vertex_count + vertex_count <= MAX_MERGED_RANGE_VERTICES)
+	{
+		auto &range = draw.ranges.back();
+
+		separate_strips(draw.indices, topology);
+		size_t first_index = draw.indices.size();
+		draw.indices.insert(draw.indices.end(), _indices.begin(), _indices.end());
+		offset_indices(std::span(draw.indices).subspan(first_index), range.vertex_count);
+
+		range.index_count = (uint32_t)(draw.indices.size() - range.first_index);
+		range.vertex_count += vertex_count;
+	}
+	else
+	{
+		draw.ranges.push_back({ (uint32_t)draw.indices.size(), (uint32_t)_indices.size(), first_vertex, vertex_count });
+		draw.indices.insert(draw.indices.end(), _indices.begin(), _indices.end());
+	}
+}
+
+VertexReservation<uint8_t> Frame::reserve_vertices(std::shared_ptr<Material> const &material, size_t vertex_count, size_t index_count, PrimitiveTopology topology)
+{
+	finish_reservation();
+
+	size_t stride = material->attribute_info.total_byte_size;
+
+	if (!caches.empty())
+	{
+		FrameCacheVertices &c = *caches.back();
+
+		if (c.vertices.empty() && c.indices.empty())
+			c.topology = topology;
+		else if (c.topology != topology)
+			throw 1;
+
+		separate_strips(c.indices, topology);
+
+		pending_reservation = PendingReservation{
+			.material = material,
+			.first_vertex_byte = c.vertices.size(),
+			.first_index = c.indices.size(),
+			.base_vertex = (uint32_t)(c.vertices.size() / stride),
+			.topology = topology,
+		};
+
+		return reserve_back(c.vertices, c.indices, vertex_count * stride, index_count);
+	}
+
+	// Its own range, so strips need no restart in front
+	auto &draw = get_draw_material(tasks, material, topology);
+
+	draw.ranges.push_back({
+		(uint32_t)draw.indices.size(),
+		(uint32_t)index_count,
+		(uint32_t)(draw.vertices.size() / stride),
+		(uint32_t)vertex_count,
+	});
+
+	return reserve_back(draw.vertices, draw.indices, vertex_count * stride, index_count);
+}
+
+void Frame::finish_reservation()
+{
+	if (!pending_reservation)
+		return;
+
+	auto const &r = *pending_reservation;
+	FrameCacheVertices &c = *caches.back();
+	std::span<const uint8_t> vertices = std::span<const uint8_t>(c.vertices).subspan(r.first_vertex_byte);
+	std::span<uint32_t> indices = std::span(c.indices).subspan(r.first_index);
+
+	// Cached geometry is drawn with its indices as they are, that cost is paid once when recording it
+	for (size_t i = 0; i + 1 < caches.size(); ++i)
+		caches[i]->add_vertices(r.material, vertices, indices, r.topology);
+
+	offset_indices(indices, r.base_vertex);
+
+	pending_reservation.reset();
 }
 
 void Frame::add_cached_vertices(std::shared_ptr<Material> const &material, FrameCacheVertices const &c)
 {
-	add_vertices(material, c.vertices, c.indices);
+	add_vertices(material, c.vertices, c.indices, c.topology);
+}
+
+bool Frame::is_culled(AABB3 const &bounds)
+{
+	if (!cull_frustum->intersects(bounds))
+	{
+		++culled_frustum;
+		return true;
+	}
+
+	if (cull_occlusion && !cull_occlusion->is_visible(bounds))
+	{
+		++culled_occlusion;
+		return true;
+	}
+
+	return false;
 }
 
 FrameStats Frame::get_stats() const
 {
 	FrameStats result{};
 
+	result.culled_frustum = culled_frustum;
+	result.culled_occlusion = culled_occlusion;
+
 	for (auto const &task : tasks)
 	{
 		std::visit([&](auto const &content) {
@@ -84,3 +242,27 @@ FrameStats Frame::get_stats() const
 
 	return result;
 }
+
+void Frame::snapshot_uniforms()
+{
+	uniform_snapshots.clear();
+
+	Material const *prev = nullptr;
+
+	for (auto const &task : tasks)
+	{
+		Material const *material = nullptr;
+
+		if (auto const *content = std::get_if<DrawTaskTypes::DrawMaterial>(&task))
+			material = content->material.get();
+		else
+		if (auto const *content = std::get_if<DrawTaskTypes::DrawCached>(&task))
+			material = content->cache->get_material();
+
+		if (!material || material == prev)
+			continue;
+
+		prev = material;
+		uniform_snapshots.try_emplace(material, UniformSnapshot{ material->get_uniforms(), material->get_uniforms_version() });
+	}
+}
@@ -0,0 +1,124 @@
+#include "gfxengine/frame_pacer.hpp"
+
+#include "gfxengine/platform.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+// Submission in low latency mode is aimed this much before the deadline
+static constexpr double LOW_LATENCY_MARGIN = 0.001;
+
+FramePacer::FramePacer(Platform &platform, FramePacerParams const &params)
+	: platform{ platform }
+	, params{ params }
+{
+	double now = platform.get_time();
+
+	frame_start = now;
+	prev_frame_start = now;
+	deadline = now + (params.target_fps > 0.0 ? 1.0 / params.target_fps : 0.0);
+}
+
+void FramePacer::wait_until(double time)
+{
+	double remaining = time - platform.get_time();
+
+	if (remaining > params.spin_time)
+		platform.sleep(remaining - params.spin_time);
+
+	while (platform.get_time() < time)
+		std::this_thread::yield();
+}
+
+double FramePacer::begin_frame()
+{
+	if (params.target_fps > 0.0)
+	{
+		double period = 1.0 / params.target_fps;
+
+		if (params.low_latency)
+			wait_until(deadline - work_estimate - LOW_LATENCY_MARGIN);
+		else
+			wait_until(deadline - period);
+	}
+
+	frame_start = platform.get_time();
+	raw_delta = frame_start - prev_frame_start;
+	prev_frame_start = frame_start;
+
+	double delta = std::min(raw_delta, params.max_delta);
+
+	if (smoothed_delta == 0.0)
+		smoothed_delta = delta;
+	else
+		smoothed_delta += (delta - smoothed_delta) * params.delta_smoothing;
+
+	return smoothed_delta;
+}
+
+void FramePacer::end_frame()
+{
+	double now = platform.get_time();
+	double work = now - frame_start;
+
+	// Follow spikes immediately, decay slowly, low latency mode must not start too late
+	if (work > work_estimate)
+		work_estimate = work;
+	else
+		work_estimate += (work - work_estimate) * 0.05;
+
+	if (stats.frames != 0)
+	{
+		double interval = now - prev_submit;
+
+		// Welford's running variance
+		uint64_t n = stats.frames;
+		double prev_average = stats.average_interval;
+		stats.average_interval += (interval - prev_average) / (double)n;
+		interval_m2 += (interval - prev_average) * (interval - stats.average_interval);
+
+		stats.last_interval = interval;
+		stats.max_interval = std::max(stats.max_interval, interval);
+		stats.jitter = n > 1 ? std::sqrt(interval_m2 / (double)(n - 1)) : 0.0;
+	}
+
+	stats.average_work += (work - stats.average_work) / (double)(stats.frames + 1);
+	++stats.frames;
+	prev_submit = now;
+
+	if (params.target_fps > 0.0)
+	{
+		double period = 1.0 / params.target_fps;
+
+		if (now > deadline)
+			++stats.missed_deadlines;
+
+		deadline += period;
+
+		// More than a frame behind, resync instead of rushing several frames out
+		if (now > deadline)
+			deadline = now + period;
+	}
+	else
+	{
+		deadline = now;
+	}
+}
+
+void FramePacer::set_target_fps(double target_fps)
+{
+	params.target_fps = target_fps;
+	deadline = platform.get_time() + (target_fps > 0.0 ? 1.0 / target_fps : 0.0);
+}
+
+void FramePacer::set_low_latency(bool enable)
+{
+	params.low_latency = enable;
+}
+
+void FramePacer::reset_stats()
+{
+	stats = {};
+	interval_m2 = 0.0;
+}
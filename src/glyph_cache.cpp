@@ -0,0 +1,287 @@
+#include "gfxengine/glyph_cache.hpp"
+
+#include "gfxengine/worker_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Largest distance between a flattened curve and the real one, in pixels
+static constexpr float FLATTEN_TOLERANCE = 0.1f;
+static constexpr int MAX_CURVE_SEGMENTS = 16;
+
+GlyphBitmap generate_glyph_sdf(GlyphOutline const &outline, float scale, float spread)
+{
+	GlyphBitmap bitmap;
+
+	if (outline.empty())
+		return bitmap;
+
+	// Font units have y up, the bitmap has y down
+	float const x0 = std::floor(outline.min.x * scale - spread);
+	float const y0 = std::floor(-outline.max.y * scale - spread);
+	float const x1 = std::ceil(outline.max.x * scale + spread);
+	float const y1 = std::ceil(-outline.min.y * scale + spread);
+
+	bitmap.size = ivec2((int32_t)(x1 - x0), (int32_t)(y1 - y0));
+	bitmap.offset = vec2(x0, y0);
+	bitmap.rgba.assign((size_t)bitmap.size.x * (size_t)bitmap.size.y * 4, 255);
+
+	auto to_bitmap = [&](vec2 p) {
+		return vec2(p.x * scale - x0, -p.y * scale - y0);
+	};
+
+	struct Line
+	{
+		vec2 a;
+		vec2 b;
+		float min_y;
+		float max_y;
+	};
+
+	thread_local std::vector<Line> lines;
+	lines.clear();
+
+	for (GlyphCurve const &c : outline.curves)
+	{
+		vec2 const p0 = to_bitmap(c.p0);
+		vec2 const p1 = to_bitmap(c.p1);
+		vec2 const p2 = to_bitmap(c.p2);
+
+		// The flattening error of n segments is at most |p0 - 2 p1 + p2| / (8 n^2)
+		float const bend = (p0 - p1 * 2.0f + p2).length();
+		int const n = std::clamp((int)std::ceil(std::sqrt(bend / (8.0f * FLATTEN_TOLERANCE))), 1, MAX_CURVE_SEGMENTS);
+
+		vec2 a = p0;
+
+		for (int i = 1; i <= n; ++i)
+		{
+			float const t = (float)i / (float)n;
+			float const u = 1.0f - t;
+			vec2 const b = i == n ? p2 : p0 * (u * u) + p1 * (2.0f * u * t) + p2 * (t * t);
+
+			if (a != b)
+				lines.push_back({ a, b, std::min(a.y, b.y), std::max(a.y, b.y) });
+
+			a = b;
+		}
+	}
+
+	struct Crossing
+	{
+		float x;
+		int winding;
+	};
+
+	thread_local std::vector<Crossing> crossings;
+	thread_local std::vector<Line const *> near;
+
+	float const spread_squared = spread * spread;
+
+	for (int32_t y = 0; y < bitmap.size.y; ++y)
+	{
+		float const py = (float)y + 0.5f;
+
+		crossings.clear();
+		near.clear();
+
+		for (Line const &l : lines)
+		{
+			// Half open so a vertex shared by two lines is crossed once
+			if ((l.a.y <= py) != (l.b.y <= py))
+			{
+				float const t = (py - l.a.y) / (l.b.y - l.a.y);
+				crossings.push_back({ l.a.x + (l.b.x - l.a.x) * t, l.b.y > l.a.y ? 1 : -1 });
+			}
+
+			if (l.min_y - spread <= py && l.max_y + spread >= py)
+				near.push_back(&l);
+		}
+
+		std::sort(crossings.begin(), crossings.end(), [](Crossing const &a, Crossing const &b) { return a.x < b.x; });
+
+		size_t next_crossing = 0;
+		int winding = 0;
+		uint8_t *row = bitmap.rgba.data() + (size_t)y * (size_t)bitmap.size.x * 4;
+
+		for (int32_t x = 0; x < bitmap.size.x; ++x)
+		{
+			float const px = (float)x + 0.5f;
+
+			while (next_crossing < crossings.size() && crossings[next_crossing].x <= px)
+				winding += crossings[next_crossing++].winding;
+
+			float best = spread_squared;
+
+			for (Line const *l : near)
+			{
+				vec2 const ab = l->b - l->a;
+				vec2 const ap = vec2(px, py) - l->a;
+				float const t = std::clamp(ap.dot(ab) / ab.dot(ab), 0.0f, 1.0f);
+				vec2 const d = ap - ab * t;
+				best = std::min(best, d.dot(d));
+			}
+
+			float const distance = winding != 0 ? std::sqrt(best) : -std::sqrt(best);
+			float const value = std::clamp(0.5f + distance / (2.0f * spread), 0.0f, 1.0f);
+			row[x * 4 + 3] = (uint8_t)std::lround(value * 255.0f);
+		}
+	}
+
+	return bitmap;
+}
+
+// A glyph whose outline can't be read is cached as empty and draws nothing, on a pool thread the error would
+// end the program
+static GlyphBitmap rasterize_glyph(Font const &font, uint16_t glyph, float scale, float spread)
+{
+	try
+	{
+		return generate_glyph_sdf(font.get_outline(glyph), scale, spread);
+	}
+	catch (int)
+	{
+		return GlyphBitmap{};
+	}
+}
+
+GlyphCache::GlyphCache(WorkerPool *_pool, float _em_size, float _spread, ivec2 page_size, size_t max_pages)
+	: pool{ _pool }
+	, em_size{ _em_size }
+	, spread{ _spread }
+	, atlas{ page_size, 1, max_pages }
+{
+	if (em_size <= 0.0f || spread <= 0.0f)
+		throw 1;
+}
+
+uint16_t GlyphCache::add_font(std::shared_ptr<Font const> font)
+{
+	if (!font || fonts.size() > UINT16_MAX)
+		throw 1;
+
+	fonts.push_back(std::move(font));
+	return (uint16_t)(fonts.size() - 1);
+}
+
+bool GlyphCache::insert(Result &result)
+{
+	auto it = glyphs.find(result.key);
+
+	if (it == glyphs.end())
+		return true;
+
+	GlyphBitmap const &bitmap = result.bitmap;
+	ivec2 const page_size = atlas.get_max_page_size();
+	int32_t const padding = atlas.get_padding();
+
+	// Empty, or too large for any page
+	if (bitmap.size.x == 0 || bitmap.size.x + padding * 2 > page_size.x || bitmap.size.y + padding * 2 > page_size.y)
+	{
+		it->second.ready = true;
+		return true;
+	}
+
+	auto region = atlas.add(bitmap.rgba, bitmap.size);
+
+	if (!region)
+	{
+		auto lru = std::min_element(page_last_used.begin(), page_last_used.end());
+
+		if (lru == page_last_used.end() || *lru == frame)
+			return false;
+
+		uint32_t const page = (uint32_t)(lru - page_last_used.begin());
+		atlas.clear_page(page);
+
+		std::erase_if(glyphs, [&](auto const &g) {
+			return g.second.ready && g.second.glyph.region.size.x > 0 && g.second.glyph.region.page == page;
+		});
+
+		region = atlas.add(bitmap.rgba, bitmap.size);
+
+		if (!region)
+			return false;
+
+		it = glyphs.find(result.key);
+	}
+
+	if (page_last_used.size() < atlas.get_page_count())
+		page_last_used.resize(atlas.get_page_count(), 0);
+
+	page_last_used[region->page] = frame;
+
+	it->second.glyph = CachedGlyph{ *region, bitmap.offset };
+	it->second.ready = true;
+	return true;
+}
+
+CachedGlyph const *GlyphCache::find(uint16_t font, uint16_t glyph)
+{
+	uint32_t const key = (uint32_t)font << 16 | glyph;
+	auto [it, inserted] = glyphs.try_emplace(key);
+
+	if (!inserted)
+	{
+		if (!it->second.ready)
+			return nullptr;
+
+		if (it->second.glyph.region.size.x > 0)
+			page_last_used[it->second.glyph.region.page] = frame;
+
+		return &it->second.glyph;
+	}
+
+	std::shared_ptr<Font const> const &f = fonts.at(font);
+	float const scale = em_size / f->get_metrics().units_per_em;
+
+	if (!pool)
+	{
+		Result r{ key, rasterize_glyph(*f, glyph, scale, spread) };
+
+		if (!insert(r))
+		{
+			waiting.push_back(std::move(r));
+			return nullptr;
+		}
+
+		return &glyphs.find(key)->second.glyph;
+	}
+
+	++in_flight;
+
+	pool->submit([key, glyph, scale, spread = spread, font = f, results = results]() {
+		Result r{ key, rasterize_glyph(*font, glyph, scale, spread) };
+
+		std::lock_guard lock(results->mutex);
+		results->done.push_back(std::move(r));
+	});
+
+	return nullptr;
+}
+
+void GlyphCache::update()
+{
+	++frame;
+
+	std::vector<Result> done;
+
+	{
+		std::lock_guard lock(results->mutex);
+		std::swap(done, results->done);
+	}
+
+	in_flight -= done.size();
+
+	// Kept back while every page holds glyphs of the current frame
+	std::vector<Result> retry;
+	std::swap(retry, waiting);
+
+	for (auto *list : { &retry, &done })
+	{
+		for (Result &r : *list)
+		{
+			if (!insert(r))
+				waiting.push_back(std::move(r));
+		}
+	}
+}
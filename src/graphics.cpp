@@ -1,15 +1,33 @@
 #include "gfxengine/graphics.hpp"
 
 #include "gfxengine/frame.hpp"
+#include "gfxengine/image.hpp"
+#include "gfxengine/logger.hpp"
+#include "gfxengine/texture_atlas.hpp"
 
 #include <glad/glad.h>
 
 #include <algorithm>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <limits>
+#include <deque>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <unordered_map>
+
+#include "private/range_allocator.hpp"
+#include "private/gl_worker_context.hpp"
 
 
 static constexpr GLenum type2gltype(ShaderFieldType t)
 {
-	static_assert(ShaderFieldType_version == 2, "Update type2gltype::table");
+	static_assert(ShaderFieldType_version == 3, "Update type2gltype::table");
 	constexpr GLenum table[]{
 		GL_BYTE, GL_UNSIGNED_BYTE,
 		GL_SHORT, GL_UNSIGNED_SHORT,
@@ -17,8 +35,44 @@ static constexpr GLenum type2gltype(ShaderFieldType t)
 		0, 0, // I64 U64
 		GL_FLOAT, GL_DOUBLE,
 		0, // Matrix4
-		0, 0, 0, 0, // vec
+		GL_FLOAT, GL_FLOAT, GL_FLOAT, GL_FLOAT, // vec
 		0, // Texture
+		GL_HALF_FLOAT,
+		GL_INT_2_10_10_10_REV, GL_UNSIGNED_INT_2_10_10_10_REV,
+	};
+
+	return table[size_t(t)];
+}
+
+static constexpr GLenum topology2glmode(PrimitiveTopology t)
+{
+	static_assert(PrimitiveTopology_version == 1, "Update topology2glmode::table");
+	constexpr GLenum table[]{
+		GL_TRIANGLES,
+		GL_TRIANGLE_STRIP,
+		GL_LINES,
+		GL_LINE_STRIP,
+		GL_POINTS,
+	};
+
+	return table[size_t(t)];
+}
+
+// Components of one ShaderFieldInfo::count as a vertex attribute
+static constexpr GLint type2glcomponents(ShaderFieldType t)
+{
+	static_assert(ShaderFieldType_version == 3, "Update type2glcomponents::table");
+	constexpr GLint table[]{
+		1, 1,
+		1, 1,
+		1, 1,
+		1, 1,
+		1, 1,
+		16,
+		1, 2, 3, 4,
+		0,
+		1,
+		4, 4,
 	};
 
 	return table[size_t(t)];
@@ -164,11 +218,31 @@ struct Buffer
 
 struct Buffers
 {
-	VertexArray vao{};
 	Buffer vbo{ GL_ARRAY_BUFFER };
 	Buffer ebo{ GL_ELEMENT_ARRAY_BUFFER };
 };
 
+// For calls whose errors are expected and handled, debug_handler would throw on them
+struct DebugOutputOff
+{
+	GLboolean enabled = glIsEnabled(GL_DEBUG_OUTPUT);
+
+	DebugOutputOff()
+	{
+		if (enabled)
+			glDisable(GL_DEBUG_OUTPUT);
+	}
+
+	~DebugOutputOff()
+	{
+		if (enabled)
+			glEnable(GL_DEBUG_OUTPUT);
+	}
+
+	DebugOutputOff(DebugOutputOff const &) = delete;
+	DebugOutputOff &operator = (DebugOutputOff const &) = delete;
+};
+
 struct Shader
 {
 	MoveOnly<GLuint, decltype([](GLuint v) { glDeleteShader(v); })> shader;
@@ -180,23 +254,52 @@ struct Shader
 		type = _type;
 	}
 
-	static Shader compile(GLenum _type, char const *source)
+	// Doesn't wait for the compilation, with parallel compile the driver finishes it on its own threads
+	static Shader begin_compile(GLenum _type, char const *source)
 	{
 		Shader result(_type);
 
 		glShaderSource(result.shader, 1, &source, nullptr);
 		glCompileShader(result.shader);
 
-		if (GLint success; glGetShaderiv(result.shader, GL_COMPILE_STATUS, &success), !success)
-		{
-			char buff[1024];
-			glGetShaderInfoLog(result.shader, sizeof(buff), nullptr, buff);
-			throw 1;
-			// std::cout << "glCompileShader vertexShader error: " << buff << "\n";
-		}
+		return result;
+	}
 
+	static Shader compile(GLenum _type, char const *source)
+	{
+		Shader result = begin_compile(_type, source);
+		result.check();
 		return result;
 	}
+
+	[[nodiscard]]
+	bool is_compiled() const
+	{
+		GLint success = GL_FALSE;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		return success;
+	}
+
+	[[nodiscard]]
+	std::string get_info_log() const
+	{
+		GLint length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+
+		std::string log(length, '\0');
+
+		if (length != 0)
+			glGetShaderInfoLog(shader, length, &length, log.data());
+
+		log.resize(length);
+		return log;
+	}
+
+	void check() const
+	{
+		if (!is_compiled())
+			throw 1;
+	}
 };
 
 struct Program
@@ -223,333 +326,1894 @@ struct Program
 		return glGetUniformLocation(program, name);
 	}
 
-	static Program link(std::span<const Shader> shaders)
+	// Attribute i is bound to location i unless the shader says otherwise, so equal attribute lists give equal layouts.
+	// Doesn't wait for the link, see Shader::begin_compile.
+	static Program begin_link(std::span<const Shader> shaders, std::span<const ShaderFieldInfo> attributes = {})
 	{
 		Program result;
 
 		for (auto const &shader : shaders)
 			glAttachShader(result.program, shader.shader);
 
+		for (size_t i = 0; i < attributes.size(); ++i)
+			glBindAttribLocation(result.program, (GLuint)i, attributes[i].name.c_str());
+
+		glProgramParameteri(result.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(result.program);
 
-		if (GLint success; glGetProgramiv(result.program, GL_LINK_STATUS, &success), !success)
-		{
-			char buff[1024];
-			glGetProgramInfoLog(result.program, sizeof(buff), nullptr, buff);
-			throw 1;
-			// std::cout << "glLinkProgram error: " << buff << "\n";
-		}
+		return result;
+	}
 
+	static Program link(std::span<const Shader> shaders, std::span<const ShaderFieldInfo> attributes = {})
+	{
+		Program result = begin_link(shaders, attributes);
+		result.check();
 		return result;
 	}
-};
 
+	// Program from glGetProgramBinary, nullopt when the driver rejects it
+	static std::optional<Program> load_binary(GLenum format, std::span<const uint8_t> binary)
+	{
+		Program result;
 
-} // namespace OpenGL
+		// A binary from another driver version fails with GL_INVALID_ENUM or an unlinked program
+		DebugOutputOff quiet;
 
-struct OpenGLMaterial : Material
-{
-	OpenGL::Program program;
+		glProgramParameteri(result.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glProgramBinary(result.program, format, binary.data(), (GLsizei)binary.size());
 
-	std::optional<OpenGL::Buffers> buffers;
+		if (!result.is_linked())
+			return std::nullopt;
 
-	OpenGLMaterial(OpenGL::Program _program, ShaderValuesInfo _attribute_info, ShaderValuesInfo _uniform_info)
-		: program{ std::move(_program) }
-	{
-		attribute_info = std::move(_attribute_info);
-		uniform_info = std::move(_uniform_info);
-		uniforms.resize(uniform_info.fields.size());
+		return result;
 	}
 
-	void bind_vertex_info()
+	[[nodiscard]]
+	bool is_linked() const
 	{
-		program.use();
-
-		for (size_t i = 0, offset = 0; i < attribute_info.fields.size(); ++i)
-		{
-			auto const &f = attribute_info.fields[i];
-
-			GLint gl_index = glGetAttribLocation(program.program.val, attribute_info.fields[i].name.c_str());
-			glVertexAttribPointer(gl_index, f.count, type2gltype(f.type), f.normalize, attribute_info.total_byte_size, (void *)offset);
-			glEnableVertexAttribArray(gl_index);
-			offset += f.byte_size();
-		}
+		GLint success = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		return success;
 	}
 
-	void update_uniforms(std::vector<std::shared_ptr<Image>> &active_textures)
+	[[nodiscard]]
+	std::string get_info_log() const
 	{
-		program.use();
+		GLint length = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
 
-		for (size_t i = 0, img_count = 0; i < uniform_info.fields.size(); ++i)
-		{
-			auto const &f = uniform_info.fields[i];
-
-			GLint gl_index = glGetUniformLocation(program.program.val, uniform_info.fields[i].name.c_str());
-
-			static_assert(ShaderFieldType_version == 2, "Update OpenGLGraphics::draw");
-			switch (f.type)
-			{
-				case ShaderFieldType::Matrix4:
-					glUniformMatrix4fv(gl_index, 1, GL_FALSE, &std::get<mat4>(*uniforms[i])[0][0]);
-					break;
+		std::string log(length, '\0');
 
-				case ShaderFieldType::Vec1:
-					glUniform1fv(gl_index, 1, &std::get<vec1>(*uniforms[i])[0]);
-					break;
+		if (length != 0)
+			glGetProgramInfoLog(program, length, &length, log.data());
 
-				case ShaderFieldType::Vec2:
-					glUniform2fv(gl_index, 1, &std::get<vec2>(*uniforms[i])[0]);
-					break;
+		log.resize(length);
+		return log;
+	}
 
-				case ShaderFieldType::Vec3:
-					glUniform3fv(gl_index, 1, &std::get<vec3>(*uniforms[i])[0]);
-					break;
+	void check() const
+	{
+		if (!is_linked())
+			throw 1;
+	}
 
-				case ShaderFieldType::Vec4:
-					glUniform4fv(gl_index, 1, &std::get<vec4>(*uniforms[i])[0]);
-					break;
+	[[nodiscard]]
+	std::vector<uint8_t> get_binary(GLenum &format) const
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
 
-				case ShaderFieldType::Texture:
-					{
-						if (auto &img = std::get<ShaderFieldTexture_t>(*uniforms[i]).img; img != active_textures[img_count])
-						{
-							glActiveTexture(GL_TEXTURE0 + img_count);
-							glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->width, img->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, img->data.data());
-							glGenerateMipmap(GL_TEXTURE_2D);
-							glUniform1i(gl_index, img_count);
-							active_textures[img_count] = img;
-						}
+		std::vector<uint8_t> binary(length);
 
-						img_count += 1;
-					}
-					break;
+		if (length != 0)
+			glGetProgramBinary(program, length, &length, &format, binary.data());
 
-				default:
-					throw 1;
-			}
-		}
+		binary.resize(length);
+		return binary;
 	}
 };
 
-static void load_buffer_data(std::shared_ptr<OpenGLMaterial> &material, std::optional<OpenGL::Buffers> &buffers, std::span<const uint8_t> vertices, std::span<const uint32_t> indices);
-
-struct OpenGLGraphicsCacheVertices : GraphicsCacheVertices
+// Linked programs on disk, one file per hash of the sources, attribute names and driver identity:
+//
+//	magic, key, binary format, binary size, binary
+class ProgramBinaryCache
 {
-	std::shared_ptr<OpenGLMaterial> material;
-	std::optional<OpenGL::Buffers> buffers;
-	size_t indices_count = 0;
+private:
 
-	OpenGLGraphicsCacheVertices(std::shared_ptr<Material> _material)
-		: material{ std::static_pointer_cast<OpenGLMaterial>(_material) }
+	static constexpr uint32_t MAGIC = 0x50584647; // GFXP, bump when the file layout changes
+
+	struct Header
 	{
-	}
+		uint32_t magic;
+		uint32_t format;
+		uint64_t key;
+		uint64_t size;
+	};
 
-	virtual void load(FrameCacheVertices const &c) override
+	std::filesystem::path directory;
+	std::string driver;
+
+	static uint64_t fnv1a(uint64_t h, std::string_view data)
 	{
-		load_buffer_data(material, buffers, c.vertices, c.indices);
-		indices_count = c.indices.size();
+		for (char c : data)
+		{
+			h ^= (uint8_t)c;
+			h *= 0x100000001b3ull;
+		}
 
-		*const_cast<size_t *>(&stats_vertices_count) = c.vertices.size() / material->attribute_info.total_byte_size;
-		*const_cast<size_t *>(&stats_indices_count) = c.indices.size();
+		// Terminator, so that ("ab", "c") and ("a", "bc") differ
+		h ^= 0xff;
+		h *= 0x100000001b3ull;
+
+		return h;
 	}
-};
 
-static void load_buffer_data(std::shared_ptr<OpenGLMaterial> &material, std::optional<OpenGL::Buffers> &buffers, std::span<const uint8_t> vertices, std::span<const uint32_t> indices)
-{
-	if (!buffers)
+	static std::string_view gl_string(GLenum name)
 	{
-		buffers = OpenGL::Buffers{};
-		buffers->vao.bind();
-		buffers->vbo.bind();
-		buffers->ebo.bind();
-
-		material->bind_vertex_info();
+		auto s = reinterpret_cast<char const *>(glGetString(name));
+		return s ? s : "";
 	}
-	else
+
+	std::filesystem::path file_path(uint64_t key) const
 	{
-		buffers->vao.bind();
+		char name[32];
+		_snprintf_s(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+		return directory / name;
 	}
 
-	glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(), indices.data(), GL_STATIC_DRAW);
-}
+public:
 
-class OpenGLGraphics : public Graphics
-{
-private:
+	ProgramBinaryCache(std::string_view _directory)
+	{
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
 
-	GLuint multisample_framebuffer;
-	GLuint multisample_texture_color;
-	GLuint multisample_texture_depth;
+		if (_directory.empty() || formats == 0)
+			return;
 
-	GLuint texture;
+		std::error_code ec;
+		std::filesystem::create_directories(_directory, ec);
 
-	ivec2 back_framebuffer_size{};
-	ivec2 multisample_framebuffer_size{};
+		if (ec)
+			return;
 
-	std::shared_ptr<OpenGLMaterial> post_copy_material;
+		directory = _directory;
 
-public:
+		driver += gl_string(GL_VENDOR);
+		driver += '\n';
+		driver += gl_string(GL_RENDERER);
+		driver += '\n';
+		driver += gl_string(GL_VERSION);
+		driver += '\n';
+		driver += gl_string(GL_SHADING_LANGUAGE_VERSION);
+	}
 
-	OpenGLGraphics()
+	[[nodiscard]]
+	bool is_enabled() const
 	{
-		(void)OpenGLStatic::get_singleton();
-
-		glViewport(0, 0, 1, 1);
+		return !directory.empty();
+	}
 
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);
-		glFrontFace(GL_CCW);
+	[[nodiscard]]
+	uint64_t get_key(std::string_view vertex_source, std::string_view fragment_source, std::span<const ShaderFieldInfo> attributes) const
+	{
+		uint64_t h = 0xcbf29ce484222325ull;
 
-		glEnable(GL_DEPTH_TEST);
+		h = fnv1a(h, driver);
+		h = fnv1a(h, vertex_source);
+		h = fnv1a(h, fragment_source);
 
-		glGenTextures(1, &texture);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture);
+		// Attribute locations are bound by name before linking
+		for (auto const &f : attributes)
+			h = fnv1a(h, f.name);
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-		//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		return h;
+	}
 
+	[[nodiscard]]
+	std::optional<Program> load(uint64_t key) const
+	{
+		if (!is_enabled())
+			return std::nullopt;
 
-		glGenFramebuffers(1, &multisample_framebuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, multisample_framebuffer);
+		FILE *f = fopen(file_path(key).string().c_str(), "rb");
 
-		glGenTextures(1, &multisample_texture_color);
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_color);
-		glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGBA, 1, 1, GL_TRUE);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_color, 0);
+		if (!f)
+			return std::nullopt;
 
-		glGenTextures(1, &multisample_texture_depth);
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_depth);
-		glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_DEPTH_COMPONENT, 1, 1, GL_TRUE);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_depth, 0);
+		Header header{};
+		std::vector<uint8_t> binary;
+		bool valid = fread(&header, sizeof(header), 1, f) == 1 && header.magic == MAGIC && header.key == key;
 
-		glEnable(GL_MULTISAMPLE);
+		if (valid)
+		{
+			binary.resize(header.size);
+			valid = fread(binary.data(), 1, binary.size(), f) == binary.size();
+		}
 
-		init_post_copy();
-	}
+		fclose(f);
 
-	~OpenGLGraphics()
-	{
-		glDeleteTextures(1, &multisample_texture_depth);
-		glDeleteTextures(1, &multisample_texture_color);
-		glDeleteFramebuffers(1, &multisample_framebuffer);
+		if (!valid)
+			return std::nullopt;
 
-		glDeleteTextures(1, &texture);
+		// Rejected after a driver update that kept the version string, the caller compiles and overwrites it
+		return Program::load_binary(header.format, binary);
 	}
 
-	void init_post_copy()
+	void store(uint64_t key, Program const &program) const
 	{
-		auto params = CreateMaterialParams{};
+		if (!is_enabled())
+			return;
 
-		params.attributes.add(ShaderFieldInfo{ "pos", ShaderFieldType::F32, false, 2 });
-		params.attributes.add(ShaderFieldInfo{ "tex_coord", ShaderFieldType::F32, false, 2 });
+		GLenum format = 0;
+		auto binary = program.get_binary(format);
 
-		params.uniforms.add(ShaderFieldInfo{ "tex", ShaderFieldType::Texture, false, 1 });
+		if (binary.empty())
+			return;
 
-		params.vertex_shader = R"tag(
-#version 460 core
+		// Written under a temporary name, a crash never leaves a truncated binary behind
+		auto path = file_path(key);
+		auto temp_path = path;
+		temp_path += ".tmp";
 
-in vec2 pos;
-in vec2 tex_coord;
+		FILE *f = fopen(temp_path.string().c_str(), "wb");
 
-out vec2 v_tex_coord;
+		if (!f)
+			return;
 
-void main()
-{
-gl_Position = vec4(pos, 0.0, 1.0);
-v_tex_coord = tex_coord;
-}
-)tag";
+		Header header{ MAGIC, format, key, binary.size() };
+		bool written = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(binary.data(), 1, binary.size(), f) == binary.size();
 
-		params.fragment_shader = R"tag(
-#version 460 core
+		fclose(f);
 
-in vec2 v_tex_coord;
+		std::error_code ec;
 
-uniform sampler2DMS tex;
-uniform vec2 tex_size;
+		if (written)
+			std::filesystem::rename(temp_path, path, ec);
+		else
+			std::filesystem::remove(temp_path, ec);
+	}
+};
 
-out vec4 o_frag_color;
 
-void main()
+// Attribute setup of a program, materials with equal layouts can read the same vertex buffers
+struct VertexLayout
 {
-o_frag_color = texelFetch(tex, ivec2(v_tex_coord * tex_size), 3);
-}
-)tag";
-		auto material = create_material(params);
+	struct Attribute
+	{
+		GLint location;
+		GLenum type;
+		GLint count;
+		GLboolean normalize;
+		size_t offset;
+
+		bool operator == (Attribute const &) const = default;
+	};
 
+	GLsizei stride = 0;
+	std::vector<Attribute> attributes;
+
+	bool operator == (VertexLayout const &) const = default;
+
+	struct Hash
+	{
+		size_t operator () (VertexLayout const &layout) const
 		{
-			struct TmpVertex
-			{
-				vec2 pos;
-				vec2 tex_coord;
-			};
+			size_t h = math::hash_values(layout.stride);
 
-			std::vector<TmpVertex> _vertices{
-				{ { -1, -1 }, { 0, 0 } },
-				{ {  1, -1 }, { 1, 0 } },
-				{ {  1,  1 }, { 1, 1 } },
-				{ { -1,  1 }, { 0, 1 } },
-			};
-			std::vector<uint32_t> _indices{ 0, 1, 2, 0, 2, 3, };
+			for (auto const &a : layout.attributes)
+				h = math::hash_combine(h, math::hash_values(a.location, a.type, a.count, a.normalize, a.offset));
 
-			std::span<const uint8_t> vertices{ (uint8_t *)&*_vertices.begin(), (uint8_t *)&*_vertices.end() };
-			std::span<const uint32_t> indices{ _indices };
+			return h;
+		}
+	};
+};
 
-			post_copy_material = std::static_pointer_cast<OpenGLMaterial>(material);
+// VAO with separate attribute formats shared by every mesh of one layout, switching meshes only rebinds buffers
+struct SharedVertexLayout
+{
+	VertexLayout layout;
+	VertexArray vao;
 
-			load_buffer_data(post_copy_material, post_copy_material->buffers, vertices, indices);
+	explicit SharedVertexLayout(VertexLayout _layout)
+		: layout{ std::move(_layout) }
+	{
+		vao.bind();
+
+		for (auto const &a : layout.attributes)
+		{
+			if (a.location < 0)
+				continue;
+
+			glVertexAttribFormat(a.location, a.count, a.type, a.normalize, (GLuint)a.offset);
+			glVertexAttribBinding(a.location, 0);
+			glEnableVertexAttribArray(a.location);
 		}
 	}
 
-	void post_copy()
+	void bind(GLuint vbo, GLuint ebo)
 	{
-		glViewport(0, 0, back_framebuffer_size.x, back_framebuffer_size.y);
-		post_copy_material->program.use();
-		post_copy_material->buffers->vao.bind();
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_color);
-		glUniform1i(0, 0);
+		vao.bind();
+		glBindVertexBuffer(0, vbo, 0, layout.stride);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	}
+};
 
-		glUniform2fv(1, 1, &vec2(multisample_framebuffer_size)[0]);
+struct VertexLayoutCache
+{
+	std::unordered_map<VertexLayout, std::shared_ptr<SharedVertexLayout>, VertexLayout::Hash> layouts;
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	std::shared_ptr<SharedVertexLayout> const &get(VertexLayout const &layout)
+	{
+		auto it = layouts.find(layout);
 
-		glDisable(GL_DEPTH_TEST);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-		glEnable(GL_DEPTH_TEST);
+		if (it == layouts.end())
+			it = layouts.emplace(layout, std::make_shared<SharedVertexLayout>(layout)).first;
+
+		return it->second;
 	}
+};
 
-	virtual void draw(Frame const &frame) override
+// Persistently mapped uniform buffer, allocated front to back with absolute positions.
+// A region is written again only after every frame that referenced it has finished on the GPU.
+struct UniformRing
+{
+	struct InFlightFrame
 	{
-		glViewport(0, 0, multisample_framebuffer_size.x, multisample_framebuffer_size.y);
-		glBindFramebuffer(GL_FRAMEBUFFER, multisample_framebuffer);
+		GLsync fence;
+		uint64_t min_pos;
+	};
 
-		std::vector<std::shared_ptr<Image>> active_textures(4);
+	static constexpr uint64_t NO_POS = std::numeric_limits<uint64_t>::max();
 
-		for (auto const &task : frame.tasks)
-		{
-			std::visit([&](auto &content) {
-				using T = std::decay_t<decltype(content)>;
+	MoveOnly<GLuint, decltype([](GLuint v) { glDeleteBuffers(1, &v); })> buffer;
+	uint8_t *mapped = nullptr;
+	size_t size = 0;
+	size_t alignment = 256;
 
-				if constexpr (std::is_same_v<T, DrawTaskTypes::DrawMaterial>)
-				{
-					auto gm = std::static_pointer_cast<OpenGLMaterial>(content.material);
+	uint64_t head = 0;
+	uint64_t frame_min_pos = NO_POS;
+	std::deque<InFlightFrame> in_flight;
 
-					load_buffer_data(gm, gm->buffers, content.vertices, content.indices);
-					gm->update_uniforms(active_textures);
+	uint64_t bound_pos = NO_POS;
 
-					glDrawElements(GL_TRIANGLES, content.indices.size(), GL_UNSIGNED_INT, 0);
-				}
-				else
+	explicit UniformRing(size_t _size)
+	{
+		GLint align = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		alignment = std::max<size_t>(align, 16);
+
+		create(_size);
+	}
+
+	~UniformRing()
+	{
+		for (auto &frame : in_flight)
+			glDeleteSync(frame.fence);
+	}
+
+	UniformRing(UniformRing const &) = delete;
+	UniformRing &operator = (UniformRing const &) = delete;
+
+	void create(size_t _size)
+	{
+		constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferStorage(GL_UNIFORM_BUFFER, _size, nullptr, flags);
+		mapped = (uint8_t *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, _size, flags);
+		size = _size;
+
+		if (!mapped)
+			throw 1;
+	}
+
+	// Contents at pos were not overwritten since
+	[[nodiscard]]
+	bool is_valid(uint64_t pos) const
+	{
+		return pos != NO_POS && head <= pos + size;
+	}
+
+	// Keeps pos alive until the current frame finishes
+	void use(uint64_t pos)
+	{
+		frame_min_pos = std::min(frame_min_pos, pos);
+	}
+
+	[[nodiscard]]
+	uint8_t *data(uint64_t pos)
+	{
+		return mapped + pos % size;
+	}
+
+	uint64_t allocate(size_t len)
+	{
+		len = (len + alignment - 1) / alignment * alignment;
+
+		while (true)
+		{
+			// Allocations never wrap around the end of the buffer
+			uint64_t pos = head;
+
+			if (pos % size + len > size)
+				pos += size - pos % size;
+
+			uint64_t min_pos = frame_min_pos;
+
+			for (auto const &frame : in_flight)
+				min_pos = std::min(min_pos, frame.min_pos);
+
+			if (min_pos == NO_POS || pos + len <= min_pos + size)
+			{
+				head = pos + len;
+				use(pos);
+				return pos;
+			}
+
+			if (!in_flight.empty())
+			{
+				glClientWaitSync(in_flight.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+				glDeleteSync(in_flight.front().fence);
+				in_flight.pop_front();
+				continue;
+			}
+
+			// The frame being recorded alone needs more than the whole buffer
+			grow(std::max(size * 2, len));
+		}
+	}
+
+	void grow(size_t new_size)
+	{
+		glFinish();
+
+		for (auto &frame : in_flight)
+			glDeleteSync(frame.fence);
+
+		in_flight.clear();
+
+		buffer = {};
+		create(new_size);
+
+		// Moving past a whole buffer invalidates every earlier position
+		head += new_size;
+		frame_min_pos = NO_POS;
+		bound_pos = NO_POS;
+	}
+
+	void bind(GLuint binding, uint64_t pos, size_t len)
+	{
+		if (pos == bound_pos)
+			return;
+
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, pos % size, len);
+		bound_pos = pos;
+	}
+
+	void begin_frame()
+	{
+		while (!in_flight.empty())
+		{
+			GLenum result = glClientWaitSync(in_flight.front().fence, 0, 0);
+
+			if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+				break;
+
+			glDeleteSync(in_flight.front().fence);
+			in_flight.pop_front();
+		}
+
+		bound_pos = NO_POS;
+	}
+
+	void end_frame()
+	{
+		if (frame_min_pos != NO_POS)
+			in_flight.push_back(InFlightFrame{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), frame_min_pos });
+
+		frame_min_pos = NO_POS;
+	}
+};
+
+struct Texture
+{
+	MoveOnly<GLuint, decltype([](GLuint v) { glDeleteTextures(1, &v); })> texture;
+
+	Texture()
+	{
+		glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+	}
+};
+
+// One texture per Image and per atlas page, kept while its source lives. An Image is uploaded once, an atlas page
+// gets the texels written since it was last drawn.
+struct TextureCache
+{
+	struct ImageEntry
+	{
+		std::weak_ptr<Image> image;
+		Texture texture;
+	};
+
+	struct PageEntry
+	{
+		std::weak_ptr<AtlasPageTexture> page;
+		std::optional<Texture> texture;
+		ivec2 size{};
+	};
+
+	std::unordered_map<Image const *, ImageEntry> images;
+	std::unordered_map<AtlasPageTexture const *, PageEntry> pages;
+	std::vector<AtlasUpload> uploads;
+
+	// Replaced during the frame, deleted after it so their names aren't reused while draws still refer to them
+	std::vector<Texture> retired;
+
+	GLuint get(ShaderFieldTexture_t const &value)
+	{
+		if (value.atlas_page)
+			return get_page(value.atlas_page, value.atlas_version);
+
+		if (!value.img)
+			throw 1;
+
+		return get_image(value.img);
+	}
+
+	GLuint get_image(std::shared_ptr<Image> const &img)
+	{
+		auto [it, inserted] = images.try_emplace(img.get());
+		ImageEntry &e = it->second;
+
+		if (!inserted)
+		{
+			if (!e.image.expired())
+				return e.texture.texture;
+
+			// A new image at the address of one that is gone, storage is immutable
+			retired.push_back(std::move(e.texture));
+			e.texture = Texture();
+		}
+
+		e.image = img;
+
+		GLuint const texture = e.texture.texture;
+
+		GLenum const internal_format = img->format == Image::Format::RGBA32F ? GL_RGBA32F : GL_RGBA8;
+		GLenum const type = img->format == Image::Format::RGBA32F ? GL_FLOAT : GL_UNSIGNED_BYTE;
+		GLsizei const width = (GLsizei)img->width;
+		GLsizei const height = (GLsizei)img->height;
+
+		GLsizei levels = (GLsizei)img->mips.size() + 1;
+
+		if (img->mips.empty())
+		{
+			while ((std::max(width, height) >> levels) > 0)
+				++levels;
+		}
+
+		glTextureStorage2D(texture, levels, internal_format, width, height);
+		glTextureSubImage2D(texture, 0, 0, 0, width, height, GL_RGBA, type, img->data.data());
+
+		// Mips from generate_mips() are uploaded as they are, otherwise the driver makes them
+		for (GLsizei level = 1; level <= (GLsizei)img->mips.size(); ++level)
+		{
+			GLsizei const w = std::max(width >> level, 1);
+			GLsizei const h = std::max(height >> level, 1);
+			glTextureSubImage2D(texture, level, 0, 0, w, h, GL_RGBA, type, img->mips[level - 1].data());
+		}
+
+		if (img->mips.empty())
+			glGenerateTextureMipmap(texture);
+
+		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+		glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		return texture;
+	}
+
+	void allocate_page(PageEntry &e, ivec2 size)
+	{
+		if (e.texture)
+			retired.push_back(std::move(*e.texture));
+
+		GLuint const texture = e.texture.emplace().texture;
+		e.size = size;
+
+		// Linear without mips, the padding between regions only keeps the full size level apart
+		glTextureStorage2D(texture, 1, GL_RGBA8, size.x, size.y);
+		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	GLuint get_page(std::shared_ptr<AtlasPageTexture> const &page, uint64_t version)
+	{
+		auto [it, inserted] = pages.try_emplace(page.get());
+		PageEntry &e = it->second;
+
+		// A new page at the address of one that is gone
+		if (!inserted && e.page.expired() && e.texture)
+		{
+			retired.push_back(std::move(*e.texture));
+			e.texture.reset();
+			e.size = ivec2();
+		}
+
+		e.page = page;
+
+		uploads.clear();
+		page->take(version, uploads);
+
+		// A resize always comes with the whole page
+		for (AtlasUpload const &u : uploads)
+		{
+			if (u.page_size != e.size)
+				allocate_page(e, u.page_size);
+
+			if (u.rgba.empty())
+				glClearTexImage(e.texture->texture, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			else
+				glTextureSubImage2D(e.texture->texture, 0, u.position.x, u.position.y, u.size.x, u.size.y, GL_RGBA, GL_UNSIGNED_BYTE, u.rgba.data());
+		}
+
+		if (!e.texture)
+		{
+			allocate_page(e, ivec2(1, 1));
+			glClearTexImage(e.texture->texture, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+
+		return e.texture->texture;
+	}
+
+	// Drops textures of images and pages that are gone
+	void end_frame()
+	{
+		retired.clear();
+
+		std::erase_if(images, [](auto const &e) { return e.second.image.expired(); });
+		std::erase_if(pages, [](auto const &e) { return e.second.page.expired(); });
+	}
+};
+
+} // namespace OpenGL
+
+// Uniform block fed from the uniform ring, declared in shaders as `layout(std140) uniform Material { ... };`
+static constexpr char const *MATERIAL_BLOCK_NAME = "Material";
+static constexpr GLuint MATERIAL_BLOCK_BINDING = 0;
+
+// State carried between the draws of a frame to skip redundant GL calls
+struct OpenGLDrawState
+{
+	OpenGL::UniformRing &uniform_ring;
+	OpenGL::TextureCache &textures;
+	std::array<GLuint, 16> bound_textures{};
+	GLuint program = 0;
+
+	GLuint vao = 0;
+	GLuint vertex_buffer = 0;
+	GLuint element_buffer = 0;
+
+	void bind_texture(size_t unit, GLuint texture)
+	{
+		if (bound_textures.at(unit) != texture)
+		{
+			glBindTextureUnit((GLuint)unit, texture);
+			bound_textures[unit] = texture;
+		}
+	}
+
+	void bind_vertex_buffers(OpenGL::SharedVertexLayout &layout, GLuint vbo, GLuint ebo)
+	{
+		if (vao != layout.vao.vertex_array)
+		{
+			layout.vao.bind();
+			vao = layout.vao.vertex_array;
+
+			// Bindings are per VAO
+			vertex_buffer = 0;
+			element_buffer = 0;
+		}
+
+		if (vertex_buffer != vbo)
+		{
+			glBindVertexBuffer(0, vbo, 0, layout.layout.stride);
+			vertex_buffer = vbo;
+		}
+
+		if (element_buffer != ebo)
+		{
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+			element_buffer = ebo;
+		}
+	}
+};
+
+struct OpenGLMaterial : Material
+{
+	OpenGL::Program program;
+
+	std::optional<OpenGL::Buffers> buffers;
+
+	std::shared_ptr<OpenGL::SharedVertexLayout> vertex_layout;
+
+	std::vector<GLint> uniform_locations;
+
+	// Byte offset of each field inside the material block, -1 for fields set with glUniform*
+	std::vector<GLint> block_offsets;
+	size_t block_size = 0;
+
+	static constexpr uint64_t NO_VERSION = std::numeric_limits<uint64_t>::max();
+
+	// Last uploaded block contents, the uniforms version they were packed from and where they live in the uniform ring
+	std::vector<uint8_t> block_data;
+	uint64_t block_version = NO_VERSION;
+	uint64_t block_pos = OpenGL::UniformRing::NO_POS;
+
+	OpenGLMaterial(OpenGL::Program _program, ShaderValuesInfo _attribute_info, ShaderValuesInfo _uniform_info, OpenGL::VertexLayoutCache &layouts)
+		: program{ std::move(_program) }
+	{
+		attribute_info = std::move(_attribute_info);
+		uniform_info = std::move(_uniform_info);
+		uniforms.resize(uniform_info.fields.size());
+
+		vertex_layout = layouts.get(get_vertex_layout(program));
+		find_uniforms();
+	}
+
+	OpenGL::VertexLayout get_vertex_layout(OpenGL::Program const &p) const
+	{
+		OpenGL::VertexLayout layout;
+		layout.stride = (GLsizei)attribute_info.total_byte_size;
+
+		for (size_t i = 0, offset = 0; i < attribute_info.fields.size(); ++i)
+		{
+			auto const &f = attribute_info.fields[i];
+			GLint count = type2glcomponents(f.type) * (GLint)f.count;
+
+			// One attribute has one to four components, the packed types are always four
+			if (type2gltype(f.type) == 0 || count < 1 || count > 4)
+				throw 1;
+
+			layout.attributes.push_back(OpenGL::VertexLayout::Attribute{
+				.location = glGetAttribLocation(p.program.val, f.name.c_str()),
+				.type = type2gltype(f.type),
+				.count = count,
+				.normalize = f.normalize,
+				.offset = offset,
+			});
+
+			offset += f.byte_size();
+		}
+
+		return layout;
+	}
+
+	// Swaps in a recompiled program. Vertex data of the material stays in the current layout, so the
+	// new program may drop attributes but not move them, false (keeping the old program) otherwise.
+	bool reload(OpenGL::Program new_program)
+	{
+		auto layout = get_vertex_layout(new_program);
+
+		for (size_t i = 0; i < layout.attributes.size(); ++i)
+		{
+			GLint location = layout.attributes[i].location;
+
+			if (location != -1 && location != vertex_layout->layout.attributes[i].location)
+				return false;
+		}
+
+		program = std::move(new_program);
+		find_uniforms();
+
+		return true;
+	}
+
+	void find_uniforms()
+	{
+		uniform_locations.assign(uniform_info.fields.size(), -1);
+		block_offsets.assign(uniform_info.fields.size(), -1);
+
+		block_size = 0;
+		block_data.clear();
+		block_version = NO_VERSION;
+		block_pos = OpenGL::UniformRing::NO_POS;
+
+		GLuint block_index = glGetUniformBlockIndex(program.program.val, MATERIAL_BLOCK_NAME);
+
+		if (block_index != GL_INVALID_INDEX)
+		{
+			GLint size = 0;
+			glGetActiveUniformBlockiv(program.program.val, block_index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+			glUniformBlockBinding(program.program.val, block_index, MATERIAL_BLOCK_BINDING);
+			block_size = (size_t)size;
+		}
+
+		for (size_t i = 0; i < uniform_info.fields.size(); ++i)
+		{
+			char const *name = uniform_info.fields[i].name.c_str();
+
+			uniform_locations[i] = glGetUniformLocation(program.program.val, name);
+
+			if (block_size == 0 || uniform_locations[i] != -1)
+				continue;
+
+			GLuint index = GL_INVALID_INDEX;
+			glGetUniformIndices(program.program.val, 1, &name, &index);
+
+			if (index == GL_INVALID_INDEX)
+				continue;
+
+			GLint field_block = -1;
+			glGetActiveUniformsiv(program.program.val, 1, &index, GL_UNIFORM_BLOCK_INDEX, &field_block);
+
+			if (field_block == (GLint)block_index)
+				glGetActiveUniformsiv(program.program.val, 1, &index, GL_UNIFORM_OFFSET, &block_offsets[i]);
+		}
+
+		// Texture fields use units in order, see update_uniforms()
+		for (size_t i = 0, unit = 0; i < uniform_info.fields.size(); ++i)
+		{
+			if (uniform_info.fields[i].type == ShaderFieldType::Texture)
+				glProgramUniform1i(program.program.val, uniform_locations[i], (GLint)unit++);
+		}
+	}
+
+	void use_program(OpenGLDrawState &state)
+	{
+		if (state.program != program.program.val)
+		{
+			program.use();
+			state.program = program.program.val;
+		}
+	}
+
+	// Writes block fields in their std140 positions, as reported by the driver
+	void pack_block(std::vector<uint8_t> &out, std::vector<std::optional<ShaderFieldValue>> const &uniforms) const
+	{
+		out.assign(block_size, 0);
+
+		for (size_t i = 0; i < uniform_info.fields.size(); ++i)
+		{
+			if (block_offsets[i] < 0 || !uniforms[i])
+				continue;
+
+			std::visit([&](auto const &value) {
+				using T = std::decay_t<decltype(value)>;
+
+				if constexpr (std::is_same_v<T, ShaderFieldTexture_t> || std::is_same_v<T, PackedI2_10_10_10> || std::is_same_v<T, PackedU2_10_10_10> || sizeof(T) < 4)
+				{
+					// Not representable in a std140 block
+					throw 1;
+				}
+				else
+				{
+					if (block_offsets[i] + sizeof(T) > block_size)
+						throw 1;
+
+					memcpy(out.data() + block_offsets[i], &value, sizeof(T));
+				}
+			}, *uniforms[i]);
+		}
+	}
+
+	void update_block(OpenGLDrawState &state, std::vector<std::optional<ShaderFieldValue>> const &uniforms, uint64_t version)
+	{
+		OpenGL::UniformRing &ring = state.uniform_ring;
+
+		// No set_uniform() since the last upload, keep pointing at it
+		if (version == block_version && ring.is_valid(block_pos))
+		{
+			ring.use(block_pos);
+		}
+		else
+		{
+			// Overwritten in the ring while unchanged, the packed copy is still good
+			if (version != block_version)
+			{
+				pack_block(block_data, uniforms);
+				block_version = version;
+			}
+
+			block_pos = ring.allocate(block_size);
+			memcpy(ring.data(block_pos), block_data.data(), block_size);
+		}
+
+		ring.bind(MATERIAL_BLOCK_BINDING, block_pos, block_size);
+	}
+
+	void update_uniforms(OpenGLDrawState &state, std::vector<std::optional<ShaderFieldValue>> const &uniforms, uint64_t version)
+	{
+		use_program(state);
+
+		if (block_size != 0)
+			update_block(state, uniforms, version);
+
+		for (size_t i = 0, unit = 0; i < uniform_info.fields.size(); ++i)
+		{
+			auto const &f = uniform_info.fields[i];
+
+			if (block_offsets[i] >= 0)
+				continue;
+
+			GLint gl_index = uniform_locations[i];
+
+			static_assert(ShaderFieldType_version == 3, "Update OpenGLGraphics::draw");
+			switch (f.type)
+			{
+				case ShaderFieldType::Matrix4:
+					glUniformMatrix4fv(gl_index, 1, GL_FALSE, &std::get<mat4>(*uniforms[i])[0][0]);
+					break;
+
+				case ShaderFieldType::Vec1:
+					glUniform1fv(gl_index, 1, &std::get<vec1>(*uniforms[i])[0]);
+					break;
+
+				case ShaderFieldType::Vec2:
+					glUniform2fv(gl_index, 1, &std::get<vec2>(*uniforms[i])[0]);
+					break;
+
+				case ShaderFieldType::Vec3:
+					glUniform3fv(gl_index, 1, &std::get<vec3>(*uniforms[i])[0]);
+					break;
+
+				case ShaderFieldType::Vec4:
+					glUniform4fv(gl_index, 1, &std::get<vec4>(*uniforms[i])[0]);
+					break;
+
+				case ShaderFieldType::Texture:
+					state.bind_texture(unit, state.textures.get(std::get<ShaderFieldTexture_t>(*uniforms[i])));
+					unit += 1;
+					break;
+
+				default:
+					throw 1;
+			}
+		}
+	}
+};
+
+// Geometry with at most this many vertices is drawn with 16-bit indices, half the index memory and bandwidth.
+// 0xFFFF is left for GL_PRIMITIVE_RESTART_FIXED_INDEX, PRIMITIVE_RESTART_INDEX narrows to it.
+static constexpr size_t MAX_SHORT_INDEXED_VERTICES = 0xFFFF;
+
+static void narrow_indices(std::span<const uint32_t> indices, std::vector<uint16_t> &out)
+{
+	out.resize(indices.size());
+
+	for (size_t i = 0; i < indices.size(); ++i)
+		out[i] = (uint16_t)indices[i];
+}
+
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+};
+
+// Cached geometry of one vertex layout sub-allocated out of shared buffers, so runs of cached draws
+// need a single VAO bind and can be submitted with one indirect draw
+struct GeometryPool
+{
+	struct Allocation
+	{
+		uint32_t first_vertex = 0;
+		uint32_t vertex_count = 0;
+		uint32_t first_index = 0;
+		uint32_t index_count = 0;
+		bool live = false;
+	};
+
+	static constexpr uint32_t NO_HANDLE = uint32_t(-1);
+
+	std::shared_ptr<OpenGL::SharedVertexLayout> layout;
+	OpenGL::Buffers buffers;
+
+	// GL_UNSIGNED_SHORT pools only take geometry of up to MAX_SHORT_INDEXED_VERTICES vertices, indices are relative to first_vertex
+	const GLenum index_type;
+	const size_t index_size;
+
+	RangeAllocator vertex_ranges;
+	RangeAllocator index_ranges;
+
+	std::vector<Allocation> allocations;
+	std::vector<uint32_t> free_handles;
+	std::vector<uint16_t> short_indices;
+
+	GeometryPool(std::shared_ptr<OpenGL::SharedVertexLayout> _layout, GLenum _index_type)
+		: layout{ std::move(_layout) }
+		, index_type{ _index_type }
+		, index_size{ _index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t) }
+	{
+	}
+
+	[[nodiscard]]
+	uint32_t allocate(std::span<const uint8_t> vertices, std::span<const uint32_t> indices)
+	{
+		size_t vertex_count = vertices.size() / layout->layout.stride;
+		size_t index_count = indices.size();
+
+		auto first_vertex = vertex_ranges.allocate(vertex_count);
+		auto first_index = index_ranges.allocate(index_count);
+
+		if (!first_vertex || !first_index)
+		{
+			if (first_vertex)
+				vertex_ranges.release(*first_vertex, vertex_count);
+
+			if (first_index)
+				index_ranges.release(*first_index, index_count);
+
+			repack(vertex_count, index_count);
+
+			first_vertex = vertex_ranges.allocate(vertex_count);
+			first_index = index_ranges.allocate(index_count);
+
+			if (!first_vertex || !first_index)
+				throw 1;
+		}
+
+		uint32_t handle;
+
+		if (!free_handles.empty())
+		{
+			handle = free_handles.back();
+			free_handles.pop_back();
+		}
+		else
+		{
+			handle = (uint32_t)allocations.size();
+			allocations.emplace_back();
+		}
+
+		allocations[handle] = Allocation{ (uint32_t)*first_vertex, (uint32_t)vertex_count, (uint32_t)*first_index, (uint32_t)index_count, true };
+
+		// GL_COPY_WRITE_BUFFER leaves the element buffer of the bound VAO alone
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffers.vbo.buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, *first_vertex * layout->layout.stride, vertices.size(), vertices.data());
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffers.ebo.buffer);
+
+		if (index_type == GL_UNSIGNED_SHORT)
+		{
+			narrow_indices(indices, short_indices);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, *first_index * index_size, short_indices.size() * index_size, short_indices.data());
+		}
+		else
+		{
+			glBufferSubData(GL_COPY_WRITE_BUFFER, *first_index * index_size, indices.size_bytes(), indices.data());
+		}
+
+		return handle;
+	}
+
+	void release(uint32_t handle)
+	{
+		Allocation &a = allocations[handle];
+		vertex_ranges.release(a.first_vertex, a.vertex_count);
+		index_ranges.release(a.first_index, a.index_count);
+		a.live = false;
+		free_handles.push_back(handle);
+	}
+
+	// Moves live allocations to the front of new buffers, growing them when compaction alone can't fit the request
+	void repack(size_t extra_vertices, size_t extra_indices)
+	{
+		size_t used_vertices = vertex_ranges.get_capacity() - vertex_ranges.get_free();
+		size_t used_indices = index_ranges.get_capacity() - index_ranges.get_free();
+
+		size_t vertex_capacity = vertex_ranges.get_capacity();
+		size_t index_capacity = index_ranges.get_capacity();
+
+		if (used_vertices + extra_vertices > vertex_capacity)
+			vertex_capacity = std::max({ vertex_capacity * 2, used_vertices + extra_vertices, size_t(1 << 16) });
+
+		if (used_indices + extra_indices > index_capacity)
+			index_capacity = std::max({ index_capacity * 2, used_indices + extra_indices, size_t(1 << 16) });
+
+		OpenGL::Buffer vbo{ GL_ARRAY_BUFFER };
+		OpenGL::Buffer ebo{ GL_ELEMENT_ARRAY_BUFFER };
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, vbo.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, vertex_capacity * layout->layout.stride, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ebo.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, index_capacity * index_size, nullptr, GL_STATIC_DRAW);
+
+		uint32_t next_vertex = 0;
+		uint32_t next_index = 0;
+
+		for (auto &a : allocations)
+		{
+			if (!a.live)
+				continue;
+
+			glBindBuffer(GL_COPY_READ_BUFFER, buffers.vbo.buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, vbo.buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, a.first_vertex * layout->layout.stride, next_vertex * layout->layout.stride, a.vertex_count * layout->layout.stride);
+
+			glBindBuffer(GL_COPY_READ_BUFFER, buffers.ebo.buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, ebo.buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, a.first_index * index_size, next_index * index_size, a.index_count * index_size);
+
+			a.first_vertex = next_vertex;
+			a.first_index = next_index;
+			next_vertex += a.vertex_count;
+			next_index += a.index_count;
+		}
+
+		buffers.vbo = std::move(vbo);
+		buffers.ebo = std::move(ebo);
+
+		vertex_ranges.reset(vertex_capacity, next_vertex);
+		index_ranges.reset(index_capacity, next_index);
+	}
+};
+
+// Shared by every cache with the same vertex layout and index type
+struct GeometryPools
+{
+	std::vector<std::shared_ptr<GeometryPool>> pools;
+
+	std::shared_ptr<GeometryPool> const &get(std::shared_ptr<OpenGL::SharedVertexLayout> const &layout, GLenum index_type)
+	{
+		for (auto const &pool : pools)
+			if (pool->layout == layout && pool->index_type == index_type)
+				return pool;
+
+		return pools.emplace_back(std::make_shared<GeometryPool>(layout, index_type));
+	}
+};
+
+struct OpenGLGraphicsCacheVertices : GraphicsCacheVertices
+{
+	std::shared_ptr<OpenGLMaterial> material;
+	GeometryPools &pools;
+	std::shared_ptr<GeometryPool> pool;
+	uint32_t handle = GeometryPool::NO_HANDLE;
+	size_t indices_count = 0;
+
+	OpenGLGraphicsCacheVertices(std::shared_ptr<Material> _material, GeometryPools &_pools)
+		: material{ std::static_pointer_cast<OpenGLMaterial>(_material) }
+		, pools{ _pools }
+		, pool{ pools.get(material->vertex_layout, GL_UNSIGNED_SHORT) }
+	{
+	}
+
+	~OpenGLGraphicsCacheVertices()
+	{
+		if (handle != GeometryPool::NO_HANDLE)
+			pool->release(handle);
+	}
+
+	virtual void load(FrameCacheVertices const &c) override
+	{
+		if (handle != GeometryPool::NO_HANDLE)
+			pool->release(handle);
+
+		size_t vertex_count = c.vertices.size() / material->attribute_info.total_byte_size;
+		pool = pools.get(material->vertex_layout, vertex_count <= MAX_SHORT_INDEXED_VERTICES ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+
+		handle = pool->allocate(c.vertices, c.indices);
+		indices_count = c.indices.size();
+
+		*const_cast<size_t *>(&stats_vertices_count) = vertex_count;
+		*const_cast<size_t *>(&stats_indices_count) = c.indices.size();
+		*const_cast<std::optional<AABB3> *>(&bounds) = compute_vertex_bounds(material->attribute_info, c.vertices);
+		*const_cast<PrimitiveTopology *>(&topology) = c.topology;
+	}
+
+	virtual Material const *get_material() const override
+	{
+		return material.get();
+	}
+};
+
+// Uploads through GL_COPY_WRITE_BUFFER, the element buffer binding belongs to the bound VAO
+template <typename TIndex>
+static void load_buffer_data(std::optional<OpenGL::Buffers> &buffers, std::span<const uint8_t> vertices, std::span<const TIndex> indices)
+{
+	if (!buffers)
+		buffers.emplace();
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers->vbo.buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers->ebo.buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(indices[0]) * indices.size(), indices.data(), GL_STATIC_DRAW);
+}
+
+static std::optional<std::string> read_text_file(std::string const &file_name)
+{
+	FILE *f = fopen(file_name.c_str(), "rb");
+
+	if (!f)
+		return std::nullopt;
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	std::string text(size > 0 ? (size_t)size : 0, '\0');
+	bool read = fread(text.data(), 1, text.size(), f) == text.size();
+
+	fclose(f);
+
+	if (!read)
+		return std::nullopt;
+
+	return text;
+}
+
+// Info logs of everything that failed, for the shader log
+static std::string get_program_errors(std::span<const OpenGL::Shader> shaders, OpenGL::Program const &program)
+{
+	std::string errors;
+
+	for (auto const &shader : shaders)
+	{
+		if (shader.is_compiled())
+			continue;
+
+		errors += shader.type == GL_VERTEX_SHADER ? "vertex shader:\n" : "fragment shader:\n";
+		errors += shader.get_info_log();
+	}
+
+	// Link errors only matter once everything compiled
+	if (errors.empty())
+		errors += program.get_info_log();
+
+	return errors;
+}
+
+// Recompiles materials whose shader files changed on a worker thread, which has its own context sharing objects
+// with the graphics one. Finished programs wait for apply(), which swaps them in between frames.
+class ShaderHotReload
+{
+private:
+
+	static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(250);
+
+	struct Watch
+	{
+		std::weak_ptr<OpenGLMaterial> material;
+		std::string vertex_file;
+		std::string fragment_file;
+		std::vector<ShaderFieldInfo> attributes;
+		std::filesystem::file_time_type vertex_time;
+		std::filesystem::file_time_type fragment_time;
+	};
+
+	struct Compiled
+	{
+		std::weak_ptr<OpenGLMaterial> material;
+		std::string name;
+		OpenGL::Program program;
+	};
+
+	struct Message
+	{
+		Logger::Level level;
+		std::string text;
+	};
+
+	GLWorkerContext context;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stop = false;
+
+	// All guarded by mutex
+	std::vector<Watch> watches;
+	std::vector<Compiled> compiled;
+	std::vector<Message> messages;
+
+	std::thread thread;
+
+	static std::filesystem::file_time_type get_write_time(std::string const &file_name)
+	{
+		std::error_code ec;
+		auto time = std::filesystem::last_write_time(file_name, ec);
+		return ec ? std::filesystem::file_time_type{} : time;
+	}
+
+	std::optional<OpenGL::Program> compile(Watch const &watch, std::vector<Message> &out)
+	{
+		auto vertex_source = read_text_file(watch.vertex_file);
+		auto fragment_source = read_text_file(watch.fragment_file);
+
+		if (!vertex_source || !fragment_source)
+		{
+			out.push_back({ Logger::Level::Warning, "Can't read " + (vertex_source ? watch.fragment_file : watch.vertex_file) });
+			return std::nullopt;
+		}
+
+		std::vector<OpenGL::Shader> shaders;
+		shaders.push_back(OpenGL::Shader::begin_compile(GL_VERTEX_SHADER, vertex_source->c_str()));
+		shaders.push_back(OpenGL::Shader::begin_compile(GL_FRAGMENT_SHADER, fragment_source->c_str()));
+
+		auto program = OpenGL::Program::begin_link(shaders, watch.attributes);
+
+		if (!program.is_linked())
+		{
+			out.push_back({ Logger::Level::Error, watch.vertex_file + ", " + watch.fragment_file + ": " + get_program_errors(shaders, program) });
+			return std::nullopt;
+		}
+
+		return program;
+	}
+
+	void thread_main()
+	{
+		if (!context.make_current())
+		{
+			std::lock_guard lock(mutex);
+			messages.push_back({ Logger::Level::Error, "Shader hot reload disabled, can't bind the worker context" });
+			return;
+		}
+
+		std::vector<Watch> changed;
+		std::vector<Message> log;
+
+		std::unique_lock lock(mutex);
+
+		while (!wake.wait_for(lock, POLL_INTERVAL, [&]() { return stop; }))
+		{
+			std::erase_if(watches, [](Watch const &w) { return w.material.expired(); });
+
+			for (auto &w : watches)
+			{
+				auto vertex_time = get_write_time(w.vertex_file);
+				auto fragment_time = get_write_time(w.fragment_file);
+
+				if (vertex_time == w.vertex_time && fragment_time == w.fragment_time)
+					continue;
+
+				w.vertex_time = vertex_time;
+				w.fragment_time = fragment_time;
+				changed.push_back(w);
+			}
+
+			if (changed.empty())
+				continue;
+
+			lock.unlock();
+
+			std::vector<Compiled> results;
+
+			for (auto const &w : changed)
+			{
+				if (auto program = compile(w, log))
+					results.push_back({ w.material, w.vertex_file, std::move(*program) });
+			}
+
+			// The programs are used from the graphics context next, they have to be complete here
+			glFinish();
+
+			lock.lock();
+
+			for (auto &r : results)
+				compiled.push_back(std::move(r));
+
+			for (auto &m : log)
+				messages.push_back(std::move(m));
+
+			changed.clear();
+			log.clear();
+		}
+
+		lock.unlock();
+
+		// Unapplied programs are deleted from the graphics context, objects are shared
+		context.release();
+	}
+
+public:
+
+	explicit ShaderHotReload(GLWorkerContext _context)
+		: context{ std::move(_context) }
+	{
+		thread = std::thread([this]() { thread_main(); });
+	}
+
+	~ShaderHotReload()
+	{
+		{
+			std::lock_guard lock(mutex);
+			stop = true;
+		}
+
+		wake.notify_all();
+		thread.join();
+	}
+
+	void watch(std::shared_ptr<OpenGLMaterial> const &material, std::string vertex_file, std::string fragment_file)
+	{
+		Watch w{
+			.material = material,
+			.vertex_file = std::move(vertex_file),
+			.fragment_file = std::move(fragment_file),
+			.attributes = material->attribute_info.fields,
+		};
+
+		w.vertex_time = get_write_time(w.vertex_file);
+		w.fragment_time = get_write_time(w.fragment_file);
+
+		std::lock_guard lock(mutex);
+		watches.push_back(std::move(w));
+	}
+
+	// Call on the graphics thread between frames, never waits for the worker
+	void apply(Logger *logger)
+	{
+		std::vector<Compiled> ready;
+		std::vector<Message> log;
+
+		if (std::unique_lock lock(mutex, std::try_to_lock); lock)
+		{
+			ready.swap(compiled);
+			log.swap(messages);
+		}
+
+		if (logger)
+		{
+			for (auto const &m : log)
+			{
+				if (m.level == Logger::Level::Error)
+					logger->loge<LogCategory::Graphics>("{}", m.text);
+				else
+					logger->logw<LogCategory::Graphics>("{}", m.text);
+			}
+		}
+
+		for (auto &c : ready)
+		{
+			auto material = c.material.lock();
+
+			if (!material)
+				continue;
+
+			bool reloaded = material->reload(std::move(c.program));
+
+			if (!logger)
+				continue;
+
+			if (reloaded)
+				logger->log<LogCategory::Graphics>("Reloaded {}", c.name);
+			else
+				logger->logw<LogCategory::Graphics>("{}: attribute locations changed, restart to apply", c.name);
+		}
+	}
+};
+
+class OpenGLGraphics : public Graphics
+{
+private:
+
+	GLuint multisample_framebuffer;
+	GLuint multisample_texture_color;
+	GLuint multisample_texture_depth;
+
+	// 1 renders into plain textures, resolved together with the upscale by a blit
+	uint32_t msaa_samples = 4;
+
+	ivec2 back_framebuffer_size{};
+	ivec2 multisample_framebuffer_size{};
+
+	// Sub-rectangle of the multisample target drawn this frame
+	ivec2 render_size{};
+	std::atomic<float> max_render_scale = 1.0f;
+	std::atomic<float> render_scale = std::numeric_limits<float>::max();
+
+	// GL_TIME_ELAPSED queries, read a few frames late so the CPU never waits on them
+	std::array<GLuint, 4> gpu_timer_queries{};
+	uint32_t gpu_timer_frame = 0;
+	std::atomic<double> gpu_frame_time = 0.0;
+
+	std::shared_ptr<OpenGLMaterial> post_copy_material;
+
+	std::optional<OpenGL::UniformRing> uniform_ring;
+	OpenGL::TextureCache textures;
+	std::optional<OpenGL::ProgramBinaryCache> program_cache;
+	std::optional<ShaderHotReload> hot_reload;
+	Logger *logger = nullptr;
+
+	OpenGL::VertexLayoutCache vertex_layouts;
+	GeometryPools geometry_pools;
+	std::optional<OpenGL::Buffer> indirect_buffer;
+	std::vector<DrawElementsIndirectCommand> indirect_commands;
+	std::vector<uint16_t> short_indices;
+	std::vector<GLsizei> range_counts;
+	std::vector<void *> range_offsets;
+	std::vector<GLint> range_base_vertices;
+
+public:
+
+	OpenGLGraphics(CreateGraphicsParams const &params, GLWorkerContext worker_context)
+		: logger{ params.logger }
+	{
+		(void)OpenGLStatic::get_singleton();
+
+		// 0xFFFFFFFF lets the driver pick the thread count, 0 turns parallel compilation off
+		if (GLAD_GL_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(params.parallel_shader_compile ? 0xFFFFFFFF : 0);
+		else if (GLAD_GL_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(params.parallel_shader_compile ? 0xFFFFFFFF : 0);
+
+		program_cache.emplace(params.program_cache_directory);
+
+		if (params.hot_reload_shaders && worker_context.make_current)
+			hot_reload.emplace(std::move(worker_context));
+
+		glViewport(0, 0, 1, 1);
+
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_BACK);
+		glFrontFace(GL_CCW);
+
+		glEnable(GL_DEPTH_TEST);
+
+		// The restart index is the largest value of the index type, see PRIMITIVE_RESTART_INDEX
+		glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+		glEnable(GL_PROGRAM_POINT_SIZE);
+
+		glGenFramebuffers(1, &multisample_framebuffer);
+		glGenTextures(1, &multisample_texture_color);
+		glGenTextures(1, &multisample_texture_depth);
+
+		multisample_framebuffer_size = ivec2(1, 1);
+		allocate_render_target();
+
+		glEnable(GL_MULTISAMPLE);
+
+		glGenQueries((GLsizei)gpu_timer_queries.size(), gpu_timer_queries.data());
+
+		uniform_ring.emplace(1 << 20);
+		indirect_buffer.emplace(GL_DRAW_INDIRECT_BUFFER);
+
+		init_post_copy();
+	}
+
+	~OpenGLGraphics()
+	{
+		glDeleteQueries((GLsizei)gpu_timer_queries.size(), gpu_timer_queries.data());
+
+		glDeleteTextures(1, &multisample_texture_depth);
+		glDeleteTextures(1, &multisample_texture_color);
+		glDeleteFramebuffers(1, &multisample_framebuffer);
+	}
+
+	void allocate_render_target()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, multisample_framebuffer);
+
+		// Storage of a bound texture can't change its target, start from fresh names
+		glDeleteTextures(1, &multisample_texture_color);
+		glDeleteTextures(1, &multisample_texture_depth);
+		glGenTextures(1, &multisample_texture_color);
+		glGenTextures(1, &multisample_texture_depth);
+
+		ivec2 size = multisample_framebuffer_size;
+
+		if (msaa_samples > 1)
+		{
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_color);
+			glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, msaa_samples, GL_RGBA8, size.x, size.y, GL_TRUE);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_color, 0);
+
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_depth);
+			glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, msaa_samples, GL_DEPTH_COMPONENT24, size.x, size.y, GL_TRUE);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_depth, 0);
+		}
+		else
+		{
+			// Keep the material texture bound to the active unit
+			GLint prev_texture = 0;
+			glGetIntegerv(GL_TEXTURE_BINDING_2D, &prev_texture);
+
+			glBindTexture(GL_TEXTURE_2D, multisample_texture_color);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, multisample_texture_color, 0);
+
+			glBindTexture(GL_TEXTURE_2D, multisample_texture_depth);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size.x, size.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, multisample_texture_depth, 0);
+
+			glBindTexture(GL_TEXTURE_2D, prev_texture);
+		}
+	}
+
+	void init_post_copy()
+	{
+		auto params = CreateMaterialParams{};
+
+		params.attributes.add(ShaderFieldInfo{ "pos", ShaderFieldType::F32, false, 2 });
+		params.attributes.add(ShaderFieldInfo{ "tex_coord", ShaderFieldType::F32, false, 2 });
+
+		params.uniforms.add(ShaderFieldInfo{ "tex", ShaderFieldType::Texture, false, 1 });
+
+		params.vertex_shader = R"tag(
+#version 460 core
+
+in vec2 pos;
+in vec2 tex_coord;
+
+out vec2 v_tex_coord;
+
+void main()
+{
+gl_Position = vec4(pos, 0.0, 1.0);
+v_tex_coord = tex_coord;
+}
+)tag";
+
+		params.fragment_shader = R"tag(
+#version 460 core
+
+in vec2 v_tex_coord;
+
+layout(location = 0) uniform sampler2DMS tex;
+layout(location = 1) uniform vec2 src_size;
+layout(location = 2) uniform vec2 dst_size;
+
+out vec4 o_frag_color;
+
+// Average of all samples
+vec4 load(ivec2 p)
+{
+p = clamp(p, ivec2(0), ivec2(src_size) - 1);
+
+int samples = textureSamples(tex);
+vec4 sum = vec4(0.0);
+
+for (int i = 0; i < samples; ++i)
+	sum += texelFetch(tex, p, i);
+
+return sum / float(samples);
+}
+
+void main()
+{
+// Bilinear upscale of the rendered sub-rectangle
+vec2 p = v_tex_coord * src_size - 0.5;
+ivec2 i = ivec2(floor(p));
+vec2 f = p - vec2(i);
+
+o_frag_color = mix(
+	mix(load(i), load(i + ivec2(1, 0)), f.x),
+	mix(load(i + ivec2(0, 1)), load(i + ivec2(1, 1)), f.x),
+	f.y);
+}
+)tag";
+		auto material = create_material(params);
+
+		{
+			struct TmpVertex
+			{
+				vec2 pos;
+				vec2 tex_coord;
+			};
+
+			std::vector<TmpVertex> _vertices{
+				{ { -1, -1 }, { 0, 0 } },
+				{ {  1, -1 }, { 1, 0 } },
+				{ {  1,  1 }, { 1, 1 } },
+				{ { -1,  1 }, { 0, 1 } },
+			};
+			std::vector<uint16_t> _indices{ 0, 1, 2, 0, 2, 3, };
+
+			std::span<const uint8_t> vertices{ (uint8_t *)&*_vertices.begin(), (uint8_t *)&*_vertices.end() };
+			std::span<const uint16_t> indices{ _indices };
+
+			post_copy_material = std::static_pointer_cast<OpenGLMaterial>(material);
+
+			load_buffer_data<uint16_t>(post_copy_material->buffers, vertices, indices);
+		}
+	}
+
+	void post_copy()
+	{
+		// Hardware resolve handles equal sizes, and any scaling of single sample targets
+		if (msaa_samples == 1 || render_size == back_framebuffer_size)
+		{
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, multisample_framebuffer);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			glBlitFramebuffer(
+				0, 0, render_size.x, render_size.y,
+				0, 0, back_framebuffer_size.x, back_framebuffer_size.y,
+				GL_COLOR_BUFFER_BIT, render_size == back_framebuffer_size ? GL_NEAREST : GL_LINEAR);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glViewport(0, 0, back_framebuffer_size.x, back_framebuffer_size.y);
+			return;
+		}
+
+		glViewport(0, 0, back_framebuffer_size.x, back_framebuffer_size.y);
+		post_copy_material->program.use();
+		post_copy_material->vertex_layout->bind(post_copy_material->buffers->vbo.buffer, post_copy_material->buffers->ebo.buffer);
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_color);
+		glUniform1i(0, 0);
+
+		glUniform2fv(1, 1, &vec2(render_size)[0]);
+		glUniform2fv(2, 1, &vec2(back_framebuffer_size)[0]);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+		glEnable(GL_DEPTH_TEST);
+	}
+
+	void update_render_size()
+	{
+		float scale = get_render_scale();
+
+		render_size = ivec2(vec2(back_framebuffer_size) * scale) / 2 * 2;
+		render_size.x = std::clamp(render_size.x, std::min(2, multisample_framebuffer_size.x), multisample_framebuffer_size.x);
+		render_size.y = std::clamp(render_size.y, std::min(2, multisample_framebuffer_size.y), multisample_framebuffer_size.y);
+	}
+
+	// One command per cached draw, in task order
+	void upload_indirect_commands(Frame const &frame)
+	{
+		indirect_commands.clear();
+
+		for (auto const &task : frame.tasks)
+		{
+			if (auto const *content = std::get_if<DrawTaskTypes::DrawCached>(&task))
+			{
+				auto const *gcache = static_cast<OpenGLGraphicsCacheVertices const *>(content->cache.get());
+				DrawElementsIndirectCommand command{};
+
+				if (gcache->handle != GeometryPool::NO_HANDLE)
+				{
+					auto const &a = gcache->pool->allocations[gcache->handle];
+					command = { a.index_count, 1, a.first_index, (GLint)a.first_vertex, 0 };
+				}
+
+				indirect_commands.push_back(command);
+			}
+		}
+
+		indirect_buffer->bind();
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, indirect_commands.size() * sizeof(DrawElementsIndirectCommand), indirect_commands.data(), GL_STREAM_DRAW);
+	}
+
+	void begin_gpu_timer()
+	{
+		if (gpu_timer_frame >= gpu_timer_queries.size())
+		{
+			GLuint query = gpu_timer_queries[gpu_timer_frame % gpu_timer_queries.size()];
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+			if (available)
+			{
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+				gpu_frame_time.store((double)elapsed * 1e-9, std::memory_order_relaxed);
+			}
+		}
+
+		glBeginQuery(GL_TIME_ELAPSED, gpu_timer_queries[gpu_timer_frame % gpu_timer_queries.size()]);
+	}
+
+	void end_gpu_timer()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		++gpu_timer_frame;
+	}
+
+	virtual void draw(Frame const &frame) override
+	{
+		if (hot_reload)
+			hot_reload->apply(logger);
+
+		begin_gpu_timer();
+
+		update_render_size();
+
+		glViewport(0, 0, render_size.x, render_size.y);
+		glBindFramebuffer(GL_FRAMEBUFFER, multisample_framebuffer);
+
+		uniform_ring->begin_frame();
+
+		OpenGLDrawState state{ .uniform_ring = *uniform_ring, .textures = textures };
+
+		upload_indirect_commands(frame);
+		size_t indirect_index = 0;
+
+		for (size_t task_index = 0; task_index < frame.tasks.size(); ++task_index)
+		{
+			auto const &task = frame.tasks[task_index];
+
+			std::visit([&](auto &content) {
+				using T = std::decay_t<decltype(content)>;
+
+				if constexpr (std::is_same_v<T, DrawTaskTypes::DrawMaterial>)
+				{
+					auto gm = std::static_pointer_cast<OpenGLMaterial>(content.material);
+
+					GLenum index_type = GL_UNSIGNED_INT;
+					size_t index_size = sizeof(uint32_t);
+
+					// Indices are relative to their range, so only the largest range has to fit
+					bool short_ranges = std::all_of(content.ranges.begin(), content.ranges.end(), [](auto const &r) {
+						return r.vertex_count <= MAX_SHORT_INDEXED_VERTICES;
+					});
+
+					if (short_ranges)
+					{
+						narrow_indices(content.indices, short_indices);
+						load_buffer_data<uint16_t>(gm->buffers, content.vertices, short_indices);
+						index_type = GL_UNSIGNED_SHORT;
+						index_size = sizeof(uint16_t);
+					}
+					else
+					{
+						load_buffer_data<uint32_t>(gm->buffers, content.vertices, content.indices);
+					}
+
+					state.bind_vertex_buffers(*gm->vertex_layout, gm->buffers->vbo.buffer, gm->buffers->ebo.buffer);
+					gm->update_uniforms(state, frame.get_uniforms(*gm), frame.get_uniforms_version(*gm));
+
+					if (content.ranges.size() == 1)
+					{
+						auto const &r = content.ranges[0];
+						glDrawElementsBaseVertex(topology2glmode(content.topology), (GLsizei)r.index_count, index_type, (void *)(r.first_index * index_size), (GLint)r.base_vertex);
+					}
+					else
+					{
+						range_counts.clear();
+						range_offsets.clear();
+						range_base_vertices.clear();
+
+						for (auto const &r : content.ranges)
+						{
+							range_counts.push_back((GLsizei)r.index_count);
+							range_offsets.push_back((void *)(r.first_index * index_size));
+							range_base_vertices.push_back((GLint)r.base_vertex);
+						}
+
+						glMultiDrawElementsBaseVertex(topology2glmode(content.topology), range_counts.data(), index_type, range_offsets.data(), (GLsizei)content.ranges.size(), range_base_vertices.data());
+					}
+				}
+				else
 				if constexpr (std::is_same_v<T, DrawTaskTypes::DrawCached>)
 				{
-					auto gcache = std::static_pointer_cast<OpenGLGraphicsCacheVertices>(content.cache);
-					gcache->buffers->vao.bind();
-					gcache->material->update_uniforms(active_textures);
+					auto *gcache = static_cast<OpenGLGraphicsCacheVertices *>(content.cache.get());
+
+					// Following caches with the same material, pool and topology go into the same indirect draw
+					size_t run = 1;
+
+					while (task_index + run < frame.tasks.size())
+					{
+						auto const *next = std::get_if<DrawTaskTypes::DrawCached>(&frame.tasks[task_index + run]);
+
+						if (!next)
+							break;
+
+						auto *next_cache = static_cast<OpenGLGraphicsCacheVertices *>(next->cache.get());
+
+						if (next_cache->material != gcache->material || next_cache->pool != gcache->pool || next_cache->topology != gcache->topology)
+							break;
 
-					glDrawElements(GL_TRIANGLES, gcache->indices_count, GL_UNSIGNED_INT, 0);
+						++run;
+					}
+
+					state.bind_vertex_buffers(*gcache->pool->layout, gcache->pool->buffers.vbo.buffer, gcache->pool->buffers.ebo.buffer);
+					gcache->material->update_uniforms(state, frame.get_uniforms(*gcache->material), frame.get_uniforms_version(*gcache->material));
+
+					glMultiDrawElementsIndirect(topology2glmode(gcache->topology), gcache->pool->index_type, (void *)(indirect_index * sizeof(DrawElementsIndirectCommand)), (GLsizei)run, 0);
+
+					indirect_index += run;
+					task_index += run - 1;
 				}
 				else
 				if constexpr (std::is_same_v<T, DrawTaskTypes::ClearBackground>)
@@ -579,7 +2243,15 @@ o_frag_color = texelFetch(tex, ivec2(v_tex_coord * tex_size), 3);
 				else
 				if constexpr (std::is_same_v<T, DrawTaskTypes::SettingBlend>)
 				{
-					throw 1;
+					if (content.enable)
+					{
+						glEnable(GL_BLEND);
+						glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+					}
+					else
+					{
+						glDisable(GL_BLEND);
+					}
 				}
 				else
 				if constexpr (std::is_same_v<T, DrawTaskTypes::SettingDepth>)
@@ -596,59 +2268,150 @@ o_frag_color = texelFetch(tex, ivec2(v_tex_coord * tex_size), 3);
 			}, task);
 		}
 
-#if 1
 		post_copy();
-#else
-		// TODO: Causes flickering on resize
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, multisample_framebuffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-		glBlitFramebuffer(
-			0, 0, multisample_framebuffer_size.x, multisample_framebuffer_size.y,
-			0, 0, back_framebuffer_size.x, back_framebuffer_size.y,
-			GL_COLOR_BUFFER_BIT, GL_SCALED_RESOLVE_FASTEST_EXT);
-#endif // 0
+
+		uniform_ring->end_frame();
+		textures.end_frame();
+		end_gpu_timer();
+	}
+
+	std::string get_shader_source(char const *source, std::string const &file_name)
+	{
+		if (source)
+			return source;
+
+		if (auto text = read_text_file(file_name))
+			return std::move(*text);
+
+		if (logger)
+			logger->loge<LogCategory::Graphics>("Can't read shader {}", file_name);
+
+		throw 1;
 	}
 
 	virtual std::shared_ptr<Material> create_material(CreateMaterialParams const &params) override
 	{
-		return std::make_shared<OpenGLMaterial>(
-			OpenGL::Program::link(std::initializer_list<OpenGL::Shader>{
-				OpenGL::Shader::compile(GL_VERTEX_SHADER, params.vertex_shader),
-				OpenGL::Shader::compile(GL_FRAGMENT_SHADER, params.fragment_shader),
-			}),
-			params.attributes,
-			params.uniforms
-		);
+		return std::move(create_materials({ &params, 1 })[0]);
+	}
+
+	virtual std::vector<std::shared_ptr<Material>> create_materials(std::span<const CreateMaterialParams> params) override
+	{
+		struct PendingProgram
+		{
+			uint64_t key = 0;
+			bool from_cache = false;
+			std::vector<OpenGL::Shader> shaders;
+			std::optional<OpenGL::Program> program;
+		};
+
+		std::vector<PendingProgram> pending(params.size());
+
+		// Everything is submitted before the first status query, querying waits for that program
+		for (size_t i = 0; i < params.size(); ++i)
+		{
+			auto &p = pending[i];
+
+			std::string vertex_source = get_shader_source(params[i].vertex_shader, params[i].vertex_shader_file);
+			std::string fragment_source = get_shader_source(params[i].fragment_shader, params[i].fragment_shader_file);
+
+			p.key = program_cache->get_key(vertex_source, fragment_source, params[i].attributes.fields);
+			p.program = program_cache->load(p.key);
+
+			if (p.program)
+			{
+				p.from_cache = true;
+				continue;
+			}
+
+			p.shaders.push_back(OpenGL::Shader::begin_compile(GL_VERTEX_SHADER, vertex_source.c_str()));
+			p.shaders.push_back(OpenGL::Shader::begin_compile(GL_FRAGMENT_SHADER, fragment_source.c_str()));
+			p.program = OpenGL::Program::begin_link(p.shaders, params[i].attributes.fields);
+		}
+
+		std::vector<std::shared_ptr<Material>> result;
+		result.reserve(params.size());
+
+		for (size_t i = 0; i < params.size(); ++i)
+		{
+			auto &p = pending[i];
+
+			if (!p.from_cache)
+			{
+				if (!p.program->is_linked())
+				{
+					if (logger)
+						logger->loge<LogCategory::Graphics>("Material {} failed: {}", i, get_program_errors(p.shaders, *p.program));
+
+					throw 1;
+				}
+
+				program_cache->store(p.key, *p.program);
+			}
+
+			auto material = std::make_shared<OpenGLMaterial>(
+				std::move(*p.program),
+				params[i].attributes,
+				params[i].uniforms,
+				vertex_layouts
+			);
+
+			if (hot_reload && !params[i].vertex_shader_file.empty() && !params[i].fragment_shader_file.empty())
+				hot_reload->watch(material, params[i].vertex_shader_file, params[i].fragment_shader_file);
+
+			result.push_back(std::move(material));
+		}
+
+		return result;
 	}
 
 	virtual std::shared_ptr<GraphicsCacheVertices> create_cache_vertices(std::shared_ptr<Material> material)
 	{
-		return std::make_shared<OpenGLGraphicsCacheVertices>(std::move(material));
+		return std::make_shared<OpenGLGraphicsCacheVertices>(std::move(material), geometry_pools);
 	}
 
 	virtual void resize(ivec2 size, float resolution_scale) override
 	{
 		back_framebuffer_size = size;
 		multisample_framebuffer_size = ivec2(vec2(size) * resolution_scale) / 2 * 2;
+		max_render_scale.store(resolution_scale, std::memory_order_relaxed);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, multisample_framebuffer);
+		allocate_render_target();
+	}
 
-		glDeleteTextures(1, &multisample_texture_color);
-		glDeleteTextures(1, &multisample_texture_depth);
+	virtual void set_msaa_samples(uint32_t samples) override
+	{
+		if (samples != 1 && samples != 2 && samples != 4 && samples != 8)
+			throw 1;
 
-		glGenTextures(1, &multisample_texture_color);
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_color);
-		glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGBA, multisample_framebuffer_size.x, multisample_framebuffer_size.y, GL_TRUE);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_color, 0);
+		if (samples == msaa_samples)
+			return;
 
-		glGenTextures(1, &multisample_texture_depth);
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_depth);
-		glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_DEPTH_COMPONENT, multisample_framebuffer_size.x, multisample_framebuffer_size.y, GL_TRUE);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, multisample_texture_depth, 0);
+		msaa_samples = samples;
+		allocate_render_target();
+	}
+
+	virtual uint32_t get_msaa_samples() const override
+	{
+		return msaa_samples;
+	}
+
+	virtual void set_render_scale(float scale) override
+	{
+		render_scale.store(scale, std::memory_order_relaxed);
+	}
+
+	virtual float get_render_scale() const override
+	{
+		return std::min(render_scale.load(std::memory_order_relaxed), max_render_scale.load(std::memory_order_relaxed));
+	}
+
+	virtual double get_gpu_frame_time() const override
+	{
+		return gpu_frame_time.load(std::memory_order_relaxed);
 	}
 };
 
-std::unique_ptr<Graphics> _create_graphics()
+std::unique_ptr<Graphics> _create_graphics(CreateGraphicsParams const &params, GLWorkerContext worker_context)
 {
-	return std::make_unique<OpenGLGraphics>();
+	return std::make_unique<OpenGLGraphics>(params, std::move(worker_context));
 }
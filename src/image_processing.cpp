@@ -0,0 +1,668 @@
+#include "gfxengine/image_processing.hpp"
+
+#include "gfxengine/worker_pool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <numbers>
+#include <vector>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define GFXENGINE_IMAGE_SSE 1
+#else
+#define GFXENGINE_IMAGE_SSE 0
+#endif
+
+// Rows per job cover at least this many texels, smaller ranges cost more to hand out than to compute
+static constexpr size_t TEXELS_PER_RANGE = 16 * 1024;
+
+static constexpr int LANCZOS_LOBES = 3;
+
+// Row loaders return a row of premultiplied linear RGBA floats, either their own or written to scratch
+using RowLoader = std::function<float const *(size_t y, std::vector<float> &scratch)>;
+
+static void for_rows(WorkerPool *pool, size_t width, size_t height, std::function<void(size_t begin, size_t end)> const &body)
+{
+	if (pool)
+		pool->parallel_for(height, std::max<size_t>(TEXELS_PER_RANGE / std::max<size_t>(width, 1), 1), body);
+	else
+		body(0, height);
+}
+
+static void check_image(Image const &image)
+{
+	if (image.width == 0 || image.height == 0 || image.data.size() != image.width * image.height * Image::texel_size(image.format))
+		throw 1;
+}
+
+struct SrgbTables
+{
+	float decode[256];
+
+	// Linear value above which a byte rounds up to i + 1, the last entry ends the search
+	float thresholds[256];
+};
+
+static double decode_srgb(double s)
+{
+	return s <= 0.04045 ? s / 12.92 : std::pow((s + 0.055) / 1.055, 2.4);
+}
+
+static double encode_srgb(double l)
+{
+	return l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+}
+
+static SrgbTables const &srgb_tables()
+{
+	static SrgbTables const tables = []() {
+		SrgbTables t;
+
+		for (int i = 0; i < 256; ++i)
+			t.decode[i] = (float)decode_srgb(i / 255.0);
+
+		for (int i = 0; i < 255; ++i)
+			t.thresholds[i] = (float)decode_srgb((i + 0.5) / 255.0);
+
+		t.thresholds[255] = FLT_MAX;
+		return t;
+	}();
+
+	return tables;
+}
+
+// Same as rounding encode_srgb(linear) * 255, without the pow
+static uint8_t encode_srgb_byte(float linear, float const *thresholds)
+{
+	size_t i = 0;
+
+	for (size_t step = 128; step > 0; step >>= 1)
+	{
+		if (thresholds[i + step - 1] < linear)
+			i += step;
+	}
+
+	return (uint8_t)i;
+}
+
+static void load_linear(Image const &image, uint8_t const *row, size_t width, float *out)
+{
+	SrgbTables const &t = srgb_tables();
+
+	for (size_t x = 0; x < width; ++x)
+	{
+		float c[4];
+
+		if (image.format == Image::Format::RGBA)
+		{
+			uint8_t const *p = row + x * 4;
+			c[3] = p[3] * (1.0f / 255.0f);
+
+			if (image.srgb && !image.premultiplied)
+			{
+				c[0] = t.decode[p[0]];
+				c[1] = t.decode[p[1]];
+				c[2] = t.decode[p[2]];
+			}
+			else
+			{
+				c[0] = p[0] * (1.0f / 255.0f);
+				c[1] = p[1] * (1.0f / 255.0f);
+				c[2] = p[2] * (1.0f / 255.0f);
+			}
+		}
+		else
+		{
+			memcpy(c, row + x * 16, 16);
+
+			if (image.srgb && !image.premultiplied)
+			{
+				for (int k = 0; k < 3; ++k)
+					c[k] = (float)decode_srgb(c[k]);
+			}
+		}
+
+		if (!image.premultiplied)
+		{
+			c[0] *= c[3];
+			c[1] *= c[3];
+			c[2] *= c[3];
+		}
+		else if (image.srgb && c[3] > 0.0f)
+		{
+			// Premultiplied in the encoded values
+			for (int k = 0; k < 3; ++k)
+				c[k] = (float)decode_srgb(c[k] / c[3]) * c[3];
+		}
+
+		memcpy(out + x * 4, c, 16);
+	}
+}
+
+static void store_linear(Image const &image, float const *in, size_t width, uint8_t *row)
+{
+	SrgbTables const &t = srgb_tables();
+
+	for (size_t x = 0; x < width; ++x)
+	{
+		float c[4];
+		memcpy(c, in + x * 4, 16);
+
+		// Ringing of the filter may leave the range
+		float const a = std::clamp(c[3], 0.0f, 1.0f);
+
+		for (int k = 0; k < 3; ++k)
+		{
+			float v = a > 0.0f ? std::clamp(c[k] / a, 0.0f, 1.0f) : 0.0f;
+
+			if (image.srgb && image.premultiplied)
+				v = (float)encode_srgb(v) * a;
+			else if (image.premultiplied)
+				v *= a;
+
+			c[k] = v;
+		}
+
+		c[3] = a;
+
+		if (image.format == Image::Format::RGBA)
+		{
+			uint8_t *p = row + x * 4;
+
+			for (int k = 0; k < 3; ++k)
+				p[k] = image.srgb && !image.premultiplied ? encode_srgb_byte(c[k], t.thresholds) : (uint8_t)std::lrint(c[k] * 255.0f);
+
+			p[3] = (uint8_t)std::lrint(a * 255.0f);
+		}
+		else
+		{
+			if (image.srgb && !image.premultiplied)
+			{
+				for (int k = 0; k < 3; ++k)
+					c[k] = (float)encode_srgb(c[k]);
+			}
+
+			memcpy(row + x * 16, c, 16);
+		}
+	}
+}
+
+struct FilterTaps
+{
+	struct Tap
+	{
+		uint32_t first;
+		uint32_t count;
+		uint32_t weights;
+	};
+
+	std::vector<Tap> taps;
+	std::vector<float> weights;
+};
+
+static double lanczos(double x)
+{
+	if (x == 0.0)
+		return 1.0;
+
+	if (std::abs(x) >= LANCZOS_LOBES)
+		return 0.0;
+
+	double const px = std::numbers::pi * x;
+	return LANCZOS_LOBES * std::sin(px) * std::sin(px / LANCZOS_LOBES) / (px * px);
+}
+
+// Weights of the source texels for every destination texel along one axis
+static FilterTaps build_taps(size_t src, size_t dst, ResizeFilter filter)
+{
+	FilterTaps out;
+	out.taps.reserve(dst);
+
+	double const scale = (double)src / (double)dst;
+	double const support = std::max(scale, 1.0);
+	std::vector<double> w;
+
+	for (size_t i = 0; i < dst; ++i)
+	{
+		double lo;
+		double hi;
+
+		if (filter == ResizeFilter::Box)
+		{
+			lo = (double)i * scale;
+			hi = (double)(i + 1) * scale;
+		}
+		else
+		{
+			double const center = ((double)i + 0.5) * scale;
+			lo = center - LANCZOS_LOBES * support;
+			hi = center + LANCZOS_LOBES * support;
+		}
+
+		int64_t const first = std::clamp((int64_t)std::floor(lo), (int64_t)0, (int64_t)src - 1);
+		int64_t const last = std::clamp((int64_t)std::ceil(hi) - 1, first, (int64_t)src - 1);
+
+		w.assign((size_t)(last - first + 1), 0.0);
+		double sum = 0.0;
+
+		// Texels past the edges repeat the edge texel
+		for (int64_t j = (int64_t)std::floor(lo); j < (int64_t)std::ceil(hi); ++j)
+		{
+			double weight;
+
+			if (filter == ResizeFilter::Box)
+				weight = std::min(hi, (double)j + 1.0) - std::max(lo, (double)j);
+			else
+				weight = lanczos(((double)j + 0.5 - ((double)i + 0.5) * scale) / support);
+
+			w[(size_t)(std::clamp(j, first, last) - first)] += weight;
+			sum += weight;
+		}
+
+		out.taps.push_back({ (uint32_t)first, (uint32_t)w.size(), (uint32_t)out.weights.size() });
+
+		for (double v : w)
+			out.weights.push_back((float)(v / sum));
+	}
+
+	return out;
+}
+
+// out[x] = sum of weight * in[x] over texels, four floats each
+static void accumulate(float *out, float const *in, float weight, size_t texels)
+{
+	size_t x = 0;
+
+#if GFXENGINE_IMAGE_SSE
+	__m128 const w = _mm_set1_ps(weight);
+
+	for (; x < texels; ++x)
+		_mm_storeu_ps(out + x * 4, _mm_add_ps(_mm_loadu_ps(out + x * 4), _mm_mul_ps(_mm_loadu_ps(in + x * 4), w)));
+#endif
+
+	for (; x < texels; ++x)
+	{
+		for (int k = 0; k < 4; ++k)
+			out[x * 4 + k] += in[x * 4 + k] * weight;
+	}
+}
+
+static void filter_row(float const *in, FilterTaps const &taps, size_t width, float *out)
+{
+	for (size_t x = 0; x < width; ++x)
+	{
+		FilterTaps::Tap const &tap = taps.taps[x];
+		float const *w = taps.weights.data() + tap.weights;
+		float const *src = in + (size_t)tap.first * 4;
+
+#if GFXENGINE_IMAGE_SSE
+		__m128 acc = _mm_setzero_ps();
+
+		for (uint32_t k = 0; k < tap.count; ++k)
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + k * 4), _mm_set1_ps(w[k])));
+
+		_mm_storeu_ps(out + x * 4, acc);
+#else
+		float acc[4]{};
+
+		for (uint32_t k = 0; k < tap.count; ++k)
+		{
+			for (int c = 0; c < 4; ++c)
+				acc[c] += src[k * 4 + c] * w[k];
+		}
+
+		memcpy(out + x * 4, acc, 16);
+#endif
+	}
+}
+
+// Separable: rows are filtered horizontally into a temporary image, then its columns vertically
+static void resize_linear(RowLoader const &load, size_t src_width, size_t src_height, float *out, size_t width, size_t height, ResizeFilter filter, WorkerPool *pool)
+{
+	FilterTaps const horizontal = build_taps(src_width, width, filter);
+	FilterTaps const vertical = build_taps(src_height, height, filter);
+
+	std::vector<float> temp(width * src_height * 4);
+
+	for_rows(pool, src_width, src_height, [&](size_t begin, size_t end) {
+		thread_local std::vector<float> scratch;
+
+		for (size_t y = begin; y < end; ++y)
+			filter_row(load(y, scratch), horizontal, width, temp.data() + y * width * 4);
+	});
+
+	for_rows(pool, width, height, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y)
+		{
+			FilterTaps::Tap const &tap = vertical.taps[y];
+			float *row = out + y * width * 4;
+
+			std::fill(row, row + width * 4, 0.0f);
+
+			for (uint32_t k = 0; k < tap.count; ++k)
+				accumulate(row, temp.data() + (tap.first + k) * width * 4, vertical.weights[tap.weights + k], width);
+		}
+	});
+}
+
+static RowLoader image_loader(Image const &image, std::vector<uint8_t> const &data, size_t width)
+{
+	size_t const pitch = width * Image::texel_size(image.format);
+
+	return [&image, &data, width, pitch](size_t y, std::vector<float> &scratch) -> float const * {
+		scratch.resize(width * 4);
+		load_linear(image, data.data() + y * pitch, width, scratch.data());
+		return scratch.data();
+	};
+}
+
+static std::vector<uint8_t> store_image(Image const &image, std::vector<float> const &texels, size_t width, size_t height, WorkerPool *pool)
+{
+	size_t const pitch = width * Image::texel_size(image.format);
+	std::vector<uint8_t> data(pitch * height);
+
+	for_rows(pool, width, height, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y)
+			store_linear(image, texels.data() + y * width * 4, width, data.data() + y * pitch);
+	});
+
+	return data;
+}
+
+Image resize_image(Image const &image, size_t width, size_t height, ResizeFilter filter, WorkerPool *pool)
+{
+	check_image(image);
+
+	if (width == 0 || height == 0)
+		throw 1;
+
+	std::vector<float> texels(width * height * 4);
+	resize_linear(image_loader(image, image.data, image.width), image.width, image.height, texels.data(), width, height, filter, pool);
+
+	Image out;
+	out.width = width;
+	out.height = height;
+	out.format = image.format;
+	out.srgb = image.srgb;
+	out.premultiplied = image.premultiplied;
+	out.data = store_image(out, texels, width, height, pool);
+	return out;
+}
+
+static void downsample_2x2(float const *row0, float const *row1, size_t src_width, size_t width, float *out)
+{
+	for (size_t x = 0; x < width; ++x)
+	{
+		size_t const x0 = x * 2 * 4;
+		size_t const x1 = std::min(x * 2 + 1, src_width - 1) * 4;
+
+#if GFXENGINE_IMAGE_SSE
+		__m128 const sum = _mm_add_ps(
+			_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+			_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+
+		_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+		for (int k = 0; k < 4; ++k)
+			out[x * 4 + k] = (row0[x0 + k] + row0[x1 + k] + row1[x0 + k] + row1[x1 + k]) * 0.25f;
+#endif
+	}
+}
+
+void generate_mips(Image &image, WorkerPool *pool)
+{
+	check_image(image);
+
+	image.mips.clear();
+
+	size_t width = image.width;
+	size_t height = image.height;
+
+	// The level above in premultiplied linear floats, level 0 is read from the image instead
+	std::vector<float> above;
+	std::vector<float> level;
+
+	while (width > 1 || height > 1)
+	{
+		size_t const next_width = std::max<size_t>(width / 2, 1);
+		size_t const next_height = std::max<size_t>(height / 2, 1);
+
+		RowLoader load = above.empty()
+			? image_loader(image, image.data, width)
+			: RowLoader([&above, width](size_t y, std::vector<float> &) -> float const * { return above.data() + y * width * 4; });
+
+		level.resize(next_width * next_height * 4);
+
+		// Odd sizes cover one and a half texels per texel of the next level
+		if ((width % 2 == 0 || width == 1) && (height % 2 == 0 || height == 1))
+		{
+			for_rows(pool, next_width, next_height, [&](size_t begin, size_t end) {
+				thread_local std::vector<float> scratch0;
+				thread_local std::vector<float> scratch1;
+
+				for (size_t y = begin; y < end; ++y)
+				{
+					float const *row0 = load(y * 2, scratch0);
+					float const *row1 = load(std::min(y * 2 + 1, height - 1), scratch1);
+					downsample_2x2(row0, row1, width, next_width, level.data() + y * next_width * 4);
+				}
+			});
+		}
+		else
+		{
+			resize_linear(load, width, height, level.data(), next_width, next_height, ResizeFilter::Box, pool);
+		}
+
+		image.mips.push_back(store_image(image, level, next_width, next_height, pool));
+
+		std::swap(above, level);
+		width = next_width;
+		height = next_height;
+	}
+}
+
+static void premultiply_bytes(uint8_t *p, size_t texels)
+{
+	size_t x = 0;
+
+#if GFXENGINE_IMAGE_SSE
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const color_lanes = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+	__m128i const alpha_lanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+	__m128i const half = _mm_set1_epi16(128);
+
+	// c * a / 255 rounded is (t + (t >> 8)) >> 8 with t = c * a + 128, alpha is multiplied with 255
+	auto multiply = [&](__m128i v) {
+		__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		a = _mm_or_si128(_mm_and_si128(a, color_lanes), alpha_lanes);
+
+		__m128i const t = _mm_add_epi16(_mm_mullo_epi16(v, a), half);
+		return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	};
+
+	for (; x + 4 <= texels; x += 4)
+	{
+		__m128i const v = _mm_loadu_si128((__m128i const *)(p + x * 4));
+		__m128i const lo = multiply(_mm_unpacklo_epi8(v, zero));
+		__m128i const hi = multiply(_mm_unpackhi_epi8(v, zero));
+		_mm_storeu_si128((__m128i *)(p + x * 4), _mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	for (; x < texels; ++x)
+	{
+		uint8_t *c = p + x * 4;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t const t = (uint32_t)c[k] * c[3] + 128;
+			c[k] = (uint8_t)((t + (t >> 8)) >> 8);
+		}
+	}
+}
+
+static void premultiply_floats(uint8_t *p, size_t texels)
+{
+	for (size_t x = 0; x < texels; ++x)
+	{
+		float c[4];
+		memcpy(c, p + x * 16, 16);
+
+#if GFXENGINE_IMAGE_SSE
+		__m128 const v = _mm_loadu_ps(c);
+		_mm_storeu_ps(c, _mm_mul_ps(v, _mm_set_ps(1.0f, c[3], c[3], c[3])));
+#else
+		c[0] *= c[3];
+		c[1] *= c[3];
+		c[2] *= c[3];
+#endif
+
+		memcpy(p + x * 16, c, 16);
+	}
+}
+
+// Calls body(data, width, height) for the image and every mip
+template <typename F>
+static void for_levels(Image &image, F &&body)
+{
+	body(image.data, image.width, image.height);
+
+	for (size_t i = 0; i < image.mips.size(); ++i)
+		body(image.mips[i], std::max<size_t>(image.width >> (i + 1), 1), std::max<size_t>(image.height >> (i + 1), 1));
+}
+
+void premultiply_alpha(Image &image, WorkerPool *pool)
+{
+	check_image(image);
+
+	if (image.premultiplied)
+		return;
+
+	size_t const texel_size = Image::texel_size(image.format);
+
+	for_levels(image, [&](std::vector<uint8_t> &data, size_t width, size_t height) {
+		for_rows(pool, width, height, [&](size_t begin, size_t end) {
+			uint8_t *rows = data.data() + begin * width * texel_size;
+
+			if (image.format == Image::Format::RGBA)
+				premultiply_bytes(rows, (end - begin) * width);
+			else
+				premultiply_floats(rows, (end - begin) * width);
+		});
+	});
+
+	image.premultiplied = true;
+}
+
+static void bytes_to_floats(uint8_t const *in, uint8_t *out, size_t texels)
+{
+	size_t i = 0;
+	size_t const count = texels * 4;
+
+#if GFXENGINE_IMAGE_SSE
+	__m128i const zero = _mm_setzero_si128();
+	__m128 const scale = _mm_set1_ps(1.0f / 255.0f);
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i const v = _mm_loadu_si128((__m128i const *)(in + i));
+		__m128i const lo = _mm_unpacklo_epi8(v, zero);
+		__m128i const hi = _mm_unpackhi_epi8(v, zero);
+
+		__m128i const parts[4]{
+			_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero),
+		};
+
+		for (int k = 0; k < 4; ++k)
+			_mm_storeu_ps((float *)(out + (i + k * 4) * 4), _mm_mul_ps(_mm_cvtepi32_ps(parts[k]), scale));
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		float const v = in[i] * (1.0f / 255.0f);
+		memcpy(out + i * 4, &v, 4);
+	}
+}
+
+static void floats_to_bytes(uint8_t const *in, uint8_t *out, size_t texels)
+{
+	size_t i = 0;
+	size_t const count = texels * 4;
+
+#if GFXENGINE_IMAGE_SSE
+	__m128 const zero = _mm_setzero_ps();
+	__m128 const one = _mm_set1_ps(1.0f);
+	__m128 const scale = _mm_set1_ps(255.0f);
+
+	auto convert = [&](size_t at) {
+		__m128 const v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps((float const *)(in + at * 4)), zero), one);
+		return _mm_cvtps_epi32(_mm_mul_ps(v, scale));
+	};
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i const lo = _mm_packs_epi32(convert(i), convert(i + 4));
+		__m128i const hi = _mm_packs_epi32(convert(i + 8), convert(i + 12));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	// Rounds half to even like _mm_cvtps_epi32
+	for (; i < count; ++i)
+	{
+		float v;
+		memcpy(&v, in + i * 4, 4);
+		out[i] = (uint8_t)std::lrint(std::clamp(v, 0.0f, 1.0f) * 255.0f);
+	}
+}
+
+Image convert_image(Image const &image, Image::Format format, WorkerPool *pool)
+{
+	check_image(image);
+
+	Image out;
+	out.width = image.width;
+	out.height = image.height;
+	out.format = format;
+	out.srgb = image.srgb;
+	out.premultiplied = image.premultiplied;
+
+	if (format == image.format)
+	{
+		out.data = image.data;
+		out.mips = image.mips;
+		return out;
+	}
+
+	size_t const in_size = Image::texel_size(image.format);
+	size_t const out_size = Image::texel_size(format);
+
+	auto convert = [&](std::vector<uint8_t> const &in, size_t width, size_t height) {
+		std::vector<uint8_t> data(width * height * out_size);
+
+		for_rows(pool, width, height, [&](size_t begin, size_t end) {
+			uint8_t const *src = in.data() + begin * width * in_size;
+			uint8_t *dst = data.data() + begin * width * out_size;
+
+			if (format == Image::Format::RGBA32F)
+				bytes_to_floats(src, dst, (end - begin) * width);
+			else
+				floats_to_bytes(src, dst, (end - begin) * width);
+		});
+
+		return data;
+	};
+
+	out.data = convert(image.data, image.width, image.height);
+
+	for (size_t i = 0; i < image.mips.size(); ++i)
+		out.mips.push_back(convert(image.mips[i], std::max<size_t>(image.width >> (i + 1), 1), std::max<size_t>(image.height >> (i + 1), 1)));
+
+	return out;
+}
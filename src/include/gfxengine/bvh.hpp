@@ -0,0 +1,392 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+
+#include <optional>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define GFXENGINE_BVH_SSE 1
+#else
+#define GFXENGINE_BVH_SSE 0
+#endif
+
+struct ShaderValuesInfo;
+struct FrameCacheVertices;
+
+struct BVHRayHit
+{
+	uint32_t item;
+
+	// Along the ray direction, origin + dir * t
+	float t;
+};
+
+// Bounding volume hierarchy over item boxes, built with the surface area heuristic.
+// Items are indices into the boxes given to build(), a segment is a ray with max_t = 1:
+//
+//	BVH2 bvh;
+//	bvh.build(std::span<const Line2>(walls));
+//	auto hit = bvh.raycast(from, to - from, 1.0f, [&](uint32_t i, float) -> std::optional<float> {
+//		auto r = Line2{ from, to }.intersect(walls[i]);
+//		return r.type == Line2IntersectResultType::SegmentIntersect ? std::optional(r.phase0) : std::nullopt;
+//	});
+template <typename TBox>
+class BVH
+{
+public:
+
+	using Box = TBox;
+	using Point = decltype(TBox::min);
+
+	static constexpr size_t DIM = sizeof(Point) / sizeof(float);
+	static constexpr uint32_t NONE = UINT32_MAX;
+
+	// Depth-first, the left child of an inner node is the next node. Lanes past DIM repeat x so 4-wide tests work unchanged.
+	struct alignas(16) Node
+	{
+		float min[4];
+		float max[4];
+
+		// Leaf: first entry in items and count > 0. Inner: right child and count == 0.
+		uint32_t offset;
+		uint32_t count;
+	};
+
+private:
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> items;
+	std::vector<Box> boxes;
+
+	// For update()
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> item_nodes;
+
+	uint32_t build_node(uint32_t begin, uint32_t end, uint32_t depth, uint32_t max_leaf_size);
+	bool fit_node(uint32_t node);
+
+	static void set_bounds(Node &node, Box const &box)
+	{
+		for (size_t lane = 0; lane < 4; ++lane)
+		{
+			node.min[lane] = box.min[lane < DIM ? lane : 0];
+			node.max[lane] = box.max[lane < DIM ? lane : 0];
+		}
+	}
+
+	static void widen(Point const &p, float (&out)[4])
+	{
+		for (size_t lane = 0; lane < 4; ++lane)
+			out[lane] = p[lane < DIM ? lane : 0];
+	}
+
+public:
+
+	// Traversal keeps a fixed stack, build falls back to median splits before the tree gets deeper than this
+	static constexpr uint32_t MAX_DEPTH = 64;
+
+	void build(std::span<const Box> boxes, uint32_t max_leaf_size = 4);
+
+	// Anything with a bounds() returning Box, e.g. Line2, Triangle2 or Triangle3
+	template <typename T>
+	void build(std::span<const T> primitives, uint32_t max_leaf_size = 4)
+	{
+		std::vector<Box> primitive_boxes;
+		primitive_boxes.reserve(primitives.size());
+
+		for (auto const &p : primitives)
+			primitive_boxes.push_back(p.bounds());
+
+		build(primitive_boxes, max_leaf_size);
+	}
+
+	// Same items moved, the tree keeps its topology and only the node bounds change
+	void refit(std::span<const Box> boxes);
+
+	// Refits the path from the item's leaf up, stops where a node's bounds do not change
+	void update(uint32_t item, Box const &box);
+
+	void clear();
+
+	[[nodiscard]]
+	bool empty() const
+	{
+		return nodes.empty();
+	}
+
+	[[nodiscard]]
+	size_t get_item_count() const
+	{
+		return boxes.size();
+	}
+
+	[[nodiscard]]
+	std::span<const Node> get_nodes() const
+	{
+		return nodes;
+	}
+
+	[[nodiscard]]
+	Box const &get_box(uint32_t item) const
+	{
+		return boxes[item];
+	}
+
+	// visit(uint32_t item) for each item whose box overlaps, returns false to stop
+	template <typename F>
+	void query(Box const &box, F &&visit) const
+	{
+		if (nodes.empty())
+			return;
+
+		alignas(16) float box_min[4], box_max[4];
+		widen(box.min, box_min);
+		widen(box.max, box_max);
+
+#if GFXENGINE_BVH_SSE
+		__m128 const q_min = _mm_load_ps(box_min);
+		__m128 const q_max = _mm_load_ps(box_max);
+#endif
+
+		uint32_t stack[MAX_DEPTH];
+		uint32_t stack_size = 0;
+		uint32_t index = 0;
+
+		for (;;)
+		{
+			Node const &node = nodes[index];
+
+#if GFXENGINE_BVH_SSE
+			__m128 const inside = _mm_and_ps(
+				_mm_cmple_ps(_mm_load_ps(node.min), q_max),
+				_mm_cmple_ps(q_min, _mm_load_ps(node.max)));
+
+			bool const overlaps = _mm_movemask_ps(inside) == 0xF;
+#else
+			bool overlaps = true;
+
+			for (size_t lane = 0; lane < DIM; ++lane)
+				overlaps = overlaps && node.min[lane] <= box_max[lane] && box_min[lane] <= node.max[lane];
+#endif
+
+			if (overlaps)
+			{
+				if (node.count == 0)
+				{
+					stack[stack_size++] = node.offset;
+					index = index + 1;
+					continue;
+				}
+
+				for (uint32_t i = node.offset; i != node.offset + node.count; ++i)
+				{
+					Box const &b = boxes[items[i]];
+					bool item_overlaps = true;
+
+					for (size_t lane = 0; lane < DIM; ++lane)
+						item_overlaps = item_overlaps && b.min[lane] <= box.max[lane] && box.min[lane] <= b.max[lane];
+
+					if (item_overlaps && !visit(items[i]))
+						return;
+				}
+			}
+
+			if (stack_size == 0)
+				return;
+
+			index = stack[--stack_size];
+		}
+	}
+
+	// intersect(uint32_t item, float max_t) -> std::optional<float> returns the item's hit t, the nearest hit under max_t wins
+	template <typename F>
+	std::optional<BVHRayHit> raycast(Point origin, Point dir, float max_t, F &&intersect) const
+	{
+		if (nodes.empty())
+			return std::nullopt;
+
+		// Axis-parallel rays would divide by zero, a tiny component keeps the slabs finite
+		for (size_t axis = 0; axis < DIM; ++axis)
+		{
+			if (dir[axis] == 0.0f)
+				dir[axis] = 1e-20f;
+		}
+
+		alignas(16) float ray_origin[4], ray_inv_dir[4];
+		widen(origin, ray_origin);
+		widen(dir, ray_inv_dir);
+
+		for (float &v : ray_inv_dir)
+			v = 1.0f / v;
+
+		std::optional<BVHRayHit> best;
+		float best_t = max_t;
+
+		// Entry t of the ray into node, or nullopt when it misses or enters past best_t
+		auto enter = [&](Node const &node) -> std::optional<float> {
+#if GFXENGINE_BVH_SSE
+			__m128 const o = _mm_load_ps(ray_origin);
+			__m128 const inv = _mm_load_ps(ray_inv_dir);
+			__m128 const t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min), o), inv);
+			__m128 const t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max), o), inv);
+
+			__m128 near_t = _mm_min_ps(t0, t1);
+			__m128 far_t = _mm_max_ps(t0, t1);
+
+			near_t = _mm_max_ps(near_t, _mm_shuffle_ps(near_t, near_t, _MM_SHUFFLE(1, 0, 3, 2)));
+			near_t = _mm_max_ps(near_t, _mm_shuffle_ps(near_t, near_t, _MM_SHUFFLE(2, 3, 0, 1)));
+			far_t = _mm_min_ps(far_t, _mm_shuffle_ps(far_t, far_t, _MM_SHUFFLE(1, 0, 3, 2)));
+			far_t = _mm_min_ps(far_t, _mm_shuffle_ps(far_t, far_t, _MM_SHUFFLE(2, 3, 0, 1)));
+
+			float const t_near = std::max(_mm_cvtss_f32(near_t), 0.0f);
+			float const t_far = _mm_cvtss_f32(far_t);
+#else
+			float t_near = 0.0f;
+			float t_far = std::numeric_limits<float>::infinity();
+
+			for (size_t lane = 0; lane < DIM; ++lane)
+			{
+				float const t0 = (node.min[lane] - ray_origin[lane]) * ray_inv_dir[lane];
+				float const t1 = (node.max[lane] - ray_origin[lane]) * ray_inv_dir[lane];
+
+				t_near = std::max(t_near, std::min(t0, t1));
+				t_far = std::min(t_far, std::max(t0, t1));
+			}
+#endif
+
+			if (t_near > t_far || t_near > best_t)
+				return std::nullopt;
+
+			return t_near;
+		};
+
+		if (!enter(nodes[0]))
+			return std::nullopt;
+
+		struct Entry
+		{
+			uint32_t node;
+			float t;
+		};
+
+		Entry stack[MAX_DEPTH];
+		uint32_t stack_size = 0;
+		uint32_t index = 0;
+
+		for (;;)
+		{
+			Node const &node = nodes[index];
+
+			if (node.count == 0)
+			{
+				// Nearer child first, the farther one is skipped later if a hit closer than its entry was found
+				uint32_t left = index + 1, right = node.offset;
+				auto t_left = enter(nodes[left]);
+				auto t_right = enter(nodes[right]);
+
+				if (t_left && t_right)
+				{
+					if (*t_right < *t_left)
+					{
+						std::swap(left, right);
+						std::swap(t_left, t_right);
+					}
+
+					stack[stack_size++] = { right, *t_right };
+					index = left;
+					continue;
+				}
+
+				if (t_left || t_right)
+				{
+					index = t_left ? left : right;
+					continue;
+				}
+			}
+			else
+			{
+				for (uint32_t i = node.offset; i != node.offset + node.count; ++i)
+				{
+					auto t = intersect(items[i], best_t);
+
+					if (t && *t >= 0.0f && *t <= best_t)
+					{
+						best_t = *t;
+						best = BVHRayHit{ items[i], *t };
+					}
+				}
+			}
+
+			for (;;)
+			{
+				if (stack_size == 0)
+					return best;
+
+				Entry const &e = stack[--stack_size];
+
+				if (e.t <= best_t)
+				{
+					index = e.node;
+					break;
+				}
+			}
+		}
+	}
+};
+
+using BVH2 = BVH<AABB2>;
+using BVH3 = BVH<AABB3>;
+
+// Triangles of cached geometry for picking and collision, rebuild when the indices change and refit when only positions do
+class MeshBVH
+{
+private:
+
+	std::vector<Triangle3> triangles;
+	BVH3 bvh;
+
+	static bool read_triangles(ShaderValuesInfo const &attributes, FrameCacheVertices const &vertices, std::vector<Triangle3> &out);
+
+public:
+
+	// False when the vertices are no triangle list or have no position attribute, see ShaderValuesInfo::find_position_offset
+	bool build(ShaderValuesInfo const &attributes, FrameCacheVertices const &vertices);
+	void build(std::vector<Triangle3> triangles);
+
+	// Same indices with moved positions, false when the triangle count changed
+	bool refit(ShaderValuesInfo const &attributes, FrameCacheVertices const &vertices);
+
+	void set_triangle(uint32_t index, Triangle3 const &triangle);
+
+	[[nodiscard]]
+	std::span<const Triangle3> get_triangles() const
+	{
+		return triangles;
+	}
+
+	[[nodiscard]]
+	BVH3 const &get_bvh() const
+	{
+		return bvh;
+	}
+
+	// Nearest triangle hit in [0, max_t], either winding
+	[[nodiscard]]
+	std::optional<BVHRayHit> raycast(vec3 origin, vec3 dir, float max_t = std::numeric_limits<float>::infinity()) const
+	{
+		return bvh.raycast(origin, dir, max_t, [&](uint32_t i, float) {
+			return triangles[i].intersect_ray(origin, dir);
+		});
+	}
+
+	// visit(uint32_t triangle) for triangles whose bounds overlap box, returns false to stop
+	template <typename F>
+	void query(AABB3 const &box, F &&visit) const
+	{
+		bvh.query(box, visit);
+	}
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+
+#include <optional>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+struct ShaderValuesInfo;
+
+// Box around the attribute found by ShaderValuesInfo::find_position_offset, nullopt when there is none
+std::optional<AABB3> compute_vertex_bounds(ShaderValuesInfo const &attributes, std::span<const uint8_t> vertices);
+
+// Clip planes of a view-projection matrix, tested 4 at a time
+class Frustum
+{
+private:
+
+	// a*x + b*y + c*z + d >= 0 inside, 6 planes padded to 8 by repeating the last one
+	alignas(16) float a[8];
+	alignas(16) float b[8];
+	alignas(16) float c[8];
+	alignas(16) float d[8];
+
+public:
+
+	explicit Frustum(mat4 const &view_projection);
+
+	// False only when the box is entirely behind one of the planes, boxes near the corners may pass
+	[[nodiscard]]
+	bool intersects(AABB3 const &box) const;
+};
+
+// Coarse software depth buffer of occluders, rejects boxes hidden behind them:
+//
+//	occlusion.begin(view_projection);
+//	occlusion.add_occluder(terrain_positions, terrain_indices);
+//	frame.set_cull_view(view_projection, &occlusion);
+class OcclusionBuffer
+{
+private:
+
+	ivec2 size;
+	mat4 view_projection = mat4::identity();
+
+	// Nearest of the farthest depths (0..1) of occluder triangles covering each pixel center, 1 where nothing
+	std::vector<float> depth;
+
+public:
+
+	explicit OcclusionBuffer(ivec2 size = { 128, 64 });
+
+	// Clears the buffer
+	void begin(mat4 const &view_projection);
+
+	// World space triangles, they have to lie inside the geometry they stand for
+	void add_occluder(std::span<const vec3> positions, std::span<const uint32_t> indices);
+
+	[[nodiscard]]
+	bool is_visible(AABB3 const &box) const;
+
+	[[nodiscard]]
+	ivec2 get_size() const
+	{
+		return size;
+	}
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+class Graphics;
+
+struct DynamicResolutionParams
+{
+	// Frame time to stay under, in seconds
+	double frame_budget = 1.0 / 60.0;
+
+	// Scale goes up only while the frame takes less than this part of the budget
+	double headroom = 0.85;
+
+	float min_scale = 0.5f;
+	float max_scale = 1.0f;
+
+	// Largest change per adjustment, scale goes down faster than up
+	float max_step_down = 0.1f;
+	float max_step_up = 0.05f;
+
+	// Frames to wait after a change, GPU timings lag behind by a few frames
+	uint32_t cooldown_frames = 4;
+};
+
+// Picks the render scale each frame so that the frame time stays within the budget:
+//
+//	dynamic_resolution.update(window.get_graphics(), pacer.get_stats().average_work);
+class DynamicResolution
+{
+private:
+
+	DynamicResolutionParams params;
+
+	float scale = 1.0f;
+	double smoothed_time = 0.0;
+	uint32_t cooldown = 0;
+
+public:
+
+	DynamicResolution(DynamicResolutionParams const &params = {});
+
+	// Uses the GPU frame time when the graphics can measure it, cpu_time otherwise. Applies and returns the new scale.
+	float update(Graphics &graphics, double cpu_time);
+
+	// Same without touching graphics, frame_time is the time the resolution scale is expected to affect
+	float update(double frame_time);
+
+	[[nodiscard]]
+	float get_scale() const
+	{
+		return scale;
+	}
+
+	[[nodiscard]]
+	DynamicResolutionParams const &get_params() const
+	{
+		return params;
+	}
+
+	void set_params(DynamicResolutionParams const &params);
+};
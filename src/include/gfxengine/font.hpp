@@ -0,0 +1,117 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Quadratic Bezier from p0 over the control point p1 to p2, straight lines have p1 halfway
+struct GlyphCurve
+{
+	vec2 p0;
+	vec2 p1;
+	vec2 p2;
+};
+
+// Closed contours in font units with y up, filled by the non-zero winding rule
+struct GlyphOutline
+{
+	std::vector<GlyphCurve> curves;
+	vec2 min{};
+	vec2 max{};
+
+	[[nodiscard]]
+	bool empty() const
+	{
+		return curves.empty();
+	}
+};
+
+// In font units, descent is negative
+struct FontMetrics
+{
+	float units_per_em = 1.0f;
+	float ascent = 0.0f;
+	float descent = 0.0f;
+	float line_gap = 0.0f;
+};
+
+// TrueType font with glyf outlines. Reads only what layout and rasterization need: cmap formats 4 and 12, horizontal
+// metrics and pairs from the kern table, GPOS kerning and hinting are ignored.
+class Font
+{
+private:
+
+	std::vector<uint8_t> data;
+
+	uint32_t glyf = 0;
+	uint32_t loca = 0;
+	uint32_t hmtx = 0;
+	uint32_t cmap = 0;
+	uint32_t kern_pairs = 0;
+	uint16_t kern_pair_count = 0;
+	uint16_t cmap_format = 0;
+	uint16_t glyph_count = 0;
+	uint16_t metric_count = 0;
+	bool long_loca = false;
+
+	FontMetrics metrics;
+
+	// Glyphs of the first 128 code points, looked up for almost every character
+	uint16_t ascii_glyphs[128]{};
+
+	[[nodiscard]]
+	uint16_t u16(size_t offset) const;
+
+	[[nodiscard]]
+	int16_t i16(size_t offset) const
+	{
+		return (int16_t)u16(offset);
+	}
+
+	[[nodiscard]]
+	uint32_t u32(size_t offset) const;
+
+	uint16_t lookup_glyph(char32_t codepoint) const;
+
+	// Components of composite glyphs are transformed by (a b, c d) and moved by offset
+	void append_outline(uint16_t glyph, vec2 x_axis, vec2 y_axis, vec2 offset, GlyphOutline &out, int depth) const;
+
+	explicit Font(std::vector<uint8_t> data);
+
+public:
+
+	static Font load_sync(std::string_view file_name);
+	static Font load(std::span<const uint8_t> file_data);
+
+	// 0 is the missing glyph
+	[[nodiscard]]
+	uint16_t get_glyph(char32_t codepoint) const
+	{
+		return codepoint < 128 ? ascii_glyphs[codepoint] : lookup_glyph(codepoint);
+	}
+
+	[[nodiscard]]
+	float get_advance(uint16_t glyph) const;
+
+	// Added to the advance of left when right follows it
+	[[nodiscard]]
+	float get_kerning(uint16_t left, uint16_t right) const;
+
+	[[nodiscard]]
+	GlyphOutline get_outline(uint16_t glyph) const;
+
+	[[nodiscard]]
+	FontMetrics const &get_metrics() const
+	{
+		return metrics;
+	}
+
+	[[nodiscard]]
+	uint16_t get_glyph_count() const
+	{
+		return glyph_count;
+	}
+};
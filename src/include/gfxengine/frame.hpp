@@ -3,6 +3,7 @@
 #include "gfxengine/math.hpp"
 #include "gfxengine/image.hpp"
 #include "gfxengine/material.hpp"
+#include "gfxengine/culling.hpp"
 
 #include <cstdint>
 #include <cstddef>
@@ -13,12 +14,31 @@
 #include <functional>
 #include <memory>
 #include <variant>
+#include <unordered_map>
+
+static constexpr size_t PrimitiveTopology_version = 1;
+
+static_assert(PrimitiveTopology_version == 1, "Update PrimitiveTopology");
+enum class PrimitiveTopology : uint8_t
+{
+	Triangles,
+	TriangleStrip,
+	Lines,
+	LineStrip,
+	Points,
+};
+
+// Ends a strip, the next index starts a new one. Strips added one after another are separated by it automatically.
+static constexpr uint32_t PRIMITIVE_RESTART_INDEX = UINT32_MAX;
 
 struct FrameCacheVertices
 {
 	std::vector<uint8_t> vertices;
 	std::vector<uint32_t> indices;
 
+	// Taken from the first add_vertices() after clear(), everything added has to match
+	PrimitiveTopology topology = PrimitiveTopology::Triangles;
+
 	[[nodiscard]]
 	bool empty() const
 	{
@@ -37,25 +57,46 @@ struct FrameCacheVertices
 		indices = {};
 	}
 
-	void add_vertices(std::shared_ptr<Material> const &material, std::span<const uint8_t> vertices, std::span<const uint32_t> indices);
+	void add_vertices(std::shared_ptr<Material> const &material, std::span<const uint8_t> vertices, std::span<const uint32_t> indices, PrimitiveTopology topology = PrimitiveTopology::Triangles);
+
+	// Reorders triangles for the post-transform cache and vertices for fetch, see mesh_optimizer.hpp.
+	// Worth it for geometry loaded once and drawn many times, unreferenced vertices are dropped. Triangle lists only.
+	void optimize(ShaderValuesInfo const &attributes);
 };
 
 struct GraphicsCacheVertices
 {
 	virtual ~GraphicsCacheVertices() = default;
 	virtual void load(FrameCacheVertices const &c) = 0;
+	virtual Material const *get_material() const = 0;
 
 	const size_t stats_vertices_count = 0;
 	const size_t stats_indices_count = 0;
+
+	// Set by load, see compute_vertex_bounds
+	const std::optional<AABB3> bounds{};
+	const PrimitiveTopology topology = PrimitiveTopology::Triangles;
 };
 
 struct DrawTaskTypes
 {
+	struct DrawRange
+	{
+		uint32_t first_index;
+		uint32_t index_count;
+		uint32_t base_vertex;
+		uint32_t vertex_count;
+	};
+
 	struct DrawMaterial
 	{
 		std::shared_ptr<Material> material;
+		PrimitiveTopology topology;
 		std::vector<uint8_t> vertices;
+
+		// Relative to the base_vertex of their range, all ranges are drawn with one call
 		std::vector<uint32_t> indices;
+		std::vector<DrawRange> ranges;
 	};
 
 	struct DrawCached
@@ -98,6 +139,15 @@ using DrawTask = std::variant<
 	DrawTaskTypes::SettingBlend,
 	DrawTaskTypes::SettingDepth>;
 
+template <typename TVertex>
+struct VertexReservation
+{
+	std::span<TVertex> vertices;
+
+	// Relative to vertices[0]
+	std::span<uint32_t> indices;
+};
+
 struct FrameStats
 {
 	size_t draw_calls;
@@ -105,6 +155,10 @@ struct FrameStats
 	size_t indices;
 	size_t cache_vertices;
 	size_t cache_indices;
+
+	// Cached vertices dropped by add_cached_vertices, see Frame::set_cull_view
+	size_t culled_frustum;
+	size_t culled_occlusion;
 };
 
 class Frame
@@ -114,11 +168,42 @@ public:
 	std::vector<FrameCacheVertices *> caches;
 	std::vector<DrawTask> tasks;
 
+	// Material uniforms captured when the frame is handed to another thread, see snapshot_uniforms()
+	struct UniformSnapshot
+	{
+		std::vector<std::optional<ShaderFieldValue>> values;
+		uint64_t version;
+	};
+
+	std::unordered_map<Material const *, UniformSnapshot> uniform_snapshots;
+
 #if GFXENGINE_EDITOR
 	std::function<void()> draw_editor{};
 #endif // GFXENGINE_EDITOR
 
-	void add_vertices(std::shared_ptr<Material> const &material, std::span<const uint8_t> _vertices, std::span<const uint32_t> _indices);
+	std::optional<Frustum> cull_frustum;
+	OcclusionBuffer const *cull_occlusion = nullptr;
+	size_t culled_frustum = 0;
+	size_t culled_occlusion = 0;
+
+	// Reserved in caches.back(), its indices are offset and copied to the other caches by finish_reservation()
+	struct PendingReservation
+	{
+		std::shared_ptr<Material> material;
+		size_t first_vertex_byte;
+		size_t first_index;
+		uint32_t base_vertex;
+		PrimitiveTopology topology;
+	};
+
+	std::optional<PendingReservation> pending_reservation;
+
+	void finish_reservation();
+
+	void add_vertices(std::shared_ptr<Material> const &material, std::span<const uint8_t> _vertices, std::span<const uint32_t> _indices, PrimitiveTopology topology = PrimitiveTopology::Triangles);
+
+	[[nodiscard]]
+	bool is_culled(AABB3 const &bounds);
 
 public:
 
@@ -126,13 +211,49 @@ public:
 
 	void add_cached_vertices(std::shared_ptr<GraphicsCacheVertices> c)
 	{
+		if (cull_frustum && c->bounds && is_culled(*c->bounds))
+			return;
+
 		tasks.push_back(DrawTask(DrawTaskTypes::DrawCached{ .cache = c }));
 	}
 
+	// Cached vertices added after this are dropped when their bounds are outside the view, or hidden behind
+	// the occluders of `occlusion`, which has to stay unchanged until then. Lasts until reset().
+	void set_cull_view(mat4 const &view_projection, OcclusionBuffer const *occlusion = nullptr)
+	{
+		cull_frustum.emplace(view_projection);
+		cull_occlusion = occlusion;
+	}
+
+	void disable_culling()
+	{
+		cull_frustum.reset();
+		cull_occlusion = nullptr;
+	}
+
 	template <typename TVertex> requires(std::is_trivially_destructible_v<TVertex>)
-	void add_vertices(std::shared_ptr<Material> const &material, std::span<const TVertex> _vertices, std::span<const uint32_t> _indices)
+	void add_vertices(std::shared_ptr<Material> const &material, std::span<const TVertex> _vertices, std::span<const uint32_t> _indices, PrimitiveTopology topology = PrimitiveTopology::Triangles)
 	{
-		add_vertices(material, std::span<const uint8_t>((uint8_t const *)&*_vertices.begin(), (uint8_t const *)&*_vertices.end()), _indices);
+		add_vertices(material, std::span<const uint8_t>((uint8_t const *)&*_vertices.begin(), (uint8_t const *)&*_vertices.end()), _indices, topology);
+	}
+
+	// Space for geometry generated in place instead of copied in with add_vertices(), zero filled. Indices are
+	// relative to the first reserved vertex and never rewritten while drawing. The spans stay valid until the
+	// next call adding vertices, reserve all of a mesh at once since every reservation is its own range:
+	//
+	//	auto r = frame.reserve_vertices<Vertex>(material, 4 * quads, 6 * quads);
+	//	for (size_t i = 0; i < quads; ++i)
+	//		write_quad(r.vertices.subspan(i * 4, 4), r.indices.subspan(i * 6, 6), (uint32_t)i * 4);
+	VertexReservation<uint8_t> reserve_vertices(std::shared_ptr<Material> const &material, size_t vertex_count, size_t index_count, PrimitiveTopology topology = PrimitiveTopology::Triangles);
+
+	template <typename TVertex> requires(std::is_trivially_copyable_v<TVertex>)
+	VertexReservation<TVertex> reserve_vertices(std::shared_ptr<Material> const &material, size_t vertex_count, size_t index_count, PrimitiveTopology topology = PrimitiveTopology::Triangles)
+	{
+		if (sizeof(TVertex) != material->attribute_info.total_byte_size)
+			throw 1;
+
+		auto r = reserve_vertices(material, vertex_count, index_count, topology);
+		return { std::span<TVertex>((TVertex *)r.vertices.data(), vertex_count), r.indices };
 	}
 
 	template <typename TVertex> requires(std::is_trivially_destructible_v<TVertex>)
@@ -145,6 +266,19 @@ public:
 		);
 	}
 
+	// Consecutive lines and points of a material end up in one draw, the shader sets gl_PointSize
+	template <typename TVertex> requires(std::is_trivially_destructible_v<TVertex>)
+	void add_line(std::shared_ptr<Material> const &material, TVertex const &v0, TVertex const &v1)
+	{
+		add_vertices<TVertex>(material, std::initializer_list<TVertex>{ v0, v1 }, std::initializer_list<uint32_t>{ 0, 1 }, PrimitiveTopology::Lines);
+	}
+
+	template <typename TVertex> requires(std::is_trivially_destructible_v<TVertex>)
+	void add_point(std::shared_ptr<Material> const &material, TVertex const &v)
+	{
+		add_vertices<TVertex>(material, std::initializer_list<TVertex>{ v }, std::initializer_list<uint32_t>{ 0 }, PrimitiveTopology::Points);
+	}
+
 	void clear_background(ColorF const &color)
 	{
 		tasks.push_back(DrawTask(DrawTaskTypes::ClearBackground{ .color = color }));
@@ -160,6 +294,7 @@ public:
 		tasks.push_back(DrawTask(DrawTaskTypes::SettingCulling{ .enable = enable }));
 	}
 
+	// Premultiplied alpha, fragment shaders output the color already multiplied with alpha
 	void setting_blend(bool enable)
 	{
 		tasks.push_back(DrawTask(DrawTaskTypes::SettingBlend{ .enable = enable }));
@@ -180,6 +315,12 @@ public:
 	void reset()
 	{
 		tasks.clear();
+		uniform_snapshots.clear();
+		pending_reservation.reset();
+
+		disable_culling();
+		culled_frustum = 0;
+		culled_occlusion = 0;
 
 #if GFXENGINE_EDITOR
 		draw_editor = {};
@@ -191,8 +332,32 @@ public:
 	{
 		caches.push_back(&c);
 		func();
+		finish_reservation();
 		caches.pop_back();
 	}
 
 	FrameStats get_stats() const;
+
+	// Copies uniforms of every referenced material, so the game can change them while this frame is drawn
+	void snapshot_uniforms();
+
+	[[nodiscard]]
+	std::vector<std::optional<ShaderFieldValue>> const &get_uniforms(Material const &material) const
+	{
+		if (!uniform_snapshots.empty())
+			if (auto it = uniform_snapshots.find(&material); it != uniform_snapshots.end())
+				return it->second.values;
+
+		return material.get_uniforms();
+	}
+
+	[[nodiscard]]
+	uint64_t get_uniforms_version(Material const &material) const
+	{
+		if (!uniform_snapshots.empty())
+			if (auto it = uniform_snapshots.find(&material); it != uniform_snapshots.end())
+				return it->second.version;
+
+		return material.get_uniforms_version();
+	}
 };
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+
+class Platform;
+
+struct FramePacerParams
+{
+	// 0 = unlimited
+	double target_fps = 0.0;
+
+	// Delay the start of the frame (input sampling) so that submission lands right before the deadline
+	bool low_latency = false;
+
+	// Weight of the newest frame in the smoothed delta, 1 disables smoothing
+	double delta_smoothing = 0.1;
+
+	// Upper bound of the delta fed to game logic, e.g. after a hitch or a breakpoint
+	double max_delta = 0.25;
+
+	// The last part of every wait is spent spinning, the OS sleep overshoots by up to a timer tick
+	double spin_time = 0.002;
+};
+
+struct FramePacerStats
+{
+	uint64_t frames = 0;
+	uint64_t missed_deadlines = 0;
+
+	// Time between submissions, in seconds
+	double last_interval = 0.0;
+	double average_interval = 0.0;
+	double max_interval = 0.0;
+
+	// Standard deviation of the submission interval
+	double jitter = 0.0;
+
+	// Average time from begin_frame() to end_frame()
+	double average_work = 0.0;
+};
+
+// Paces the game loop to a target frame rate when vsync is off:
+//
+//	double dt = pacer.begin_frame();
+//	window.poll_events();
+//	update(dt);
+//	window.present(frame);
+//	pacer.end_frame();
+class FramePacer
+{
+private:
+
+	Platform &platform;
+	FramePacerParams params;
+
+	double frame_start = 0.0;
+	double prev_frame_start = 0.0;
+	double prev_submit = 0.0;
+	double deadline = 0.0;
+
+	double work_estimate = 0.0;
+	double raw_delta = 0.0;
+	double smoothed_delta = 0.0;
+
+	FramePacerStats stats;
+	double interval_m2 = 0.0;
+
+	void wait_until(double time);
+
+public:
+
+	FramePacer(Platform &platform, FramePacerParams const &params = {});
+
+	// Waits for the next frame slot, returns the smoothed delta
+	double begin_frame();
+
+	// Call right after the frame was handed to the window
+	void end_frame();
+
+	void set_target_fps(double target_fps);
+	void set_low_latency(bool enable);
+
+	[[nodiscard]]
+	FramePacerParams const &get_params() const
+	{
+		return params;
+	}
+
+	[[nodiscard]]
+	double get_delta() const
+	{
+		return smoothed_delta;
+	}
+
+	[[nodiscard]]
+	double get_raw_delta() const
+	{
+		return raw_delta;
+	}
+
+	[[nodiscard]]
+	FramePacerStats const &get_stats() const
+	{
+		return stats;
+	}
+
+	void reset_stats();
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+#include "gfxengine/font.hpp"
+#include "gfxengine/texture_atlas.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class WorkerPool;
+
+struct GlyphBitmap
+{
+	// White RGBA texels with the distance in alpha, 128 is the outline
+	std::vector<uint8_t> rgba;
+	ivec2 size{};
+
+	// Top left corner relative to the pen position on the baseline, in pixels with y down
+	vec2 offset{};
+};
+
+// Signed distance field of outline at scale pixels per font unit. Distances up to spread pixels on either side of
+// the outline are kept, the bitmap has a border of spread pixels around the glyph. Empty outlines give an empty
+// bitmap. Pure function, also usable to bake glyphs offline.
+GlyphBitmap generate_glyph_sdf(GlyphOutline const &outline, float scale, float spread);
+
+struct CachedGlyph
+{
+	AtlasRegion region;
+
+	// Top left corner of the region relative to the pen position, in pixels at the cache's em size
+	vec2 offset;
+};
+
+// Distance field glyphs of several fonts in one atlas, rasterized once at em_size pixels and scaled when drawn.
+// Glyphs are generated on the pool the first time find() asks for them and show up after a later update().
+// When all pages are full the page used least recently is emptied, its glyphs are generated again when needed.
+class GlyphCache
+{
+private:
+
+	struct Entry
+	{
+		CachedGlyph glyph{};
+		bool ready = false;
+	};
+
+	struct Result
+	{
+		uint32_t key;
+		GlyphBitmap bitmap;
+	};
+
+	// Shared with the jobs, so the cache may go away while some still run
+	struct Results
+	{
+		std::mutex mutex;
+		std::vector<Result> done;
+	};
+
+	WorkerPool *pool;
+	float em_size;
+	float spread;
+	TextureAtlas atlas;
+
+	std::vector<std::shared_ptr<Font const>> fonts;
+	std::unordered_map<uint32_t, Entry> glyphs;
+	std::vector<uint64_t> page_last_used;
+	std::shared_ptr<Results> results = std::make_shared<Results>();
+
+	// Finished, but every page was in use this frame
+	std::vector<Result> waiting;
+
+	uint64_t frame = 1;
+	size_t in_flight = 0;
+
+	bool insert(Result &result);
+
+public:
+
+	// Without a pool glyphs are generated inside find(). The atlas keeps at most max_pages pages growing up to
+	// page_size, enough for the glyphs of one frame.
+	explicit GlyphCache(WorkerPool *pool, float em_size = 48.0f, float spread = 6.0f, ivec2 page_size = { 1024, 1024 }, size_t max_pages = 2);
+
+	uint16_t add_font(std::shared_ptr<Font const> font);
+
+	[[nodiscard]]
+	Font const &get_font(uint16_t font) const
+	{
+		return *fonts.at(font);
+	}
+
+	// nullptr while the glyph is generated, empty glyphs like space have a region of size 0. Valid until update().
+	[[nodiscard]]
+	CachedGlyph const *find(uint16_t font, uint16_t glyph);
+
+	// Moves glyphs finished since the last call into the atlas, call once per frame on the game thread
+	void update();
+
+	[[nodiscard]]
+	TextureAtlas &get_atlas()
+	{
+		return atlas;
+	}
+
+	[[nodiscard]]
+	float get_em_size() const
+	{
+		return em_size;
+	}
+
+	[[nodiscard]]
+	float get_spread() const
+	{
+		return spread;
+	}
+
+	[[nodiscard]]
+	size_t get_pending_count() const
+	{
+		return in_flight + waiting.size();
+	}
+};
@@ -3,11 +3,32 @@
 #include "gfxengine/math.hpp"
 
 #include <memory>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
 
 struct GraphicsCacheVertices;
 class Frame;
 struct CreateMaterialParams;
 struct Material;
+class Logger;
+
+struct CreateGraphicsParams
+{
+	// Linked programs are stored here and reused while the shader sources and the driver stay the same, empty disables the cache
+	std::string program_cache_directory;
+
+	// Let the driver compile on its own threads when it supports GL_KHR_parallel_shader_compile, see create_materials
+	bool parallel_shader_compile = true;
+
+	// Recompile materials created from shader files when the files change, keeping the old program on errors
+	bool hot_reload_shaders = false;
+
+	// Receives shader compile logs. Used on the thread that calls draw and create_material, which is the render
+	// thread in render thread mode, while the game keeps logging to the same Logger. Logger locks for that.
+	Logger *logger = nullptr;
+};
 
 class Graphics
 {
@@ -17,6 +38,29 @@ public:
 
 	virtual void draw(Frame const &frame) = 0;
 	virtual std::shared_ptr<Material> create_material(CreateMaterialParams const &params) = 0;
+
+	// Same as create_material for each element, but all programs are compiled before the first one is waited on
+	virtual std::vector<std::shared_ptr<Material>> create_materials(std::span<const CreateMaterialParams> params) = 0;
+
 	virtual std::shared_ptr<GraphicsCacheVertices> create_cache_vertices(std::shared_ptr<Material> material) = 0;
+
+	// Allocates the render target for size * resolution_scale, the largest render scale usable afterwards
 	virtual void resize(ivec2 size, float resolution_scale) = 0;
+
+	// 1, 2, 4 or 8, reallocates the render target
+	virtual void set_msaa_samples(uint32_t samples) = 0;
+
+	[[nodiscard]]
+	virtual uint32_t get_msaa_samples() const = 0;
+
+	// Part of the render target drawn to, clamped to (0, resolution_scale], never reallocates.
+	// Thread safe, takes effect with the next frame.
+	virtual void set_render_scale(float scale) = 0;
+
+	[[nodiscard]]
+	virtual float get_render_scale() const = 0;
+
+	// GPU time of the last finished frame in seconds, 0 until available. Thread safe.
+	[[nodiscard]]
+	virtual double get_gpu_frame_time() const = 0;
 };
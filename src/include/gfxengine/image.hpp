@@ -11,6 +11,9 @@ struct Image
 	enum class Format
 	{
 		RGBA,
+
+		// Four floats per texel in data, 0..1 like the bytes of RGBA
+		RGBA32F,
 	};
 
 	std::vector<uint8_t> data;
@@ -18,6 +21,22 @@ struct Image
 	size_t height = 0;
 	Format format = Format::RGBA;
 
+	// Color channels are sRGB encoded, alpha is always linear
+	bool srgb = true;
+
+	// Color channels are multiplied with alpha, see premultiply_alpha()
+	bool premultiplied = false;
+
+	// Levels 1.. down to 1x1 in the same format, level i is max(1, width >> i) wide, see generate_mips().
+	// Empty when the renderer should generate them.
+	std::vector<std::vector<uint8_t>> mips;
+
+	[[nodiscard]]
+	static constexpr size_t texel_size(Format format)
+	{
+		return format == Format::RGBA32F ? 16 : 4;
+	}
+
 	static Image load_sync(std::string_view file_name);
 	static Image load(std::span<const uint8_t> file_data);
 };
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "gfxengine/image.hpp"
+
+#include <cstddef>
+
+class WorkerPool;
+
+// CPU image operations for RGBA and RGBA32F images. With a pool the rows are split across its threads, the calls
+// still return only once the result is complete.
+
+enum class ResizeFilter
+{
+	// Average of the covered texels, cheap and without ringing
+	Box,
+
+	// Windowed sinc with three lobes, keeps more detail when downsampling
+	Lanczos3,
+};
+
+// Same texels in the other format, the encoding flags and mips are kept
+[[nodiscard]]
+Image convert_image(Image const &image, Image::Format format, WorkerPool *pool = nullptr);
+
+// Multiplies the color channels with alpha as stored, which is how Frame::setting_blend blends. Includes the mips.
+void premultiply_alpha(Image &image, WorkerPool *pool = nullptr);
+
+// Filters in linear light for sRGB images and weights colors by alpha, transparent texels don't darken their
+// neighbours. The result has no mips.
+[[nodiscard]]
+Image resize_image(Image const &image, size_t width, size_t height, ResizeFilter filter = ResizeFilter::Lanczos3, WorkerPool *pool = nullptr);
+
+// Replaces image.mips with a full chain, every level box filtered from the one above in linear light. Levels are
+// computed from unrounded values, so sRGB quantization doesn't build up down the chain.
+void generate_mips(Image &image, WorkerPool *pool = nullptr);
@@ -4,14 +4,176 @@
 #include "gfxengine/buffered_cstr.hpp"
 
 #include <vector>
+#include <algorithm>
 #include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <cstring>
 
+// Binary log stream layout (native endianness):
+//   LogRecordHeader, followed by
+//   Format:  fmt_size bytes of format string, arg_count LogArgType tags
+//   Message: encoded arguments (strings as uint32_t length + bytes)
+// Format records are emitted the first time a format string is seen, so a stream is self-describing.
+
+enum class LogRecordType : uint8_t
+{
+	Format,
+	Message,
+};
+
+enum class LogArgType : uint8_t
+{
+	Bool, Char,
+	I8, U8,
+	I16, U16,
+	I32, U32,
+	I64, U64,
+	F32, F64,
+	Str,
+	Ptr,
+};
+
+struct LogRecordHeader
+{
+	uint32_t size; // including header
+	LogRecordType type;
+	uint8_t level;
+	uint8_t category;
+	uint8_t arg_count;
+	uint64_t time_ms;
+	uint64_t fmt_id;
+};
+
+template <typename T>
+struct LogArgTraits
+{
+	static constexpr bool supported = false;
+};
+
+template <typename T> requires(std::is_arithmetic_v<T>)
+struct LogArgTraits<T>
+{
+	static constexpr bool supported = true;
+
+	static constexpr LogArgType type()
+	{
+		if constexpr (std::is_same_v<T, bool>) return LogArgType::Bool;
+		else if constexpr (std::is_same_v<T, char>) return LogArgType::Char;
+		else if constexpr (std::is_floating_point_v<T>) return sizeof(T) == 4 ? LogArgType::F32 : LogArgType::F64;
+		else if constexpr (sizeof(T) == 1) return std::is_signed_v<T> ? LogArgType::I8 : LogArgType::U8;
+		else if constexpr (sizeof(T) == 2) return std::is_signed_v<T> ? LogArgType::I16 : LogArgType::U16;
+		else if constexpr (sizeof(T) == 4) return std::is_signed_v<T> ? LogArgType::I32 : LogArgType::U32;
+		else return std::is_signed_v<T> ? LogArgType::I64 : LogArgType::U64;
+	}
+
+	static constexpr size_t size(T const &) { return type() == LogArgType::F64 && sizeof(T) != 8 ? sizeof(double) : sizeof(T); }
+
+	static void write(uint8_t *out, T const &v)
+	{
+		if constexpr (std::is_floating_point_v<T> && sizeof(T) != 4 && sizeof(T) != 8)
+		{
+			double d = (double)v;
+			memcpy(out, &d, sizeof(d));
+		}
+		else
+		{
+			memcpy(out, &v, sizeof(v));
+		}
+	}
+};
+
+template <typename T>
+struct LogArgTraits<T *>
+{
+	static constexpr bool supported = true;
+
+	static constexpr LogArgType type() { return LogArgType::Ptr; }
+	static constexpr size_t size(T *) { return sizeof(uint64_t); }
+
+	static void write(uint8_t *out, T *v)
+	{
+		uint64_t p = (uint64_t)(uintptr_t)v;
+		memcpy(out, &p, sizeof(p));
+	}
+};
+
+struct _LogStrArgTraits
+{
+	static constexpr bool supported = true;
+
+	static constexpr LogArgType type() { return LogArgType::Str; }
+	static constexpr size_t size(std::string_view v) { return sizeof(uint32_t) + v.size(); }
+
+	static void write(uint8_t *out, std::string_view v)
+	{
+		uint32_t len = (uint32_t)v.size();
+		memcpy(out, &len, sizeof(len));
+		memcpy(out + sizeof(len), v.data(), v.size());
+	}
+};
+
+template <> struct LogArgTraits<char *> : _LogStrArgTraits {};
+template <> struct LogArgTraits<char const *> : _LogStrArgTraits {};
+template <size_t N> struct LogArgTraits<char[N]> : _LogStrArgTraits {};
+template <> struct LogArgTraits<std::string> : _LogStrArgTraits {};
+template <> struct LogArgTraits<std::string_view> : _LogStrArgTraits {};
+
+// Calls below these levels are removed at compile time: 0 - Verbose, 1 - Info, 2 - Warning, 3 - Error, 4 - Nothing
+#ifndef GFXENGINE_LOG_MIN_LEVEL
+#define GFXENGINE_LOG_MIN_LEVEL 0
+#endif // !GFXENGINE_LOG_MIN_LEVEL
+
+#ifndef GFXENGINE_LOG_MIN_LEVEL_GENERAL
+#define GFXENGINE_LOG_MIN_LEVEL_GENERAL GFXENGINE_LOG_MIN_LEVEL
+#endif // !GFXENGINE_LOG_MIN_LEVEL_GENERAL
+
+#ifndef GFXENGINE_LOG_MIN_LEVEL_PLATFORM
+#define GFXENGINE_LOG_MIN_LEVEL_PLATFORM GFXENGINE_LOG_MIN_LEVEL
+#endif // !GFXENGINE_LOG_MIN_LEVEL_PLATFORM
+
+#ifndef GFXENGINE_LOG_MIN_LEVEL_WINDOW
+#define GFXENGINE_LOG_MIN_LEVEL_WINDOW GFXENGINE_LOG_MIN_LEVEL
+#endif // !GFXENGINE_LOG_MIN_LEVEL_WINDOW
+
+#ifndef GFXENGINE_LOG_MIN_LEVEL_INPUT
+#define GFXENGINE_LOG_MIN_LEVEL_INPUT GFXENGINE_LOG_MIN_LEVEL
+#endif // !GFXENGINE_LOG_MIN_LEVEL_INPUT
+
+#ifndef GFXENGINE_LOG_MIN_LEVEL_GRAPHICS
+#define GFXENGINE_LOG_MIN_LEVEL_GRAPHICS GFXENGINE_LOG_MIN_LEVEL
+#endif // !GFXENGINE_LOG_MIN_LEVEL_GRAPHICS
+
+#ifndef GFXENGINE_LOG_MIN_LEVEL_APP
+#define GFXENGINE_LOG_MIN_LEVEL_APP GFXENGINE_LOG_MIN_LEVEL
+#endif // !GFXENGINE_LOG_MIN_LEVEL_APP
+
+enum class LogCategory : uint8_t
+{
+	General,
+	Platform,
+	Window,
+	Input,
+	Graphics,
+	App,
+};
+
+static constexpr size_t LogCategory_count = 6;
+
+// Can be used from any thread, messages are emitted one at a time. Handlers run under the lock and must not log
+// to the same Logger.
 class Logger
 {
 public:
 
-	enum class Level
+	enum class Level : uint8_t
 	{
+		Verbose,
 		Info,
 		Warning,
 		Error,
@@ -19,55 +181,87 @@ public:
 
 	using HandlerFunc = std::function<void(char const *c_str, size_t len)>;
 
+	// Receives one binary record per call, see LogRecordHeader
+	using BinaryHandlerFunc = std::function<void(std::span<const uint8_t> record)>;
+
 	Logger(Platform &_platform)
 		: platform{ _platform }
 	{
 	}
 
-	template <class... _Types>
+	static constexpr bool enabled(LogCategory category, Level level)
+	{
+		constexpr int table[LogCategory_count]{
+			GFXENGINE_LOG_MIN_LEVEL_GENERAL,
+			GFXENGINE_LOG_MIN_LEVEL_PLATFORM,
+			GFXENGINE_LOG_MIN_LEVEL_WINDOW,
+			GFXENGINE_LOG_MIN_LEVEL_INPUT,
+			GFXENGINE_LOG_MIN_LEVEL_GRAPHICS,
+			GFXENGINE_LOG_MIN_LEVEL_APP,
+		};
+
+		return int(level) >= table[size_t(category)];
+	}
+
+	template <LogCategory C = LogCategory::General, class... _Types>
+	void logv(std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
+	{
+		if constexpr (enabled(C, Level::Verbose))
+			handlet(C, Level::Verbose, _Fmt, _Args...);
+	}
+
+	template <LogCategory C = LogCategory::General, class... _Types>
 	void log(std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
 	{
-		handlet(Level::Info, _Fmt, _Args...);
+		if constexpr (enabled(C, Level::Info))
+			handlet(C, Level::Info, _Fmt, _Args...);
 	}
 
-	template <class... _Types>
+	template <LogCategory C = LogCategory::General, class... _Types>
 	void logw(std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
 	{
-		handlet(Level::Warning, _Fmt, _Args...);
+		if constexpr (enabled(C, Level::Warning))
+			handlet(C, Level::Warning, _Fmt, _Args...);
 	}
 
-	template <class... _Types>
+	template <LogCategory C = LogCategory::General, class... _Types>
 	void loge(std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
 	{
-		handlet(Level::Error, _Fmt, _Args...);
+		if constexpr (enabled(C, Level::Error))
+			handlet(C, Level::Error, _Fmt, _Args...);
 	}
 
-	template <class... _Types>
+	template <LogCategory C = LogCategory::General, class... _Types>
 	void logd(std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
 	{
 #ifndef NDEBUG
-		handlet(Level::Info, _Fmt, _Args...);
+		if constexpr (enabled(C, Level::Info))
+			handlet(C, Level::Info, _Fmt, _Args...);
 #endif // !NDEBUG
 	}
 
-	template <class... _Types>
+	template <LogCategory C = LogCategory::General, class... _Types>
 	void logdw(std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
 	{
 #ifndef NDEBUG
-		handlet(Level::Warning, _Fmt, _Args...);
+		if constexpr (enabled(C, Level::Warning))
+			handlet(C, Level::Warning, _Fmt, _Args...);
 #endif // !NDEBUG
 	}
 
-	template <class... _Types>
+	template <LogCategory C = LogCategory::General, class... _Types>
 	void logde(std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
 	{
 #ifndef NDEBUG
-		handlet(Level::Error, _Fmt, _Args...);
+		if constexpr (enabled(C, Level::Error))
+			handlet(C, Level::Error, _Fmt, _Args...);
 #endif // !NDEBUG
 	}
 
 	int add_handler(HandlerFunc handler)
 	{
+		std::lock_guard lock(mutex);
+
 		++last_handler_id;
 		handlers.emplace_back(last_handler_id, std::move(handler));
 		return last_handler_id;
@@ -75,12 +269,48 @@ public:
 
 	void remove_handler(int id)
 	{
+		std::lock_guard lock(mutex);
+
 		auto it = std::find_if(handlers.begin(), handlers.end(), [&](auto &v) { return v.id == id; });
 
 		if (it != handlers.end())
 			handlers.erase(it);
 	}
 
+	int add_binary_handler(BinaryHandlerFunc handler)
+	{
+		std::lock_guard lock(mutex);
+
+		++last_handler_id;
+		binary_handlers.emplace_back(last_handler_id, std::move(handler));
+
+		// New sink has to see every format definition
+		known_formats.clear();
+
+		return last_handler_id;
+	}
+
+	void remove_binary_handler(int id)
+	{
+		std::lock_guard lock(mutex);
+
+		auto it = std::find_if(binary_handlers.begin(), binary_handlers.end(), [&](auto &v) { return v.id == id; });
+
+		if (it != binary_handlers.end())
+			binary_handlers.erase(it);
+	}
+
+	// Token bucket per call site (format string): `burst` messages at once, refilled at `per_second`.
+	// per_second == 0 disables limiting for the category.
+	void set_rate_limit(LogCategory category, float per_second, float burst)
+	{
+		std::lock_guard lock(mutex);
+		rate_limits[size_t(category)] = RateLimit{ per_second, std::max(burst, 1.0f) };
+	}
+
+	// Emits pending "suppressed N messages" reports, call once per frame or before shutdown
+	void report_suppressed();
+
 private:
 
 	struct HandlerWithID
@@ -89,17 +319,145 @@ private:
 		HandlerFunc handler;
 	};
 
+	struct BinaryHandlerWithID
+	{
+		int id;
+		BinaryHandlerFunc handler;
+	};
+
+	struct RateLimit
+	{
+		float per_second = 0.0f;
+		float burst = 1.0f;
+	};
+
+	struct RateState
+	{
+		double tokens;
+		double last_time;
+		uint32_t suppressed;
+		LogCategory category;
+		Level level;
+	};
+
 	Platform &platform;
+
+	// Guards everything below
+	std::mutex mutex;
+
 	std::vector<HandlerWithID> handlers;
+	std::vector<BinaryHandlerWithID> binary_handlers;
 	int last_handler_id = 0;
 
+	std::vector<uint8_t> record;
+	std::unordered_set<char const *> known_formats;
+
+	RateLimit rate_limits[LogCategory_count]{};
+	std::unordered_map<char const *, RateState> rate_states;
+
+	template <class... _Types>
+	void handlet(LogCategory category, Level level, std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
+	{
+		std::lock_guard lock(mutex);
+
+		if (handlers.empty() && binary_handlers.empty()) return;
+
+		if (rate_limits[size_t(category)].per_second > 0.0f && rate_limited(category, level, _Fmt.get().data()))
+			return;
+
+		emit(category, level, _Fmt, _Args...);
+	}
+
 	template <class... _Types>
-	void handlet(Level level, std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
+	void emit(LogCategory category, Level level, std::format_string<const _Types &...> _Fmt, const _Types &... _Args)
 	{
+		if constexpr ((LogArgTraits<std::remove_cv_t<_Types>>::supported && ...))
+		{
+			if (!binary_handlers.empty())
+				handle_binary(category, level, _Fmt.get(), _Args...);
+		}
+		else
+		{
+			// Not encodable, binary handlers get the same preformatted text
+			auto buf = BufferedCStr<>::format(_Fmt, _Args...);
+
+			if (!binary_handlers.empty())
+				handle_binary(category, level, "{}", std::string_view(buf.c_str(), buf.len()));
+
+			if (!handlers.empty())
+				handle(category, level, buf.c_str(), buf.len());
+
+			return;
+		}
+
 		if (handlers.empty()) return;
 		auto buf = BufferedCStr<>::format(_Fmt, _Args...);
-		handle(level, buf.c_str(), buf.len());
+		handle(category, level, buf.c_str(), buf.len());
 	}
 
-	void handle(Level level, char const *c_str, size_t len);
+	template <class... _Types>
+	void handle_binary(LogCategory category, Level level, std::string_view fmt, const _Types &... _Args)
+	{
+		static_assert(sizeof...(_Types) <= 64, "Too many log arguments");
+
+		uint64_t time_ms = platform.get_system_time_ms();
+
+		if (!known_formats.contains(fmt.data()))
+		{
+			static constexpr LogArgType tags[]{ LogArgTraits<std::remove_cv_t<_Types>>::type()..., LogArgType::Bool };
+			emit_format(fmt, std::span<const LogArgType>(tags, sizeof...(_Types)), time_ms);
+		}
+
+		size_t size = sizeof(LogRecordHeader) + (LogArgTraits<std::remove_cv_t<_Types>>::size(_Args) + ... + 0);
+		record.resize(size);
+
+		LogRecordHeader header{};
+		header.size = (uint32_t)size;
+		header.type = LogRecordType::Message;
+		header.level = (uint8_t)level;
+		header.category = (uint8_t)category;
+		header.arg_count = (uint8_t)sizeof...(_Types);
+		header.time_ms = time_ms;
+		header.fmt_id = (uint64_t)(uintptr_t)fmt.data();
+		memcpy(record.data(), &header, sizeof(header));
+
+		uint8_t *out = record.data() + sizeof(header);
+		((LogArgTraits<std::remove_cv_t<_Types>>::write(out, _Args), out += LogArgTraits<std::remove_cv_t<_Types>>::size(_Args)), ...);
+
+		for (auto &h : binary_handlers)
+			h.handler(record);
+	}
+
+	// These run with mutex held
+	bool rate_limited(LogCategory category, Level level, char const *fmt);
+
+	void emit_format(std::string_view fmt, std::span<const LogArgType> tags, uint64_t time_ms);
+
+	void handle(LogCategory category, Level level, char const *c_str, size_t len);
+};
+
+// Turns a binary log stream back into text, usable from a sink or an offline tool
+class BinaryLogDecoder
+{
+public:
+
+	// Same text a Logger::HandlerFunc would have received
+	using OutputFunc = Logger::HandlerFunc;
+
+	// Consumes whole records, returns number of bytes used. Leftover partial record should be fed again with more data.
+	size_t feed(std::span<const uint8_t> data, OutputFunc const &output);
+
+private:
+
+	struct FormatInfo
+	{
+		std::string fmt;
+		std::vector<LogArgType> tags;
+	};
+
+	std::unordered_map<uint64_t, FormatInfo> formats;
+	std::string message;
+	std::string line;
+
+	void decode_message(FormatInfo const &info, std::span<const uint8_t> args);
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "gfxengine/math.hpp"
+#include "gfxengine/vertex_packing.hpp"
 
 #include <memory>
 #include <vector>
@@ -9,10 +10,11 @@
 #include <optional>
 
 struct Image;
+class AtlasPageTexture;
 
-static constexpr size_t ShaderFieldType_version = 2;
+static constexpr size_t ShaderFieldType_version = 3;
 
-static_assert(ShaderFieldType_version == 2, "Update ShaderFieldType");
+static_assert(ShaderFieldType_version == 3, "Update ShaderFieldType");
 enum class ShaderFieldType : uint16_t
 {
 	I8, U8,
@@ -24,14 +26,22 @@ enum class ShaderFieldType : uint16_t
 	Matrix4,
 	Vec1, Vec2, Vec3, Vec4,
 	Texture,
+
+	// Vertex attributes only, see vertex_packing.hpp. The 2_10_10_10 types are one vec4 per count.
+	F16,
+	I2_10_10_10, U2_10_10_10,
 };
 
+// img is uploaded once per Image, point to another Image to change the texture. Instead of img, atlas_page draws
+// a TextureAtlas page as of atlas_version, see TextureAtlas::get_texture().
 struct ShaderFieldTexture_t
 {
 	std::shared_ptr<Image> img;
+	std::shared_ptr<AtlasPageTexture> atlas_page;
+	uint64_t atlas_version = 0;
 };
 
-static_assert(ShaderFieldType_version == 2, "Update ShaderFieldValue");
+static_assert(ShaderFieldType_version == 3, "Update ShaderFieldValue");
 using ShaderFieldValue = std::variant<
 	int8_t, uint8_t,
 	int16_t, uint16_t,
@@ -40,7 +50,9 @@ using ShaderFieldValue = std::variant<
 	float, double,
 	mat4,
 	vec1, vec2, vec3, vec4,
-	ShaderFieldTexture_t
+	ShaderFieldTexture_t,
+	Half,
+	PackedI2_10_10_10, PackedU2_10_10_10
 >;
 
 struct ShaderFieldInfo
@@ -57,7 +69,7 @@ struct ShaderFieldInfo
 
 	static constexpr size_t type_size(ShaderFieldType t)
 	{
-		static_assert(ShaderFieldType_version == 2, "Update ShaderFieldInfo::type_size::table");
+		static_assert(ShaderFieldType_version == 3, "Update ShaderFieldInfo::type_size::table");
 		constexpr size_t table[]{
 			1, 1,
 			2, 2,
@@ -67,6 +79,8 @@ struct ShaderFieldInfo
 			4*16,
 			4, 8, 12, 16,
 			4,
+			2,
+			4, 4,
 		};
 
 		return table[size_t(t)];
@@ -83,14 +97,42 @@ struct ShaderValuesInfo
 		fields.push_back(field);
 		total_byte_size += field.byte_size();
 	}
+
+	// Byte offset of the first position-like field (F32 x3/x4, Vec3 or Vec4)
+	std::optional<size_t> find_position_offset() const
+	{
+		static_assert(ShaderFieldType_version == 3, "Update ShaderValuesInfo::find_position_offset");
+
+		size_t offset = 0;
+
+		for (auto const &f : fields)
+		{
+			bool floats = f.type == ShaderFieldType::F32 && (f.count == 3 || f.count == 4);
+			bool vector = (f.type == ShaderFieldType::Vec3 || f.type == ShaderFieldType::Vec4) && f.count == 1;
+
+			if (floats || vector)
+				return offset;
+
+			offset += f.byte_size();
+		}
+
+		return std::nullopt;
+	}
 };
 
+// Non-texture uniforms may be declared in `layout(std140) uniform Material { ... };`,
+// they are then uploaded as one block and skipped while unchanged
 struct CreateMaterialParams
 {
 	char const *vertex_shader = nullptr;
 	char const *fragment_shader = nullptr;
 	ShaderValuesInfo attributes;
 	ShaderValuesInfo uniforms;
+
+	// Sources are read from these when the pointers above are null. With CreateGraphicsParams::hot_reload_shaders
+	// the material is recompiled whenever either file changes.
+	std::string vertex_shader_file;
+	std::string fragment_shader_file;
 };
 
 struct Material
@@ -99,5 +141,36 @@ struct Material
 
 	ShaderValuesInfo attribute_info;
 	ShaderValuesInfo uniform_info;
+
+	[[nodiscard]]
+	std::vector<std::optional<ShaderFieldValue>> const &get_uniforms() const
+	{
+		return uniforms;
+	}
+
+	// Counts set_uniform() calls, the uniform block is packed again only when it changed
+	[[nodiscard]]
+	uint64_t get_uniforms_version() const
+	{
+		return uniforms_version;
+	}
+
+	void set_uniform(size_t index, ShaderFieldValue value)
+	{
+		uniforms.at(index) = std::move(value);
+		++uniforms_version;
+	}
+
+	// After writing uniforms directly instead of through set_uniform()
+	void mark_uniforms_changed()
+	{
+		++uniforms_version;
+	}
+
+	// By uniform_info index. Direct writes are only picked up after mark_uniforms_changed().
 	std::vector<std::optional<ShaderFieldValue>> uniforms;
+
+private:
+
+	uint64_t uniforms_version = 0;
 };
@@ -3,6 +3,10 @@
 #include <cmath>
 #include <limits>
 #include <array>
+#include <algorithm>
+#include <optional>
+#include <functional>
+#include <cstdint>
 
 /*
 #define GLM_FORCE_XYZW_ONLY
@@ -2106,16 +2110,42 @@ constexpr VT abs(const VT val)
 	return _comp(val, abs<VT::template value_type>);
 }
 
+// Murmur3 finalizer, every input bit affects every output bit
+constexpr uint64_t hash_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+// Order dependent, (a, b) and (b, a) hash differently
+constexpr size_t hash_combine(size_t seed, size_t value)
+{
+	return (size_t)hash_mix(seed + 0x9e3779b97f4a7c15ull + value);
+}
+
+template <typename T, typename... Rest>
+constexpr size_t hash_values(T const &first, Rest const &...rest)
+{
+	size_t h = (size_t)hash_mix(std::hash<T>{}(first));
+	((h = hash_combine(h, std::hash<Rest>{}(rest))), ...);
+	return h;
+}
+
 } // namespace math
 
 namespace std
 {
 
-template <typename T> struct hash<math::vec1_base<T>> { size_t operator()(const math::vec1_base<T> &v) const { return hash<T>{}(v.x); } };
-template <typename T> struct hash<math::vec2_base<T>> { size_t operator()(const math::vec2_base<T> &v) const { return hash<T>{}(v.x) ^ hash<T>{}(v.y) << 1; } };
-template <typename T> struct hash<math::vec3_base<T>> { size_t operator()(const math::vec3_base<T> &v) const { return hash<T>{}(v.x) ^ hash<T>{}(v.y) << 1 ^ hash<T>{}(v.z) << 2; } };
-template <typename T> struct hash<math::vec4_base<T>> { size_t operator()(const math::vec4_base<T> &v) const { return hash<T>{}(v.x) ^ hash<T>{}(v.y) << 1 ^ hash<T>{}(v.z) << 2 ^ hash<T>{}(v.w) >> 1; } };
-template <typename T> struct hash<math::mat4x4_base<T>> { size_t operator()(const math::mat4x4_base<T> &v) const { return hash<math::vec4_base<T>>{}(v.col0) ^ hash<math::vec4_base<T>>{}(v.col1) << 1 ^ hash<math::vec4_base<T>>{}(v.col2) << 2 ^ hash<math::vec4_base<T>>{}(v.col3) >> 1; } };
+// Mixed so that neighbouring integer coordinates spread over the whole table, std::hash<int> may be the identity
+template <typename T> struct hash<math::vec1_base<T>> { size_t operator()(const math::vec1_base<T> &v) const { return math::hash_values(v.x); } };
+template <typename T> struct hash<math::vec2_base<T>> { size_t operator()(const math::vec2_base<T> &v) const { return math::hash_values(v.x, v.y); } };
+template <typename T> struct hash<math::vec3_base<T>> { size_t operator()(const math::vec3_base<T> &v) const { return math::hash_values(v.x, v.y, v.z); } };
+template <typename T> struct hash<math::vec4_base<T>> { size_t operator()(const math::vec4_base<T> &v) const { return math::hash_values(v.x, v.y, v.z, v.w); } };
+template <typename T> struct hash<math::mat4x4_base<T>> { size_t operator()(const math::mat4x4_base<T> &v) const { return math::hash_values(v.col0, v.col1, v.col2, v.col3); } };
 
 } // namespace std
 
@@ -2156,6 +2186,45 @@ struct Line2IntersectResult
 	}
 };
 
+struct AABB2
+{
+	vec2 min, max;
+
+	// Contains nothing, the first add() sets it to that point
+	static constexpr AABB2 empty()
+	{
+		constexpr float inf = std::numeric_limits<float>::infinity();
+		return { { inf, inf }, { -inf, -inf } };
+	}
+
+	constexpr bool is_empty() const
+	{
+		return min.x > max.x;
+	}
+
+	constexpr void add(vec2 p)
+	{
+		min = { std::min(min.x, p.x), std::min(min.y, p.y) };
+		max = { std::max(max.x, p.x), std::max(max.y, p.y) };
+	}
+
+	constexpr void add(AABB2 const &other)
+	{
+		min = { std::min(min.x, other.min.x), std::min(min.y, other.min.y) };
+		max = { std::max(max.x, other.max.x), std::max(max.y, other.max.y) };
+	}
+
+	constexpr vec2 center() const
+	{
+		return (min + max) / 2.0f;
+	}
+
+	constexpr vec2 size() const
+	{
+		return max - min;
+	}
+};
+
 struct Line2
 {
 	vec2 p0, p1;
@@ -2202,6 +2271,13 @@ struct Line2
 	{
 		return p0 == p1;
 	}
+
+	constexpr AABB2 bounds() const
+	{
+		AABB2 result{ p0, p0 };
+		result.add(p1);
+		return result;
+	}
 };
 
 struct Triangle2
@@ -2217,6 +2293,98 @@ struct Triangle2
 	{
 		return (p0 + p1 + p2) / 3.0f;
 	}
+
+	constexpr AABB2 bounds() const
+	{
+		AABB2 result{ p0, p0 };
+		result.add(p1);
+		result.add(p2);
+		return result;
+	}
+};
+
+struct AABB3
+{
+	vec3 min, max;
+
+	// Contains nothing, the first add() sets it to that point
+	static constexpr AABB3 empty()
+	{
+		constexpr float inf = std::numeric_limits<float>::infinity();
+		return { { inf, inf, inf }, { -inf, -inf, -inf } };
+	}
+
+	constexpr bool is_empty() const
+	{
+		return min.x > max.x;
+	}
+
+	constexpr void add(vec3 p)
+	{
+		min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+		max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+	}
+
+	constexpr void add(AABB3 const &other)
+	{
+		min = { std::min(min.x, other.min.x), std::min(min.y, other.min.y), std::min(min.z, other.min.z) };
+		max = { std::max(max.x, other.max.x), std::max(max.y, other.max.y), std::max(max.z, other.max.z) };
+	}
+
+	constexpr vec3 center() const
+	{
+		return (min + max) / 2.0f;
+	}
+
+	constexpr vec3 size() const
+	{
+		return max - min;
+	}
+};
+
+struct Triangle3
+{
+	vec3 p0, p1, p2;
+
+	constexpr vec3 center() const
+	{
+		return (p0 + p1 + p2) / 3.0f;
+	}
+
+	constexpr AABB3 bounds() const
+	{
+		AABB3 result{ p0, p0 };
+		result.add(p1);
+		result.add(p2);
+		return result;
+	}
+
+	// Möller-Trumbore, t along dir of the hit on either side
+	constexpr std::optional<float> intersect_ray(vec3 origin, vec3 dir) const
+	{
+		const vec3 e1 = p1 - p0;
+		const vec3 e2 = p2 - p0;
+		const vec3 p = dir.cross(e2);
+		const float det = e1.dot(p);
+
+		if (det == 0.0f)
+			return std::nullopt;
+
+		const float inv_det = 1.0f / det;
+		const vec3 s = origin - p0;
+		const float u = s.dot(p) * inv_det;
+
+		if (u < 0.0f || u > 1.0f)
+			return std::nullopt;
+
+		const vec3 q = s.cross(e1);
+		const float v = dir.dot(q) * inv_det;
+
+		if (v < 0.0f || u + v > 1.0f)
+			return std::nullopt;
+
+		return e2.dot(q) * inv_det;
+	}
 };
 
 struct Color
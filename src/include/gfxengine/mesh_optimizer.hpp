@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Reorders triangles so that consecutive ones reuse vertices still in the GPU's post-transform cache (Tom Forsyth's
+// linear-speed vertex cache optimisation). Indices are rewritten in place, vertices are unchanged.
+void optimize_vertex_cache(std::span<uint32_t> indices, size_t vertex_count);
+
+// Moves vertices into the order the indices first use them and drops unreferenced ones, run after
+// optimize_vertex_cache so vertex fetches walk memory forward. Returns the new vertex count.
+size_t optimize_vertex_fetch(std::vector<uint8_t> &vertices, size_t stride, std::span<uint32_t> indices);
+
+// Average vertices transformed per triangle with a FIFO cache of cache_size, 0.5 is the best possible and 3 the worst
+[[nodiscard]]
+float compute_vertex_cache_acmr(std::span<const uint32_t> indices, size_t vertex_count, size_t cache_size = 16);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Rectangle packer that keeps the top edge of the packed area as horizontal segments and places every rectangle
+// where its top ends lowest. Packs rectangles arriving in any order tightly, so it suits atlases filled at runtime.
+class SkylinePacker
+{
+private:
+
+	struct Segment
+	{
+		int32_t x;
+		int32_t y;
+		int32_t width;
+	};
+
+	ivec2 size;
+	std::vector<Segment> skyline;
+	int64_t used_area = 0;
+
+	// Lowest y a rectangle of width can be placed at starting on segment index, nullopt when it doesn't fit
+	std::optional<int32_t> fit(size_t index, int32_t width, int32_t height) const;
+
+public:
+
+	explicit SkylinePacker(ivec2 size);
+
+	// Top left corner of the rectangle, nullopt when there is no room left for it
+	[[nodiscard]]
+	std::optional<ivec2> pack(ivec2 rect);
+
+	// Extends the area right and down, packed rectangles keep their place
+	void grow(ivec2 new_size);
+
+	void clear();
+
+	[[nodiscard]]
+	ivec2 get_size() const
+	{
+		return size;
+	}
+
+	// Packed area relative to the whole area
+	[[nodiscard]]
+	float get_occupancy() const
+	{
+		return (float)((double)used_area / ((double)size.x * (double)size.y));
+	}
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// Open addressing map from integer grid cells (ivec2, ivec3) to values, linear probing over one flat array:
+//
+//	SpatialHash<ivec3, Chunk> chunks;
+//	chunks[SpatialHash<ivec3, Chunk>::cell_of(player_position, CHUNK_SIZE)].load();
+//	chunks.for_each_neighbor(center, 1, [&](ivec3 cell, Chunk &chunk) { ... });
+//
+// Values have to be default constructible, erased slots are reset to Value{}.
+// Pointers to values stay valid until the next insert or erase.
+template <typename Key, typename Value>
+class SpatialHash
+{
+public:
+
+	using Coord = typename Key::value_type;
+
+	static constexpr size_t DIM = sizeof(Key) / sizeof(Coord);
+
+private:
+
+	struct Slot
+	{
+		Key key{};
+		Value value{};
+	};
+
+	std::vector<Slot> slots;
+	std::vector<uint8_t> used;
+	size_t count = 0;
+	size_t mask = 0;
+
+	size_t home(Key const &key) const
+	{
+		return std::hash<Key>{}(key) & mask;
+	}
+
+	// Slot holding key, or the empty slot where it would go
+	size_t probe(Key const &key) const
+	{
+		size_t i = home(key);
+
+		while (used[i] && !(slots[i].key == key))
+			i = (i + 1) & mask;
+
+		return i;
+	}
+
+	void rehash(size_t capacity)
+	{
+		std::vector<Slot> old_slots(capacity);
+		std::vector<uint8_t> old_used(capacity, 0);
+
+		std::swap(slots, old_slots);
+		std::swap(used, old_used);
+		mask = capacity - 1;
+
+		for (size_t i = 0; i < old_slots.size(); ++i)
+		{
+			if (!old_used[i])
+				continue;
+
+			size_t j = probe(old_slots[i].key);
+			slots[j] = std::move(old_slots[i]);
+			used[j] = 1;
+		}
+	}
+
+public:
+
+	explicit SpatialHash(size_t capacity = 0)
+	{
+		reserve(capacity);
+	}
+
+	// Cell containing position for a grid of cell_size, rounds toward negative infinity
+	template <typename Point>
+	static Key cell_of(Point const &position, float cell_size)
+	{
+		Key cell{};
+
+		for (size_t i = 0; i < DIM; ++i)
+			cell[i] = (Coord)std::floor(position[i] / cell_size);
+
+		return cell;
+	}
+
+	// Room for count values without growing, the table stays at most 3/4 full
+	void reserve(size_t _count)
+	{
+		size_t capacity = std::bit_ceil(std::max<size_t>(_count + _count / 3 + 1, 16));
+
+		if (capacity > slots.size())
+			rehash(capacity);
+	}
+
+	[[nodiscard]]
+	Value *find(Key const &key)
+	{
+		if (count == 0)
+			return nullptr;
+
+		size_t i = probe(key);
+		return used[i] ? &slots[i].value : nullptr;
+	}
+
+	[[nodiscard]]
+	Value const *find(Key const &key) const
+	{
+		return const_cast<SpatialHash *>(this)->find(key);
+	}
+
+	[[nodiscard]]
+	bool contains(Key const &key) const
+	{
+		return find(key) != nullptr;
+	}
+
+	// Value of key, inserted as Value{} when missing. Second is true when it was inserted.
+	std::pair<Value *, bool> try_emplace(Key const &key)
+	{
+		if (slots.empty())
+			rehash(16);
+
+		size_t i = probe(key);
+
+		if (used[i])
+			return { &slots[i].value, false };
+
+		// Only an insert grows the table, finding a key keeps pointers valid
+		if ((count + 1) * 4 > slots.size() * 3)
+		{
+			rehash(slots.size() * 2);
+			i = probe(key);
+		}
+
+		slots[i].key = key;
+		used[i] = 1;
+		++count;
+
+		return { &slots[i].value, true };
+	}
+
+	Value &operator [] (Key const &key)
+	{
+		return *try_emplace(key).first;
+	}
+
+	bool erase(Key const &key)
+	{
+		if (count == 0)
+			return false;
+
+		size_t i = probe(key);
+
+		if (!used[i])
+			return false;
+
+		// Backward shift, moves later entries of the cluster into the hole so lookups never need tombstones
+		for (size_t j = (i + 1) & mask; used[j]; j = (j + 1) & mask)
+		{
+			size_t h = home(slots[j].key);
+
+			// j may move to i only when its home is not cyclically within (i, j]
+			bool const stays = i <= j ? (i < h && h <= j) : (i < h || h <= j);
+
+			if (!stays)
+			{
+				slots[i] = std::move(slots[j]);
+				i = j;
+			}
+		}
+
+		slots[i] = Slot{};
+		used[i] = 0;
+		--count;
+
+		return true;
+	}
+
+	// Keeps the capacity
+	void clear()
+	{
+		for (size_t i = 0; i < slots.size(); ++i)
+		{
+			if (used[i])
+				slots[i] = Slot{};
+		}
+
+		std::fill(used.begin(), used.end(), 0);
+		count = 0;
+	}
+
+	[[nodiscard]]
+	size_t size() const
+	{
+		return count;
+	}
+
+	[[nodiscard]]
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	[[nodiscard]]
+	size_t capacity() const
+	{
+		return slots.size();
+	}
+
+	// f(Key const &, Value &) in table order, must not insert or erase
+	template <typename F>
+	void for_each(F &&f)
+	{
+		for (size_t i = 0; i < slots.size(); ++i)
+		{
+			if (used[i])
+				f(std::as_const(slots[i].key), slots[i].value);
+		}
+	}
+
+	template <typename F>
+	void for_each(F &&f) const
+	{
+		for (size_t i = 0; i < slots.size(); ++i)
+		{
+			if (used[i])
+				f(slots[i].key, slots[i].value);
+		}
+	}
+
+	// f(Key const &, Value &) for every stored cell in [min, max] inclusive, must not insert or erase
+	template <typename F>
+	void for_each_in_box(Key const &min, Key const &max, F &&f)
+	{
+		if (count == 0)
+			return;
+
+		for (size_t axis = 0; axis < DIM; ++axis)
+		{
+			if (min[axis] > max[axis])
+				return;
+		}
+
+		Key cell = min;
+
+		// Odometer over the box, x changes fastest
+		for (;;)
+		{
+			if (Value *value = find(cell))
+				f(std::as_const(cell), *value);
+
+			size_t axis = 0;
+
+			for (; axis < DIM; ++axis)
+			{
+				if (cell[axis] < max[axis])
+				{
+					++cell[axis];
+					break;
+				}
+
+				cell[axis] = min[axis];
+			}
+
+			if (axis == DIM)
+				return;
+		}
+	}
+
+	// Cells within radius along every axis, center included
+	template <typename F>
+	void for_each_neighbor(Key const &center, Coord radius, F &&f)
+	{
+		Key min = center, max = center;
+
+		for (size_t i = 0; i < DIM; ++i)
+		{
+			min[i] -= radius;
+			max[i] += radius;
+		}
+
+		for_each_in_box(min, max, f);
+	}
+};
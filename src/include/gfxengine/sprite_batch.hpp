@@ -0,0 +1,98 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+#include "gfxengine/material.hpp"
+#include "gfxengine/texture_atlas.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Frame;
+class Graphics;
+
+// Pixel positions with y down, the default material multiplies the texture with color
+struct SpriteVertex
+{
+	vec2 position;
+	vec2 uv;
+	Color color;
+
+	static ShaderValuesInfo attributes();
+};
+
+// Collects sprites of one atlas between begin() and end() and emits them as few draws as possible:
+//
+//	batch.begin(vec2(window_size));
+//	batch.draw(icon, vec2(10, 10), vec2(icon.size));
+//	frame.setting_blend(true);
+//	frame.setting_depth(false);
+//	batch.end(frame);
+//
+// Sprites are sorted by layer, then by atlas page, the order among sprites of the same layer and page is kept.
+// Overlapping sprites from different pages need different layers to draw in a known order.
+class SpriteBatch
+{
+private:
+
+	struct Sprite
+	{
+		// x0, y0, x1, y1
+		vec4 rect;
+
+		// In texels, scaled to the page size in end() so pages may grow in between
+		vec4 uv;
+		Color color;
+		uint32_t key;
+	};
+
+	Graphics &graphics;
+	TextureAtlas &atlas;
+	CreateMaterialParams material_params;
+	size_t tex_uniform;
+	size_t viewport_uniform;
+
+	// Per page
+	std::vector<std::shared_ptr<Material>> materials;
+
+	vec2 viewport_size{ 1.0f, 1.0f };
+	std::vector<Sprite> sprites;
+	std::vector<uint32_t> order;
+	std::vector<uint32_t> quad_indices;
+
+	std::shared_ptr<Material> const &get_material(uint32_t page);
+
+	static void write_quads(SpriteVertex *out, Sprite const *sprites, uint32_t const *order, size_t count, vec2 uv_scale);
+
+public:
+
+	// Uses a built in textured material
+	SpriteBatch(Graphics &graphics, TextureAtlas &atlas);
+
+	// params.attributes have to match SpriteVertex::attributes(), params.uniforms need the Texture "tex"
+	// and the Vec2 "viewport_size"
+	SpriteBatch(Graphics &graphics, TextureAtlas &atlas, CreateMaterialParams params);
+
+	// The built in material, a starting point for materials that only change the fragment shader
+	static CreateMaterialParams default_material_params();
+
+	void begin(vec2 viewport_size);
+
+	void draw(AtlasRegion const &region, vec2 position, vec2 size, Color color = Color::WHITE, uint16_t layer = 0)
+	{
+		sprites.push_back(Sprite{
+			.rect = vec4(position.x, position.y, position.x + size.x, position.y + size.y),
+			.uv = vec4(vec2(region.position), vec2(region.position + region.size)),
+			.color = color,
+			.key = (uint32_t)layer << 16 | region.page,
+		});
+	}
+
+	void end(Frame &frame);
+
+	[[nodiscard]]
+	size_t get_sprite_count() const
+	{
+		return sprites.size();
+	}
+};
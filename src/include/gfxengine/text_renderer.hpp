@@ -0,0 +1,95 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+#include "gfxengine/glyph_cache.hpp"
+#include "gfxengine/sprite_batch.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class Frame;
+class Graphics;
+
+struct ShapedGlyph
+{
+	uint16_t glyph;
+
+	// Pen position on the baseline in ems, y down from the top of the first line
+	vec2 position;
+};
+
+struct ShapedText
+{
+	std::vector<ShapedGlyph> glyphs;
+
+	// In ems, trailing spaces don't count
+	vec2 size{};
+};
+
+// Lays out UTF-8 text with kerning. Lines break at '\n' and, when max_width > 0, at the last space keeping the line
+// within max_width ems. Invalid UTF-8 becomes U+FFFD.
+ShapedText shape_text(Font const &font, std::string_view utf8, float max_width = 0.0f);
+
+// Draws text with the distance field glyphs of a GlyphCache, sharp at any size. Shaped runs are cached, text drawn
+// every frame is laid out once:
+//
+//	glyphs.update();
+//	text.begin(vec2(window_size));
+//	text.draw(font, "Score: 100", vec2(10, 10), 24.0f);
+//	frame.setting_blend(true);
+//	frame.setting_depth(false);
+//	text.end(frame);
+//
+// Glyphs still being generated are left out until they are ready.
+class TextRenderer
+{
+private:
+
+	struct Run
+	{
+		ShapedText text;
+		uint64_t last_used;
+	};
+
+	GlyphCache &glyphs;
+	SpriteBatch batch;
+
+	// Font, max width and text in one string
+	std::unordered_map<std::string, Run> runs;
+	std::string key;
+
+	uint64_t frame = 0;
+	size_t missing = 0;
+
+public:
+
+	TextRenderer(Graphics &graphics, GlyphCache &glyphs);
+
+	// Runs not drawn in the previous frame are dropped
+	void begin(vec2 viewport_size);
+
+	[[nodiscard]]
+	ShapedText const &shape(uint16_t font, std::string_view text, float max_width = 0.0f);
+
+	// position is the top left corner, size the em size and max_width the wrapping width in pixels. Returns the
+	// size of the text in pixels.
+	vec2 draw(uint16_t font, std::string_view text, vec2 position, float size, Color color = Color::WHITE, float max_width = 0.0f, uint16_t layer = 0);
+
+	void end(Frame &frame);
+
+	[[nodiscard]]
+	size_t get_run_count() const
+	{
+		return runs.size();
+	}
+
+	// Glyphs left out since begin() because they weren't ready
+	[[nodiscard]]
+	size_t get_missing_count() const
+	{
+		return missing;
+	}
+};
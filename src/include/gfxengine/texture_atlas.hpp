@@ -0,0 +1,189 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+#include "gfxengine/image.hpp"
+#include "gfxengine/material.hpp"
+#include "gfxengine/skyline_packer.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+struct AtlasRegion
+{
+	// Stays the same while the region exists, see TextureAtlas::get_region()
+	uint32_t id = 0;
+	uint32_t page = 0;
+
+	// In texels, without the padding around it
+	ivec2 position{};
+	ivec2 size{};
+};
+
+// Texels written to an atlas page since it was last drawn
+struct AtlasUpload
+{
+	uint64_t version = 0;
+
+	// Of the whole page when queued, the texture is reallocated when it differs
+	ivec2 page_size{};
+
+	ivec2 position{};
+	ivec2 size{};
+
+	// size.x * size.y RGBA texels, empty clears the page to transparent black
+	std::vector<uint8_t> rgba;
+};
+
+// Texture side of an atlas page, shared between the atlas on the game thread and the renderer. Writes are queued
+// here and the renderer applies those up to the version a frame was built with, a frame drawn on the render thread
+// doesn't see texels written for later frames. An upload covering the whole page replaces the queued ones, a frame
+// built before it may then miss the texels it replaced for one draw.
+class AtlasPageTexture
+{
+private:
+
+	mutable std::mutex mutex;
+	std::vector<AtlasUpload> queue;
+	size_t queued_bytes = 0;
+
+public:
+
+	void push(AtlasUpload upload);
+
+	// Moves the uploads up to version to the end of out, oldest first
+	void take(uint64_t version, std::vector<AtlasUpload> &out);
+
+	[[nodiscard]]
+	size_t get_queued_bytes() const;
+};
+
+// Packs many small RGBA images into a few large pages, so drawing them needs one texture per page.
+// The edge texels of every image are repeated into its padding, filtering never reaches a neighbour.
+//
+// Pages start at initial_page_size and double when full, up to max_page_size, before another page is added.
+// Only the texels written are uploaded, see get_texture().
+class TextureAtlas
+{
+private:
+
+	struct Page
+	{
+		std::shared_ptr<Image> image;
+		SkylinePacker packer;
+		std::shared_ptr<AtlasPageTexture> texture;
+		uint64_t version = 0;
+		size_t region_count = 0;
+
+		// Handed out by get_page(), copied before it is written again
+		bool shared = false;
+	};
+
+	struct Entry
+	{
+		AtlasRegion region;
+		bool used = false;
+	};
+
+	ivec2 max_page_size;
+	ivec2 initial_page_size;
+	int32_t padding;
+	size_t max_pages;
+	std::vector<Page> pages;
+
+	// By region id
+	std::vector<Entry> entries;
+	std::vector<uint32_t> free_ids;
+
+	uint64_t generation = 0;
+
+	Image &write_page(uint32_t page);
+
+	// Page and top left corner of the padded rectangle, grows or adds pages as needed. Only the packers change.
+	std::optional<std::pair<uint32_t, ivec2>> place(ivec2 padded);
+	bool grow(Page &page);
+
+	// Brings images and textures in line with the packers after place()
+	void sync_pages();
+
+	void blit(Image &dst, ivec2 position, uint8_t const *src, size_t src_pitch, ivec2 size) const;
+	void queue_upload(uint32_t page, ivec2 position, ivec2 size);
+	void queue_clear(uint32_t page);
+
+public:
+
+	explicit TextureAtlas(ivec2 max_page_size = { 2048, 2048 }, int32_t padding = 1, size_t max_pages = SIZE_MAX, ivec2 initial_page_size = { 256, 256 });
+
+	// nullopt when the image doesn't fit on an empty page, or when all max_pages pages are full
+	[[nodiscard]]
+	std::optional<AtlasRegion> add(Image const &image);
+
+	// size.x * size.y RGBA texels
+	[[nodiscard]]
+	std::optional<AtlasRegion> add(std::span<const uint8_t> rgba, ivec2 size);
+
+	// The space is reused once the page is empty or after defragment()
+	void remove(uint32_t id);
+
+	// Where the region is now, regions move in defragment()
+	[[nodiscard]]
+	AtlasRegion const &get_region(uint32_t id) const;
+
+	// x0, y0, x1, y1 in texture coordinates of the region's page, they change when the page grows
+	[[nodiscard]]
+	vec4 get_uv(AtlasRegion const &region) const;
+
+	// Repacks the remaining regions tallest first from pages of initial_page_size, freeing the space of removed ones
+	// and dropping pages left empty. Pages are uploaded whole afterwards. False, with nothing changed, when they
+	// didn't fit again.
+	bool defragment();
+
+	// Changes whenever regions move or become invalid, regions kept by the caller have to be looked up again
+	[[nodiscard]]
+	uint64_t get_generation() const
+	{
+		return generation;
+	}
+
+	[[nodiscard]]
+	size_t get_page_count() const
+	{
+		return pages.size();
+	}
+
+	[[nodiscard]]
+	ivec2 get_page_size(uint32_t page) const
+	{
+		return pages.at(page).packer.get_size();
+	}
+
+	[[nodiscard]]
+	ivec2 get_max_page_size() const
+	{
+		return max_page_size;
+	}
+
+	[[nodiscard]]
+	int32_t get_padding() const
+	{
+		return padding;
+	}
+
+	// Material value drawing the page as it is now. The renderer keeps one texture per page and uploads only what
+	// changed since the previous frame.
+	[[nodiscard]]
+	ShaderFieldTexture_t get_texture(uint32_t page) const;
+
+	// CPU copy of the page, never changed afterwards, images added later go to a copy
+	[[nodiscard]]
+	std::shared_ptr<Image> const &get_page(uint32_t page);
+
+	// Regions on the page become invalid, the page keeps its index and size and is filled again by later adds
+	void clear_page(uint32_t page);
+
+	void clear();
+};
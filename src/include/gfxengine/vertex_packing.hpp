@@ -0,0 +1,268 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <span>
+
+// Compact vertex attribute encodings. Declare the packed fields with the matching ShaderFieldType, e.g. a
+// normal as { "normal", ShaderFieldType::I16, true, 2 } from pack_normal_oct16() or a colour as
+// { "color", ShaderFieldType::U2_10_10_10, true, 1 } from pack_unorm_2_10_10_10().
+//
+// Floats are clamped and rounded to nearest even, NaN becomes the lowest value of the range.
+
+// IEEE 754 binary16, ShaderFieldType::F16
+struct Half
+{
+	uint16_t bits;
+
+	bool operator == (Half const &) const = default;
+};
+
+// x in the low 10 bits, then y, z and a 2 bit w, read by the shader as a vec4
+struct PackedI2_10_10_10
+{
+	uint32_t bits;
+
+	bool operator == (PackedI2_10_10_10 const &) const = default;
+};
+
+struct PackedU2_10_10_10
+{
+	uint32_t bits;
+
+	bool operator == (PackedU2_10_10_10 const &) const = default;
+};
+
+inline float clamp_snorm(float f)
+{
+	return f > -1.0f ? (f < 1.0f ? f : 1.0f) : -1.0f;
+}
+
+inline float clamp_unorm(float f)
+{
+	return f > 0.0f ? (f < 1.0f ? f : 1.0f) : 0.0f;
+}
+
+[[nodiscard]]
+inline int8_t pack_snorm8(float f)
+{
+	return (int8_t)std::lrint(clamp_snorm(f) * 127.0f);
+}
+
+[[nodiscard]]
+inline uint8_t pack_unorm8(float f)
+{
+	return (uint8_t)std::lrint(clamp_unorm(f) * 255.0f);
+}
+
+[[nodiscard]]
+inline int16_t pack_snorm16(float f)
+{
+	return (int16_t)std::lrint(clamp_snorm(f) * 32767.0f);
+}
+
+[[nodiscard]]
+inline uint16_t pack_unorm16(float f)
+{
+	return (uint16_t)std::lrint(clamp_unorm(f) * 65535.0f);
+}
+
+// Same conversion as the GPU does for normalized attributes
+[[nodiscard]]
+inline float unpack_snorm8(int8_t v)
+{
+	return std::max(v / 127.0f, -1.0f);
+}
+
+[[nodiscard]]
+inline float unpack_unorm8(uint8_t v)
+{
+	return v / 255.0f;
+}
+
+[[nodiscard]]
+inline float unpack_snorm16(int16_t v)
+{
+	return std::max(v / 32767.0f, -1.0f);
+}
+
+[[nodiscard]]
+inline float unpack_unorm16(uint16_t v)
+{
+	return v / 65535.0f;
+}
+
+// Overflows to infinity, small values become denormals
+[[nodiscard]]
+inline Half pack_half(float f)
+{
+	uint32_t x = std::bit_cast<uint32_t>(f);
+	uint32_t const sign = x & 0x80000000u;
+	uint16_t out;
+
+	x ^= sign;
+
+	if (x >= (127u + 16u) << 23)
+	{
+		// NaN stays a quiet NaN
+		out = x > 255u << 23 ? 0x7e00 : 0x7c00;
+	}
+	else if (x < 113u << 23)
+	{
+		// Lets the FPU round the denormal mantissa into the low bits
+		float const magic = std::bit_cast<float>(((127u - 15u) + (23u - 10u) + 1u) << 23);
+		out = (uint16_t)(std::bit_cast<uint32_t>(std::bit_cast<float>(x) + magic) - std::bit_cast<uint32_t>(magic));
+	}
+	else
+	{
+		uint32_t const mantissa_odd = (x >> 13) & 1;
+		x += ((15u - 127u) << 23) + 0xfff + mantissa_odd;
+		out = (uint16_t)(x >> 13);
+	}
+
+	return Half{ (uint16_t)(out | (sign >> 16)) };
+}
+
+[[nodiscard]]
+inline float unpack_half(Half h)
+{
+	uint32_t const shifted_exponent = 0x7c00u << 13;
+	uint32_t x = (uint32_t)(h.bits & 0x7fff) << 13;
+	uint32_t const exponent = x & shifted_exponent;
+
+	x += (127u - 15u) << 23;
+
+	if (exponent == shifted_exponent)
+	{
+		x += (128u - 16u) << 23;
+	}
+	else if (exponent == 0)
+	{
+		x += 1u << 23;
+		x = std::bit_cast<uint32_t>(std::bit_cast<float>(x) - std::bit_cast<float>(113u << 23));
+	}
+
+	return std::bit_cast<float>(x | (uint32_t)(h.bits & 0x8000) << 16);
+}
+
+// Unit vector to [-1, 1]^2 by projecting onto an octahedron and folding the lower half over, decode in the shader with
+//
+//	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+//	float t = max(-n.z, 0.0);
+//	n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+//	n = normalize(n);
+[[nodiscard]]
+inline vec2 encode_octahedral(vec3 n)
+{
+	float const l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+
+	if (l1 == 0.0f)
+		return { 0.0f, 0.0f };
+
+	vec2 p(n.x / l1, n.y / l1);
+
+	if (n.z < 0.0f)
+	{
+		p = vec2(
+			(1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	return p;
+}
+
+[[nodiscard]]
+inline vec3 decode_octahedral(vec2 e)
+{
+	vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	float const t = std::max(-n.z, 0.0f);
+
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+
+	return n.normalize();
+}
+
+// I16 x2 normalized, within 0.04 degrees
+[[nodiscard]]
+inline std::array<int16_t, 2> pack_normal_oct16(vec3 n)
+{
+	vec2 e = encode_octahedral(n);
+	return { pack_snorm16(e.x), pack_snorm16(e.y) };
+}
+
+// I8 x2 normalized, within 1 degree, enough for most lit surfaces
+[[nodiscard]]
+inline std::array<int8_t, 2> pack_normal_oct8(vec3 n)
+{
+	vec2 e = encode_octahedral(n);
+	return { pack_snorm8(e.x), pack_snorm8(e.y) };
+}
+
+[[nodiscard]]
+inline PackedI2_10_10_10 pack_snorm_2_10_10_10(vec4 v)
+{
+	uint32_t x = (uint32_t)std::lrint(clamp_snorm(v.x) * 511.0f) & 0x3ff;
+	uint32_t y = (uint32_t)std::lrint(clamp_snorm(v.y) * 511.0f) & 0x3ff;
+	uint32_t z = (uint32_t)std::lrint(clamp_snorm(v.z) * 511.0f) & 0x3ff;
+	uint32_t w = (uint32_t)std::lrint(clamp_snorm(v.w)) & 0x3;
+
+	return { x | y << 10 | z << 20 | w << 30 };
+}
+
+[[nodiscard]]
+inline PackedU2_10_10_10 pack_unorm_2_10_10_10(vec4 v)
+{
+	uint32_t x = (uint32_t)std::lrint(clamp_unorm(v.x) * 1023.0f);
+	uint32_t y = (uint32_t)std::lrint(clamp_unorm(v.y) * 1023.0f);
+	uint32_t z = (uint32_t)std::lrint(clamp_unorm(v.z) * 1023.0f);
+	uint32_t w = (uint32_t)std::lrint(clamp_unorm(v.w) * 3.0f);
+
+	return { x | y << 10 | z << 20 | w << 30 };
+}
+
+[[nodiscard]]
+inline vec4 unpack_snorm_2_10_10_10(PackedI2_10_10_10 p)
+{
+	// Shifting the field to the top sign extends it on the way back
+	int32_t const bits = (int32_t)p.bits;
+
+	return {
+		std::max((float)(bits << 22 >> 22) / 511.0f, -1.0f),
+		std::max((float)(bits << 12 >> 22) / 511.0f, -1.0f),
+		std::max((float)(bits << 2 >> 22) / 511.0f, -1.0f),
+		std::max((float)(bits >> 30), -1.0f),
+	};
+}
+
+[[nodiscard]]
+inline vec4 unpack_unorm_2_10_10_10(PackedU2_10_10_10 p)
+{
+	return {
+		(float)(p.bits & 0x3ff) / 1023.0f,
+		(float)(p.bits >> 10 & 0x3ff) / 1023.0f,
+		(float)(p.bits >> 20 & 0x3ff) / 1023.0f,
+		(float)(p.bits >> 30) / 3.0f,
+	};
+}
+
+// Whole span encoders, four values per SSE2 instruction where available and otherwise the same as the
+// functions above. in and out must be the same size.
+
+void pack_half(std::span<const float> in, std::span<Half> out);
+
+void pack_snorm8(std::span<const float> in, std::span<int8_t> out);
+void pack_unorm8(std::span<const float> in, std::span<uint8_t> out);
+void pack_snorm16(std::span<const float> in, std::span<int16_t> out);
+void pack_unorm16(std::span<const float> in, std::span<uint16_t> out);
+
+void pack_normals_oct16(std::span<const vec3> in, std::span<std::array<int16_t, 2>> out);
+void pack_normals_oct8(std::span<const vec3> in, std::span<std::array<int8_t, 2>> out);
+
+void pack_snorm_2_10_10_10(std::span<const vec4> in, std::span<PackedI2_10_10_10> out);
+void pack_unorm_2_10_10_10(std::span<const vec4> in, std::span<PackedU2_10_10_10> out);
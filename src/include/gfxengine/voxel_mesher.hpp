@@ -0,0 +1,213 @@
+#pragma once
+
+#include "gfxengine/math.hpp"
+#include "gfxengine/frame.hpp"
+#include "gfxengine/spatial_hash.hpp"
+#include "gfxengine/vertex_packing.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Graphics;
+class WorkerPool;
+
+// Block 0 is air, every other block is an opaque cube
+struct VoxelChunk
+{
+	static constexpr int32_t SIZE = 32;
+
+	// x changes fastest, then y, then z
+	std::array<uint16_t, SIZE * SIZE * SIZE> blocks{};
+
+	static constexpr size_t index(ivec3 local)
+	{
+		return (size_t)local.x + (size_t)local.y * SIZE + (size_t)local.z * SIZE * SIZE;
+	}
+
+	[[nodiscard]]
+	uint16_t get(ivec3 local) const
+	{
+		return blocks[index(local)];
+	}
+
+	void set(ivec3 local, uint16_t block)
+	{
+		blocks[index(local)] = block;
+	}
+
+	// block_at(ivec3 world_voxel) -> uint16_t for every voxel of chunk, e.g. from a density:
+	//
+	//	chunk->fill(coord, [&](ivec3 p) { return noise.noise(p.x * 0.05, p.y * 0.05, p.z * 0.05) > p.y * 0.02 ? STONE : 0; });
+	template <typename F>
+	void fill(ivec3 chunk, F &&block_at)
+	{
+		ivec3 const base = chunk * SIZE;
+		size_t i = 0;
+
+		for (int32_t z = 0; z < SIZE; ++z)
+		{
+			for (int32_t y = 0; y < SIZE; ++y)
+			{
+				for (int32_t x = 0; x < SIZE; ++x)
+					blocks[i++] = (uint16_t)block_at(base + ivec3(x, y, z));
+			}
+		}
+	}
+};
+
+// Output of VoxelMesher, the material's attributes have to match attributes(). 24 bytes, the shader reads
+// normal and ao as normalized floats.
+struct VoxelVertex
+{
+	vec3 position;
+
+	// w is 0
+	std::array<int8_t, 4> normal;
+
+	// In blocks across a merged face, repeat the texture
+	std::array<Half, 2> uv;
+
+	uint16_t block;
+
+	// 1 = unoccluded, 0 = corner fully enclosed
+	uint16_t ao;
+
+	static ShaderValuesInfo attributes();
+};
+
+// Greedy mesher of one chunk, faces are culled against the neighbouring chunks and carry per-vertex ambient occlusion.
+// Keeps scratch memory between calls, use one per thread.
+class VoxelMesher
+{
+public:
+
+	static constexpr int32_t PADDED = VoxelChunk::SIZE + 2;
+
+	// neighbours[(x + 1) + (y + 1) * 3 + (z + 1) * 9] for offsets -1..1, [13] is the chunk itself. Missing chunks are air.
+	using Neighbourhood = std::array<VoxelChunk const *, 27>;
+
+private:
+
+	// Chunk with a one voxel border from its neighbours
+	std::vector<uint16_t> padded;
+	std::vector<uint32_t> mask;
+	std::vector<VoxelVertex> vertices;
+
+	void gather(Neighbourhood const &chunks);
+
+	[[nodiscard]]
+	bool solid(ivec3 p) const
+	{
+		return padded[(size_t)(p.x + 1) + (size_t)(p.y + 1) * PADDED + (size_t)(p.z + 1) * PADDED * PADDED] != 0;
+	}
+
+public:
+
+	VoxelMesher();
+
+	void mesh(ivec3 chunk, Neighbourhood const &chunks, FrameCacheVertices &out);
+};
+
+struct VoxelWorldStats
+{
+	size_t chunks;
+	size_t meshed;
+	size_t pending;
+	size_t in_flight;
+};
+
+// Chunks meshed on a worker pool, only chunks whose voxels or neighbours changed are meshed again:
+//
+//	world.set_chunk(coord, std::move(chunk));
+//	world.update(graphics, terrain_material);
+//	world.draw(frame);
+class VoxelWorld
+{
+private:
+
+	struct Entry
+	{
+		std::shared_ptr<VoxelChunk> data;
+		std::shared_ptr<GraphicsCacheVertices> cache;
+
+		// New for every entry, a chunk removed and loaded again doesn't take the jobs of the old one
+		uint64_t generation = 0;
+
+		// Set from last_version whenever the chunk or a neighbour changes
+		uint64_t version = 0;
+		uint64_t meshed_version = 0;
+
+		bool in_flight = false;
+		bool in_dirty_list = false;
+	};
+
+	struct Result
+	{
+		ivec3 chunk;
+		uint64_t generation;
+		uint64_t version;
+		FrameCacheVertices mesh;
+	};
+
+	// Shared with the jobs, so the world may go away while some still run
+	struct Results
+	{
+		std::mutex mutex;
+		std::vector<Result> done;
+	};
+
+	WorkerPool &pool;
+	SpatialHash<ivec3, Entry> chunks;
+	std::vector<ivec3> dirty;
+	std::shared_ptr<Results> results = std::make_shared<Results>();
+	size_t in_flight = 0;
+
+	// Unique across entries, a result is applied only to the version it was meshed from
+	uint64_t last_version = 0;
+	uint64_t last_generation = 0;
+
+	void mark_dirty(ivec3 chunk);
+	void mark_neighbours_dirty(ivec3 chunk, ivec3 local_min, ivec3 local_max);
+
+public:
+
+	explicit VoxelWorld(WorkerPool &pool);
+
+	// The world owns the chunk from now on, edit it through set_block()
+	void set_chunk(ivec3 chunk, std::unique_ptr<VoxelChunk> data);
+	void remove_chunk(ivec3 chunk);
+
+	[[nodiscard]]
+	VoxelChunk const *get_chunk(ivec3 chunk) const;
+
+	// Copies the chunk first while a job still reads it
+	void set_block(ivec3 voxel, uint16_t block);
+
+	// 0 outside of loaded chunks
+	[[nodiscard]]
+	uint16_t get_block(ivec3 voxel) const;
+
+	// Uploads meshes finished since the last call and starts up to max_jobs new ones, call on the game thread
+	void update(Graphics &graphics, std::shared_ptr<Material> const &material, size_t max_jobs = 64);
+
+	void draw(Frame &frame);
+
+	[[nodiscard]]
+	VoxelWorldStats get_stats() const;
+
+	[[nodiscard]]
+	static ivec3 chunk_of(ivec3 voxel)
+	{
+		return { floor_div(voxel.x), floor_div(voxel.y), floor_div(voxel.z) };
+	}
+
+private:
+
+	static constexpr int32_t floor_div(int32_t v)
+	{
+		return v >= 0 ? v / VoxelChunk::SIZE : (v - VoxelChunk::SIZE + 1) / VoxelChunk::SIZE;
+	}
+};
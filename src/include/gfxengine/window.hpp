@@ -1,5 +1,9 @@
 #pragma once
 
+#include "gfxengine/graphics.hpp"
+
+#include <cstdint>
+
 class Frame;
 class Platform;
 class Graphics;
@@ -9,6 +13,14 @@ struct CreateWindowParams
 {
 	Platform &platform;
 	WindowEventHandler *window_event_handler = nullptr;
+
+	// Draw on a separate thread that owns the graphics context, `draw`/`present` return as soon as the frame is queued
+	bool render_thread = false;
+
+	// Frames queued or being drawn before `draw`/`present` blocks (1..3)
+	uint32_t max_frames_in_flight = 2;
+
+	CreateGraphicsParams graphics;
 };
 
 class Window
@@ -19,10 +31,37 @@ public:
 
 	virtual void poll_events() = 0;
 	virtual void draw(Frame const &frame) = 0;
+
+	// Like draw, but may take the frame contents instead of copying them. `frame` is left reset and ready to be filled again.
+	virtual void present(Frame &frame);
+
 	virtual Graphics &get_graphics() const = 0;
 
 	virtual void lock_mouse(bool lock) = 0;
 	virtual void fullscreen(bool enable) = 0;
 	virtual void close() = 0;
 	virtual void set_vsync(bool enable) = 0;
+
+	// Operations issued between begin_batch() and end_batch() may be delivered together
+	virtual void begin_batch() {}
+	virtual void end_batch() {}
+};
+
+struct WindowBatch
+{
+	Window &window;
+
+	WindowBatch(Window &_window)
+		: window{ _window }
+	{
+		window.begin_batch();
+	}
+
+	~WindowBatch()
+	{
+		window.end_batch();
+	}
+
+	WindowBatch(WindowBatch const &) = delete;
+	WindowBatch &operator = (WindowBatch const &) = delete;
 };
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running jobs in submission order. Jobs still queued when the pool is destroyed are dropped.
+class WorkerPool
+{
+private:
+
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::deque<std::function<void()>> jobs;
+	size_t running = 0;
+	bool stopping = false;
+
+	void thread_main();
+
+public:
+
+	// 0 = one thread per core, leaving one for the game thread
+	explicit WorkerPool(size_t thread_count = 0);
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator = (WorkerPool const &) = delete;
+
+	void submit(std::function<void()> job);
+
+	// Blocks until the queue is empty and no job is running
+	void wait_idle();
+
+	// Calls body(begin, end) for ranges of at least grain indices covering [0, count) on the pool and the calling
+	// thread, returns once all are done. Unlike wait_idle() it doesn't wait for unrelated jobs and may be called from
+	// a job, the caller works through the ranges itself when every thread is busy.
+	void parallel_for(size_t count, size_t grain, std::function<void(size_t begin, size_t end)> const &body);
+
+	[[nodiscard]]
+	size_t get_thread_count() const
+	{
+		return threads.size();
+	}
+};
@@ -1,11 +1,34 @@
 #include "gfxengine/logger.hpp"
 
-void Logger::handle(Level level, char const *c_str, size_t len)
+#include <algorithm>
+
+static char const *level_str(Logger::Level level)
+{
+	if (level == Logger::Level::Verbose) return "[V] ";
+	if (level == Logger::Level::Warning) return "[W] ";
+	if (level == Logger::Level::Error) return "[E] ";
+	return "[I] ";
+}
+
+static char const *category_str(LogCategory category)
 {
-	char const *level_str = "[I] ";
-	if (level == Level::Warning) level_str = "[W] ";
-	if (level == Level::Error) level_str = "[E] ";
+	static char const *table[LogCategory_count]{
+		"",
+		"[Platform] ",
+		"[Window] ",
+		"[Input] ",
+		"[Graphics] ",
+		"[App] ",
+	};
+
+	if (size_t(category) >= LogCategory_count)
+		return "";
+
+	return table[size_t(category)];
+}
 
+void Logger::handle(LogCategory category, Level level, char const *c_str, size_t len)
+{
 	uint64_t t = platform.get_system_time_ms();
 
 	uint64_t ms = t % 1000;
@@ -13,8 +36,375 @@ void Logger::handle(Level level, char const *c_str, size_t len)
 	uint64_t m = (t / 1000 / 60) % 60;
 	uint64_t h = (t / 1000 / 60 / 60) % 24;
 
-	auto buf = BufferedCStr<>::format("[{:02}:{:02}:{:02}.{:03}] {}{}\n", h, m, s, ms, level_str, std::string_view(c_str, len));
+	auto buf = BufferedCStr<>::format("[{:02}:{:02}:{:02}.{:03}] {}{}{}\n", h, m, s, ms, level_str(level), category_str(category), std::string_view(c_str, len));
 
 	for (auto &h : handlers)
 		h.handler(buf.c_str(), buf.len());
 }
+
+bool Logger::rate_limited(LogCategory category, Level level, char const *fmt)
+{
+	RateLimit const &limit = rate_limits[size_t(category)];
+	double now = platform.get_time();
+
+	auto [it, inserted] = rate_states.try_emplace(fmt, RateState{ limit.burst, now, 0, category, level });
+	RateState &state = it->second;
+
+	state.tokens = std::min((double)limit.burst, state.tokens + (now - state.last_time) * limit.per_second);
+	state.last_time = now;
+
+	if (state.tokens < 1.0)
+	{
+		++state.suppressed;
+		return true;
+	}
+
+	state.tokens -= 1.0;
+
+	if (state.suppressed != 0)
+	{
+		uint32_t suppressed = state.suppressed;
+		state.suppressed = 0;
+		emit(category, level, "suppressed {} messages: \"{}\"", suppressed, fmt);
+	}
+
+	return false;
+}
+
+void Logger::report_suppressed()
+{
+	std::lock_guard lock(mutex);
+
+	for (auto &[fmt, state] : rate_states)
+	{
+		if (state.suppressed == 0)
+			continue;
+
+		uint32_t suppressed = state.suppressed;
+		state.suppressed = 0;
+		emit(state.category, state.level, "suppressed {} messages: \"{}\"", suppressed, fmt);
+	}
+}
+
+void Logger::emit_format(std::string_view fmt, std::span<const LogArgType> tags, uint64_t time_ms)
+{
+	known_formats.insert(fmt.data());
+
+	size_t size = sizeof(LogRecordHeader) + sizeof(uint32_t) + fmt.size() + tags.size();
+	record.resize(size);
+
+	LogRecordHeader header{};
+	header.size = (uint32_t)size;
+	header.type = LogRecordType::Format;
+	header.level = 0;
+	header.category = 0;
+	header.arg_count = (uint8_t)tags.size();
+	header.time_ms = time_ms;
+	header.fmt_id = (uint64_t)(uintptr_t)fmt.data();
+
+	uint8_t *out = record.data();
+	memcpy(out, &header, sizeof(header));
+	out += sizeof(header);
+
+	uint32_t fmt_size = (uint32_t)fmt.size();
+	memcpy(out, &fmt_size, sizeof(fmt_size));
+	out += sizeof(fmt_size);
+
+	memcpy(out, fmt.data(), fmt.size());
+	out += fmt.size();
+
+	memcpy(out, tags.data(), tags.size());
+
+	for (auto &h : binary_handlers)
+		h.handler(record);
+}
+
+size_t BinaryLogDecoder::feed(std::span<const uint8_t> data, OutputFunc const &output)
+{
+	size_t offset = 0;
+
+	while (data.size() - offset >= sizeof(LogRecordHeader))
+	{
+		LogRecordHeader header;
+		memcpy(&header, data.data() + offset, sizeof(header));
+
+		if (header.size < sizeof(header))
+			throw 1;
+
+		if (data.size() - offset < header.size)
+			break;
+
+		auto body = data.subspan(offset + sizeof(header), header.size - sizeof(header));
+		offset += header.size;
+
+		if (header.type == LogRecordType::Format)
+		{
+			uint32_t fmt_size;
+
+			if (body.size() < sizeof(fmt_size))
+				throw 1;
+
+			memcpy(&fmt_size, body.data(), sizeof(fmt_size));
+
+			if (sizeof(fmt_size) + fmt_size + header.arg_count > body.size())
+				throw 1;
+
+			FormatInfo &info = formats[header.fmt_id];
+			info.fmt.assign((char const *)body.data() + sizeof(fmt_size), fmt_size);
+			info.tags.resize(header.arg_count);
+			memcpy(info.tags.data(), body.data() + sizeof(fmt_size) + fmt_size, header.arg_count);
+		}
+		else
+		if (header.type == LogRecordType::Message)
+		{
+			auto it = formats.find(header.fmt_id);
+
+			if (it == formats.end() || it->second.tags.size() != header.arg_count)
+				throw 1;
+
+			decode_message(it->second, body);
+
+			uint64_t t = header.time_ms;
+
+			uint64_t ms = t % 1000;
+			uint64_t s = (t / 1000) % 60;
+			uint64_t m = (t / 1000 / 60) % 60;
+			uint64_t h = (t / 1000 / 60 / 60) % 24;
+
+			line.clear();
+			std::format_to(std::back_inserter(line), "[{:02}:{:02}:{:02}.{:03}] {}{}{}\n", h, m, s, ms, level_str(Logger::Level(header.level)), category_str(LogCategory(header.category)), message);
+
+			output(line.c_str(), line.size());
+		}
+		else
+		{
+			throw 1;
+		}
+	}
+
+	return offset;
+}
+
+template <typename T>
+static T read_arg(std::span<const uint8_t> args, size_t &offset)
+{
+	if (args.size() - offset < sizeof(T))
+		throw 1;
+
+	T v;
+	memcpy(&v, args.data() + offset, sizeof(T));
+	offset += sizeof(T);
+	return v;
+}
+
+static void format_one(std::string &out, std::string_view spec, auto const &v)
+{
+	if (spec.empty())
+	{
+		std::format_to(std::back_inserter(out), "{}", v);
+		return;
+	}
+
+	std::string fmt;
+	fmt.reserve(spec.size() + 3);
+	fmt += "{:";
+	fmt += spec;
+	fmt += "}";
+	std::vformat_to(std::back_inserter(out), fmt, std::make_format_args(v));
+}
+
+void BinaryLogDecoder::decode_message(FormatInfo const &info, std::span<const uint8_t> args)
+{
+	// Locate each argument first, replacement fields can refer to them by index
+	size_t arg_offsets[64];
+
+	if (info.tags.size() > std::size(arg_offsets))
+		throw 1;
+
+	for (size_t i = 0, offset = 0; i < info.tags.size(); ++i)
+	{
+		arg_offsets[i] = offset;
+
+		switch (info.tags[i])
+		{
+			case LogArgType::Bool: case LogArgType::Char: case LogArgType::I8: case LogArgType::U8: offset += 1; break;
+			case LogArgType::I16: case LogArgType::U16: offset += 2; break;
+			case LogArgType::I32: case LogArgType::U32: case LogArgType::F32: offset += 4; break;
+			case LogArgType::I64: case LogArgType::U64: case LogArgType::F64: case LogArgType::Ptr: offset += 8; break;
+			case LogArgType::Str:
+			{
+				uint32_t len = read_arg<uint32_t>(args, offset);
+				offset += len;
+				break;
+			}
+			default: throw 1;
+		}
+
+		if (offset > args.size())
+			throw 1;
+	}
+
+	message.clear();
+
+	std::string_view fmt = info.fmt;
+	size_t next_arg = 0;
+
+	auto parse_index = [&](std::string_view id) {
+		if (id.empty())
+			return next_arg++;
+
+		size_t index = 0;
+
+		for (char d : id)
+		{
+			if (d < '0' || d > '9')
+				throw 1;
+
+			index = index * 10 + size_t(d - '0');
+		}
+
+		return index;
+	};
+
+	// Dynamic width or precision, like std::format only integers are allowed
+	auto read_integer = [&](size_t index) -> int64_t {
+		if (index >= info.tags.size())
+			throw 1;
+
+		size_t offset = arg_offsets[index];
+		int64_t v;
+
+		switch (info.tags[index])
+		{
+			case LogArgType::I8:  v = read_arg<int8_t>(args, offset); break;
+			case LogArgType::U8:  v = read_arg<uint8_t>(args, offset); break;
+			case LogArgType::I16: v = read_arg<int16_t>(args, offset); break;
+			case LogArgType::U16: v = read_arg<uint16_t>(args, offset); break;
+			case LogArgType::I32: v = read_arg<int32_t>(args, offset); break;
+			case LogArgType::U32: v = read_arg<uint32_t>(args, offset); break;
+			case LogArgType::I64: v = read_arg<int64_t>(args, offset); break;
+			case LogArgType::U64: v = (int64_t)std::min<uint64_t>(read_arg<uint64_t>(args, offset), INT64_MAX); break;
+			default: throw 1;
+		}
+
+		if (v < 0)
+			throw 1;
+
+		return v;
+	};
+
+	std::string resolved_spec;
+
+	for (size_t i = 0; i < fmt.size(); ++i)
+	{
+		char c = fmt[i];
+
+		if (c == '}')
+		{
+			// "}}" escape
+			if (i + 1 < fmt.size() && fmt[i + 1] == '}')
+				++i;
+
+			message += '}';
+			continue;
+		}
+
+		if (c != '{')
+		{
+			message += c;
+			continue;
+		}
+
+		if (i + 1 < fmt.size() && fmt[i + 1] == '{')
+		{
+			message += '{';
+			++i;
+			continue;
+		}
+
+		// The spec may hold replacement fields of its own, as in "{:{}}" or "{:.{}f}"
+		size_t end = i + 1;
+
+		for (int depth = 1; end < fmt.size(); ++end)
+		{
+			if (fmt[end] == '{')
+				++depth;
+			else
+			if (fmt[end] == '}' && --depth == 0)
+				break;
+		}
+
+		if (end == fmt.size())
+			throw 1;
+
+		std::string_view field = fmt.substr(i + 1, end - i - 1);
+		i = end;
+
+		std::string_view spec;
+
+		if (size_t colon = field.find(':'); colon != std::string_view::npos)
+		{
+			spec = field.substr(colon + 1);
+			field = field.substr(0, colon);
+		}
+
+		// The field takes its argument before the nested ones
+		size_t arg_index = parse_index(field);
+
+		if (spec.find('{') != std::string_view::npos)
+		{
+			resolved_spec.clear();
+
+			for (size_t k = 0; k < spec.size(); ++k)
+			{
+				if (spec[k] != '{')
+				{
+					resolved_spec += spec[k];
+					continue;
+				}
+
+				size_t close = spec.find('}', k);
+
+				if (close == std::string_view::npos)
+					throw 1;
+
+				std::format_to(std::back_inserter(resolved_spec), "{}", read_integer(parse_index(spec.substr(k + 1, close - k - 1))));
+				k = close;
+			}
+
+			spec = resolved_spec;
+		}
+
+		if (arg_index >= info.tags.size())
+			throw 1;
+
+		size_t offset = arg_offsets[arg_index];
+
+		switch (info.tags[arg_index])
+		{
+			case LogArgType::Bool: format_one(message, spec, read_arg<bool>(args, offset)); break;
+			case LogArgType::Char: format_one(message, spec, read_arg<char>(args, offset)); break;
+			case LogArgType::I8:   format_one(message, spec, (int)read_arg<int8_t>(args, offset)); break;
+			case LogArgType::U8:   format_one(message, spec, (unsigned)read_arg<uint8_t>(args, offset)); break;
+			case LogArgType::I16:  format_one(message, spec, read_arg<int16_t>(args, offset)); break;
+			case LogArgType::U16:  format_one(message, spec, read_arg<uint16_t>(args, offset)); break;
+			case LogArgType::I32:  format_one(message, spec, read_arg<int32_t>(args, offset)); break;
+			case LogArgType::U32:  format_one(message, spec, read_arg<uint32_t>(args, offset)); break;
+			case LogArgType::I64:  format_one(message, spec, read_arg<int64_t>(args, offset)); break;
+			case LogArgType::U64:  format_one(message, spec, read_arg<uint64_t>(args, offset)); break;
+			case LogArgType::F32:  format_one(message, spec, read_arg<float>(args, offset)); break;
+			case LogArgType::F64:  format_one(message, spec, read_arg<double>(args, offset)); break;
+			case LogArgType::Ptr:  format_one(message, spec, (void const *)(uintptr_t)read_arg<uint64_t>(args, offset)); break;
+			case LogArgType::Str:
+			{
+				uint32_t len = read_arg<uint32_t>(args, offset);
+
+				if (args.size() - offset < len)
+					throw 1;
+
+				format_one(message, spec, std::string_view((char const *)args.data() + offset, len));
+				break;
+			}
+		}
+	}
+}
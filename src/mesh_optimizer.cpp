@@ -0,0 +1,252 @@
+#include "gfxengine/mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+// Tuned for the cache sizes of current GPUs, see https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+static constexpr size_t CACHE_SIZE = 32;
+static constexpr float CACHE_DECAY_POWER = 1.5f;
+static constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+static constexpr float VALENCE_BOOST_SCALE = 2.0f;
+static constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+static constexpr uint32_t NONE = UINT32_MAX;
+
+namespace
+{
+
+struct ScoreTables
+{
+	std::array<float, CACHE_SIZE> cache;
+	std::array<float, 64> valence;
+
+	ScoreTables()
+	{
+		for (size_t i = 0; i < CACHE_SIZE; ++i)
+		{
+			// The last triangle's vertices score lower on purpose, otherwise strips form and the cache goes unused
+			cache[i] = i < 3 ? LAST_TRIANGLE_SCORE : std::pow(1.0f - (float)(i - 3) / (float)(CACHE_SIZE - 3), CACHE_DECAY_POWER);
+		}
+
+		valence[0] = 0.0f;
+
+		for (size_t i = 1; i < valence.size(); ++i)
+			valence[i] = VALENCE_BOOST_SCALE * std::pow((float)i, -VALENCE_BOOST_POWER);
+	}
+
+	float score(uint32_t cache_position, uint32_t remaining) const
+	{
+		if (remaining == 0)
+			return -1.0f;
+
+		float s = cache_position < CACHE_SIZE ? cache[cache_position] : 0.0f;
+		s += remaining < valence.size() ? valence[remaining] : VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER);
+
+		return s;
+	}
+};
+
+} // namespace
+
+void optimize_vertex_cache(std::span<uint32_t> indices, size_t vertex_count)
+{
+	static const ScoreTables tables;
+
+	size_t const triangle_count = indices.size() / 3;
+
+	if (triangle_count < 2)
+		return;
+
+	for (uint32_t i : indices)
+	{
+		if (i >= vertex_count)
+			throw 1;
+	}
+
+	// Triangles using each vertex, emitted ones are swapped past `remaining`
+	std::vector<uint32_t> remaining(vertex_count, 0);
+	std::vector<uint32_t> first_adjacent(vertex_count + 1, 0);
+	std::vector<uint32_t> adjacent(triangle_count * 3);
+
+	for (size_t i = 0; i < triangle_count * 3; ++i)
+		++remaining[indices[i]];
+
+	for (size_t v = 0; v < vertex_count; ++v)
+		first_adjacent[v + 1] = first_adjacent[v] + remaining[v];
+
+	{
+		std::vector<uint32_t> fill(first_adjacent.begin(), first_adjacent.end() - 1);
+
+		for (size_t i = 0; i < triangle_count * 3; ++i)
+			adjacent[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<float> vertex_score(vertex_count);
+
+	for (size_t v = 0; v < vertex_count; ++v)
+		vertex_score[v] = tables.score(NONE, remaining[v]);
+
+	std::vector<float> triangle_score(triangle_count);
+	std::vector<uint8_t> emitted(triangle_count, 0);
+
+	uint32_t best = 0;
+
+	for (size_t t = 0; t < triangle_count; ++t)
+	{
+		triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+
+		if (triangle_score[t] > triangle_score[best])
+			best = (uint32_t)t;
+	}
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	// Three extra slots for the vertices pushed out by the newest triangle, their scores drop to uncached
+	std::array<uint32_t, CACHE_SIZE + 3> cache;
+	std::array<uint32_t, CACHE_SIZE + 3> new_cache;
+	size_t cache_count = 0;
+
+	size_t scan = 0;
+
+	for (size_t out = 0; out < triangle_count; ++out)
+	{
+		if (best == NONE)
+		{
+			// Nothing adjacent to the cache is left, continue in input order which is usually coherent too
+			while (emitted[scan])
+				++scan;
+
+			best = (uint32_t)scan;
+		}
+
+		uint32_t const tri[3]{ indices[best * 3], indices[best * 3 + 1], indices[best * 3 + 2] };
+
+		result.insert(result.end(), tri, tri + 3);
+		emitted[best] = 1;
+
+		for (uint32_t v : tri)
+		{
+			uint32_t *begin = adjacent.data() + first_adjacent[v];
+			uint32_t *end = begin + remaining[v];
+			uint32_t *it = std::find(begin, end, best);
+
+			std::swap(*it, *(end - 1));
+			--remaining[v];
+		}
+
+		size_t new_count = 0;
+
+		// Degenerate triangles repeat a vertex, it still takes one slot
+		for (uint32_t v : tri)
+		{
+			if (std::find(new_cache.begin(), new_cache.begin() + new_count, v) == new_cache.begin() + new_count)
+				new_cache[new_count++] = v;
+		}
+
+		for (size_t i = 0; i < cache_count; ++i)
+		{
+			uint32_t v = cache[i];
+
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				new_cache[new_count++] = v;
+		}
+
+		best = NONE;
+		float best_score = -1.0f;
+
+		for (size_t i = 0; i < new_count; ++i)
+		{
+			uint32_t v = new_cache[i];
+			uint32_t position = i < CACHE_SIZE ? (uint32_t)i : NONE;
+			float score = tables.score(position, remaining[v]);
+			float delta = score - vertex_score[v];
+
+			vertex_score[v] = score;
+
+			for (uint32_t a = 0; a < remaining[v]; ++a)
+			{
+				uint32_t t = adjacent[first_adjacent[v] + a];
+				triangle_score[t] += delta;
+			}
+		}
+
+		// Every triangle whose score changed is adjacent to the cache
+		for (size_t i = 0; i < std::min(new_count, CACHE_SIZE); ++i)
+		{
+			uint32_t v = new_cache[i];
+
+			for (uint32_t a = 0; a < remaining[v]; ++a)
+			{
+				uint32_t t = adjacent[first_adjacent[v] + a];
+
+				if (triangle_score[t] > best_score)
+				{
+					best_score = triangle_score[t];
+					best = t;
+				}
+			}
+		}
+
+		std::copy_n(new_cache.begin(), std::min(new_count, CACHE_SIZE), cache.begin());
+		cache_count = std::min(new_count, CACHE_SIZE);
+	}
+
+	std::copy(result.begin(), result.end(), indices.begin());
+}
+
+size_t optimize_vertex_fetch(std::vector<uint8_t> &vertices, size_t stride, std::span<uint32_t> indices)
+{
+	if (stride == 0)
+		throw 1;
+
+	size_t const vertex_count = vertices.size() / stride;
+	std::vector<uint32_t> remap(vertex_count, NONE);
+	uint32_t next = 0;
+
+	for (uint32_t &i : indices)
+	{
+		if (i >= vertex_count)
+			throw 1;
+
+		if (remap[i] == NONE)
+			remap[i] = next++;
+
+		i = remap[i];
+	}
+
+	std::vector<uint8_t> reordered((size_t)next * stride);
+
+	for (size_t v = 0; v < vertex_count; ++v)
+	{
+		if (remap[v] != NONE)
+			memcpy(reordered.data() + (size_t)remap[v] * stride, vertices.data() + v * stride, stride);
+	}
+
+	vertices = std::move(reordered);
+	return next;
+}
+
+float compute_vertex_cache_acmr(std::span<const uint32_t> indices, size_t vertex_count, size_t cache_size)
+{
+	if (indices.size() < 3)
+		return 0.0f;
+
+	// A vertex is cached while fewer than cache_size misses happened since its own
+	std::vector<size_t> loaded_at(vertex_count, 0);
+	size_t time = cache_size + 1;
+	size_t misses = 0;
+
+	for (uint32_t i : indices)
+	{
+		if (time - loaded_at[i] > cache_size)
+		{
+			loaded_at[i] = time++;
+			++misses;
+		}
+	}
+
+	return (float)misses / (float)(indices.size() / 3);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <functional>
+
+// Second context sharing objects with the one graphics is created on, for GL work on another thread
+struct GLWorkerContext
+{
+	// Binds the context to the calling thread, false when it failed
+	std::function<bool()> make_current;
+
+	// Unbinds it again, before the thread exits
+	std::function<void()> release;
+};
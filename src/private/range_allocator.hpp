@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <optional>
+
+// Best-fit allocator over [0, capacity), adjacent free ranges are merged when released
+class RangeAllocator
+{
+private:
+
+	// offset -> size
+	std::map<size_t, size_t> free_ranges;
+	size_t capacity = 0;
+	size_t free_total = 0;
+
+public:
+
+	explicit RangeAllocator(size_t _capacity = 0)
+	{
+		reset(_capacity, 0);
+	}
+
+	[[nodiscard]]
+	std::optional<size_t> allocate(size_t size)
+	{
+		if (size == 0)
+			return 0;
+
+		auto best = free_ranges.end();
+
+		for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it)
+		{
+			if (it->second >= size && (best == free_ranges.end() || it->second < best->second))
+			{
+				best = it;
+
+				if (it->second == size)
+					break;
+			}
+		}
+
+		if (best == free_ranges.end())
+			return std::nullopt;
+
+		size_t offset = best->first;
+		size_t remaining = best->second - size;
+
+		free_ranges.erase(best);
+
+		if (remaining != 0)
+			free_ranges.emplace(offset + size, remaining);
+
+		free_total -= size;
+		return offset;
+	}
+
+	void release(size_t offset, size_t size)
+	{
+		if (size == 0)
+			return;
+
+		free_total += size;
+
+		auto next = free_ranges.lower_bound(offset);
+
+		if (next != free_ranges.end() && offset + size == next->first)
+		{
+			size += next->second;
+			next = free_ranges.erase(next);
+		}
+
+		if (next != free_ranges.begin())
+		{
+			auto prev = std::prev(next);
+
+			if (prev->first + prev->second == offset)
+			{
+				prev->second += size;
+				return;
+			}
+		}
+
+		free_ranges.emplace(offset, size);
+	}
+
+	// Everything below used is taken, the rest is one free range
+	void reset(size_t _capacity, size_t used)
+	{
+		capacity = _capacity;
+		free_total = capacity - used;
+		free_ranges.clear();
+
+		if (free_total != 0)
+			free_ranges.emplace(used, free_total);
+	}
+
+	[[nodiscard]]
+	size_t get_capacity() const
+	{
+		return capacity;
+	}
+
+	[[nodiscard]]
+	size_t get_free() const
+	{
+		return free_total;
+	}
+
+	[[nodiscard]]
+	size_t get_free_range_count() const
+	{
+		return free_ranges.size();
+	}
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded single-producer/single-consumer ring, N must be a power of two
+template <typename T, size_t N> requires((N & (N - 1)) == 0)
+class SpscQueue
+{
+private:
+
+	static constexpr size_t MASK = N - 1;
+	static constexpr size_t CACHE_LINE = 64;
+
+	// Written by consumer
+	alignas(CACHE_LINE) std::atomic<size_t> head{ 0 };
+	size_t tail_cache = 0;
+
+	// Written by producer
+	alignas(CACHE_LINE) std::atomic<size_t> tail{ 0 };
+	size_t head_cache = 0;
+
+	alignas(CACHE_LINE) T slots[N]{};
+
+public:
+
+	SpscQueue() = default;
+
+	SpscQueue(SpscQueue const &) = delete;
+	SpscQueue &operator = (SpscQueue const &) = delete;
+	SpscQueue(SpscQueue &&) = delete;
+	SpscQueue &operator = (SpscQueue &&) = delete;
+
+	static constexpr size_t capacity() { return N; }
+
+	// Producer
+	[[nodiscard]]
+	bool push(T const &value)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+
+		if (t - head_cache == N)
+		{
+			head_cache = head.load(std::memory_order_acquire);
+
+			if (t - head_cache == N)
+				return false;
+		}
+
+		slots[t & MASK] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer
+	[[nodiscard]]
+	bool pop(T &out)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+
+		if (h == tail_cache)
+		{
+			tail_cache = tail.load(std::memory_order_acquire);
+
+			if (h == tail_cache)
+				return false;
+		}
+
+		out = std::move(slots[h & MASK]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer, releases all slots at once
+	template <typename TFunc>
+	size_t consume_all(TFunc const &func)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t t = tail.load(std::memory_order_acquire);
+		tail_cache = t;
+
+		for (size_t i = h; i != t; ++i)
+			func(slots[i & MASK]);
+
+		head.store(t, std::memory_order_release);
+		return t - h;
+	}
+
+	// Approximate when called concurrently
+	[[nodiscard]]
+	bool empty() const
+	{
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+};
@@ -0,0 +1,133 @@
+#include "gfxengine/skyline_packer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+SkylinePacker::SkylinePacker(ivec2 _size)
+	: size{ _size }
+{
+	if (size.x <= 0 || size.y <= 0)
+		throw 1;
+
+	clear();
+}
+
+void SkylinePacker::clear()
+{
+	skyline.assign(1, Segment{ 0, 0, size.x });
+	used_area = 0;
+}
+
+void SkylinePacker::grow(ivec2 new_size)
+{
+	if (new_size.x < size.x || new_size.y < size.y)
+		throw 1;
+
+	// The new columns are empty down to the top
+	if (new_size.x > size.x)
+	{
+		if (skyline.back().y == 0)
+			skyline.back().width += new_size.x - size.x;
+		else
+			skyline.push_back(Segment{ size.x, 0, new_size.x - size.x });
+	}
+
+	size = new_size;
+}
+
+std::optional<int32_t> SkylinePacker::fit(size_t index, int32_t width, int32_t height) const
+{
+	if (skyline[index].x + width > size.x)
+		return std::nullopt;
+
+	int32_t y = 0;
+	int32_t remaining = width;
+
+	for (size_t i = index; remaining > 0; ++i)
+	{
+		y = std::max(y, skyline[i].y);
+
+		if (y + height > size.y)
+			return std::nullopt;
+
+		remaining -= skyline[i].width;
+	}
+
+	return y;
+}
+
+std::optional<ivec2> SkylinePacker::pack(ivec2 rect)
+{
+	if (rect.x <= 0 || rect.y <= 0)
+		return std::nullopt;
+
+	size_t best = SIZE_MAX;
+	int32_t best_top = INT32_MAX;
+	int32_t best_width = INT32_MAX;
+	int32_t best_y = 0;
+
+	for (size_t i = 0; i < skyline.size(); ++i)
+	{
+		auto y = fit(i, rect.x, rect.y);
+
+		if (!y)
+			continue;
+
+		// Lowest top first, then the narrowest segment so wide gaps stay open for wide rectangles
+		int32_t top = *y + rect.y;
+
+		if (top < best_top || (top == best_top && skyline[i].width < best_width))
+		{
+			best = i;
+			best_top = top;
+			best_width = skyline[i].width;
+			best_y = *y;
+		}
+	}
+
+	if (best == SIZE_MAX)
+		return std::nullopt;
+
+	ivec2 const position(skyline[best].x, best_y);
+
+	skyline.insert(skyline.begin() + (ptrdiff_t)best, Segment{ position.x, best_top, rect.x });
+
+	// Segments now below the new one shrink or go away
+	size_t i = best + 1;
+
+	while (i < skyline.size())
+	{
+		Segment const &prev = skyline[i - 1];
+		Segment &s = skyline[i];
+
+		int32_t overlap = prev.x + prev.width - s.x;
+
+		if (overlap <= 0)
+			break;
+
+		if (overlap < s.width)
+		{
+			s.x += overlap;
+			s.width -= overlap;
+			break;
+		}
+
+		skyline.erase(skyline.begin() + (ptrdiff_t)i);
+	}
+
+	for (size_t j = 0; j + 1 < skyline.size();)
+	{
+		if (skyline[j].y == skyline[j + 1].y)
+		{
+			skyline[j].width += skyline[j + 1].width;
+			skyline.erase(skyline.begin() + (ptrdiff_t)j + 1);
+		}
+		else
+		{
+			++j;
+		}
+	}
+
+	used_area += (int64_t)rect.x * rect.y;
+	return position;
+}
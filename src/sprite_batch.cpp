@@ -0,0 +1,261 @@
+#include "gfxengine/sprite_batch.hpp"
+
+#include "gfxengine/frame.hpp"
+#include "gfxengine/graphics.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define GFXENGINE_SPRITE_SSE 1
+#else
+#define GFXENGINE_SPRITE_SSE 0
+#endif
+
+// Keeps every range drawable with 16-bit indices
+static constexpr size_t MAX_SPRITES_PER_RANGE = 0xFFFF / 4;
+
+static_assert(sizeof(SpriteVertex) == 20, "Update SpriteVertex::attributes");
+
+ShaderValuesInfo SpriteVertex::attributes()
+{
+	ShaderValuesInfo info;
+	info.add({ "position", ShaderFieldType::F32, false, 2 });
+	info.add({ "uv", ShaderFieldType::F32, false, 2 });
+	info.add({ "color", ShaderFieldType::U8, true, 4 });
+	return info;
+}
+
+CreateMaterialParams SpriteBatch::default_material_params()
+{
+	CreateMaterialParams params;
+
+	params.attributes = SpriteVertex::attributes();
+	params.uniforms.add({ "tex", ShaderFieldType::Texture, false, 1 });
+	params.uniforms.add({ "viewport_size", ShaderFieldType::Vec2, false, 1 });
+
+	params.vertex_shader = R"tag(
+#version 460 core
+
+in vec2 position;
+in vec2 uv;
+in vec4 color;
+
+uniform vec2 viewport_size;
+
+out vec2 v_uv;
+out vec4 v_color;
+
+void main()
+{
+gl_Position = vec4(position / viewport_size * vec2(2.0, -2.0) + vec2(-1.0, 1.0), 0.0, 1.0);
+v_uv = uv;
+v_color = color;
+}
+)tag";
+
+	// Blending is premultiplied, see Frame::setting_blend
+	params.fragment_shader = R"tag(
+#version 460 core
+
+in vec2 v_uv;
+in vec4 v_color;
+
+uniform sampler2D tex;
+
+out vec4 o_frag_color;
+
+void main()
+{
+vec4 c = texture(tex, v_uv) * v_color;
+o_frag_color = vec4(c.rgb * c.a, c.a);
+}
+)tag";
+
+	return params;
+}
+
+static size_t find_uniform(CreateMaterialParams const &params, char const *name, ShaderFieldType type)
+{
+	for (size_t i = 0; i < params.uniforms.fields.size(); ++i)
+	{
+		if (params.uniforms.fields[i].name == name && params.uniforms.fields[i].type == type)
+			return i;
+	}
+
+	throw 1;
+}
+
+// Corners in the order 0 = (x0, y0), 1 = (x1, y0), 2 = (x1, y1), 3 = (x0, y1)
+void SpriteBatch::write_quads(SpriteVertex *out, Sprite const *sprites, uint32_t const *order, size_t count, vec2 uv_scale)
+{
+#if GFXENGINE_SPRITE_SSE
+	__m128 const scale = _mm_setr_ps(uv_scale.x, uv_scale.y, uv_scale.x, uv_scale.y);
+#endif
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		Sprite const &s = sprites[order[i]];
+		float const *rect = &s.rect.x;
+		float const *uv = &s.uv.x;
+		Color const color = s.color;
+
+		SpriteVertex *v = out + i * 4;
+
+#if GFXENGINE_SPRITE_SSE
+		__m128 const r = _mm_loadu_ps(rect);
+		__m128 const t = _mm_mul_ps(_mm_loadu_ps(uv), scale);
+
+		// position and uv are adjacent in SpriteVertex, one store each
+		_mm_storeu_ps(&v[0].position.x, _mm_movelh_ps(r, t));
+		_mm_storeu_ps(&v[1].position.x, _mm_shuffle_ps(r, t, _MM_SHUFFLE(1, 2, 1, 2)));
+		_mm_storeu_ps(&v[2].position.x, _mm_movehl_ps(t, r));
+		_mm_storeu_ps(&v[3].position.x, _mm_shuffle_ps(r, t, _MM_SHUFFLE(3, 0, 3, 0)));
+#else
+		float const u0 = uv[0] * uv_scale.x;
+		float const v0 = uv[1] * uv_scale.y;
+		float const u1 = uv[2] * uv_scale.x;
+		float const v1 = uv[3] * uv_scale.y;
+
+		v[0].position = vec2(rect[0], rect[1]);
+		v[0].uv = vec2(u0, v0);
+		v[1].position = vec2(rect[2], rect[1]);
+		v[1].uv = vec2(u1, v0);
+		v[2].position = vec2(rect[2], rect[3]);
+		v[2].uv = vec2(u1, v1);
+		v[3].position = vec2(rect[0], rect[3]);
+		v[3].uv = vec2(u0, v1);
+#endif
+
+		v[0].color = color;
+		v[1].color = color;
+		v[2].color = color;
+		v[3].color = color;
+	}
+}
+
+SpriteBatch::SpriteBatch(Graphics &graphics, TextureAtlas &atlas)
+	: SpriteBatch(graphics, atlas, default_material_params())
+{
+}
+
+SpriteBatch::SpriteBatch(Graphics &_graphics, TextureAtlas &_atlas, CreateMaterialParams params)
+	: graphics{ _graphics }
+	, atlas{ _atlas }
+	, material_params{ std::move(params) }
+	, tex_uniform{ find_uniform(material_params, "tex", ShaderFieldType::Texture) }
+	, viewport_uniform{ find_uniform(material_params, "viewport_size", ShaderFieldType::Vec2) }
+{
+	if (material_params.attributes.total_byte_size != sizeof(SpriteVertex))
+		throw 1;
+
+	// Counter-clockwise once y is flipped to clip space
+	quad_indices.resize(MAX_SPRITES_PER_RANGE * 6);
+
+	for (uint32_t i = 0; i < MAX_SPRITES_PER_RANGE; ++i)
+	{
+		uint32_t const q[6]{ 0, 2, 1, 0, 3, 2 };
+
+		for (uint32_t j = 0; j < 6; ++j)
+			quad_indices[i * 6 + j] = i * 4 + q[j];
+	}
+}
+
+std::shared_ptr<Material> const &SpriteBatch::get_material(uint32_t page)
+{
+	if (materials.size() <= page)
+		materials.resize(page + 1);
+
+	if (!materials[page])
+		materials[page] = graphics.create_material(material_params);
+
+	return materials[page];
+}
+
+void SpriteBatch::begin(vec2 _viewport_size)
+{
+	viewport_size = _viewport_size;
+	sprites.clear();
+}
+
+void SpriteBatch::end(Frame &frame)
+{
+	if (sprites.empty())
+		return;
+
+	// Counting sort by key, there are only a few distinct keys
+	std::vector<uint32_t> keys;
+	std::vector<uint32_t> counts;
+	size_t last = 0;
+
+	for (auto const &s : sprites)
+	{
+		if (keys.empty() || keys[last] != s.key)
+		{
+			last = std::find(keys.begin(), keys.end(), s.key) - keys.begin();
+
+			if (last == keys.size())
+			{
+				keys.push_back(s.key);
+				counts.push_back(0);
+			}
+		}
+
+		++counts[last];
+	}
+
+	std::vector<uint32_t> slots(keys.size());
+
+	for (size_t i = 0; i < keys.size(); ++i)
+		slots[i] = (uint32_t)i;
+
+	std::sort(slots.begin(), slots.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+	std::vector<uint32_t> starts(keys.size());
+	uint32_t offset = 0;
+
+	for (uint32_t slot : slots)
+	{
+		starts[slot] = offset;
+		offset += counts[slot];
+	}
+
+	order.resize(sprites.size());
+	last = 0;
+
+	for (uint32_t i = 0; i < sprites.size(); ++i)
+	{
+		if (keys[last] != sprites[i].key)
+			last = std::find(keys.begin(), keys.end(), sprites[i].key) - keys.begin();
+
+		order[starts[last]++] = i;
+	}
+
+	size_t first = 0;
+
+	for (uint32_t slot : slots)
+	{
+		uint32_t const page = keys[slot] & 0xFFFF;
+		auto const &material = get_material(page);
+		ivec2 const page_size = atlas.get_page_size(page);
+		vec2 const uv_scale(1.0f / (float)page_size.x, 1.0f / (float)page_size.y);
+
+		material->set_uniform(tex_uniform, atlas.get_texture(page));
+		material->set_uniform(viewport_uniform, viewport_size);
+
+		for (size_t remaining = counts[slot]; remaining > 0;)
+		{
+			size_t n = std::min(remaining, MAX_SPRITES_PER_RANGE);
+			auto r = frame.reserve_vertices<SpriteVertex>(material, n * 4, n * 6);
+
+			write_quads(r.vertices.data(), sprites.data(), order.data() + first, n, uv_scale);
+			memcpy(r.indices.data(), quad_indices.data(), n * 6 * sizeof(uint32_t));
+
+			first += n;
+			remaining -= n;
+		}
+	}
+
+	sprites.clear();
+}
@@ -0,0 +1,214 @@
+#include "gfxengine/text_renderer.hpp"
+
+#include <algorithm>
+
+static constexpr char32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+static char32_t decode_utf8(std::string_view s, size_t &i)
+{
+	uint8_t const lead = (uint8_t)s[i++];
+
+	if (lead < 0x80)
+		return lead;
+
+	int extra;
+	char32_t c;
+
+	if ((lead & 0xE0) == 0xC0)
+	{
+		extra = 1;
+		c = lead & 0x1F;
+	}
+	else if ((lead & 0xF0) == 0xE0)
+	{
+		extra = 2;
+		c = lead & 0x0F;
+	}
+	else if ((lead & 0xF8) == 0xF0)
+	{
+		extra = 3;
+		c = lead & 0x07;
+	}
+	else
+	{
+		return REPLACEMENT_CHARACTER;
+	}
+
+	for (int k = 0; k < extra; ++k)
+	{
+		if (i == s.size() || ((uint8_t)s[i] & 0xC0) != 0x80)
+			return REPLACEMENT_CHARACTER;
+
+		c = c << 6 | ((uint8_t)s[i++] & 0x3F);
+	}
+
+	return c;
+}
+
+ShapedText shape_text(Font const &font, std::string_view utf8, float max_width)
+{
+	ShapedText out;
+
+	if (utf8.empty())
+		return out;
+
+	FontMetrics const &metrics = font.get_metrics();
+	float const em = 1.0f / metrics.units_per_em;
+	float const line_height = (metrics.ascent - metrics.descent + metrics.line_gap) * em;
+
+	vec2 pen(0.0f, metrics.ascent * em);
+	size_t line_count = 1;
+
+	// First glyph after the last space of the line, spaces themselves aren't kept
+	size_t break_at = SIZE_MAX;
+	uint16_t previous = 0;
+	bool has_previous = false;
+
+	out.glyphs.reserve(utf8.size());
+
+	for (size_t i = 0; i < utf8.size();)
+	{
+		char32_t const c = decode_utf8(utf8, i);
+
+		if (c == '\n')
+		{
+			pen = vec2(0.0f, pen.y + line_height);
+			++line_count;
+			break_at = SIZE_MAX;
+			has_previous = false;
+			continue;
+		}
+
+		if (c == '\r')
+			continue;
+
+		uint16_t const glyph = font.get_glyph(c);
+
+		if (has_previous)
+			pen.x += font.get_kerning(previous, glyph) * em;
+
+		float const advance = font.get_advance(glyph) * em;
+		previous = glyph;
+		has_previous = true;
+
+		if (c == ' ')
+		{
+			pen.x += advance;
+			break_at = out.glyphs.size();
+			continue;
+		}
+
+		if (max_width > 0.0f && pen.x + advance > max_width && break_at != SIZE_MAX)
+		{
+			// The word started after the space moves to a new line
+			float const shift = break_at < out.glyphs.size() ? out.glyphs[break_at].position.x : pen.x;
+
+			for (size_t g = break_at; g < out.glyphs.size(); ++g)
+				out.glyphs[g].position += vec2(-shift, line_height);
+
+			pen += vec2(-shift, line_height);
+			++line_count;
+			break_at = SIZE_MAX;
+		}
+
+		out.glyphs.push_back({ glyph, pen });
+		pen.x += advance;
+	}
+
+	for (ShapedGlyph const &g : out.glyphs)
+		out.size.x = std::max(out.size.x, g.position.x + font.get_advance(g.glyph) * em);
+
+	out.size.y = (float)line_count * line_height;
+	return out;
+}
+
+static CreateMaterialParams text_material_params()
+{
+	CreateMaterialParams params = SpriteBatch::default_material_params();
+
+	// The edge is one pixel wide at any scale
+	params.fragment_shader = R"tag(
+#version 460 core
+
+in vec2 v_uv;
+in vec4 v_color;
+
+uniform sampler2D tex;
+
+out vec4 o_frag_color;
+
+void main()
+{
+float d = texture(tex, v_uv).a - 0.5;
+float w = max(fwidth(d), 1e-4);
+float a = clamp(d / w + 0.5, 0.0, 1.0) * v_color.a;
+o_frag_color = vec4(v_color.rgb * a, a);
+}
+)tag";
+
+	return params;
+}
+
+TextRenderer::TextRenderer(Graphics &graphics, GlyphCache &_glyphs)
+	: glyphs{ _glyphs }
+	, batch{ graphics, _glyphs.get_atlas(), text_material_params() }
+{
+}
+
+void TextRenderer::begin(vec2 viewport_size)
+{
+	++frame;
+	missing = 0;
+
+	std::erase_if(runs, [&](auto const &run) {
+		return run.second.last_used + 1 < frame;
+	});
+
+	batch.begin(viewport_size);
+}
+
+ShapedText const &TextRenderer::shape(uint16_t font, std::string_view text, float max_width)
+{
+	key.clear();
+	key.append((char const *)&font, sizeof(font));
+	key.append((char const *)&max_width, sizeof(max_width));
+	key.append(text);
+
+	auto it = runs.find(key);
+
+	if (it == runs.end())
+		it = runs.emplace(key, Run{ shape_text(glyphs.get_font(font), text, max_width), frame }).first;
+
+	it->second.last_used = frame;
+	return it->second.text;
+}
+
+vec2 TextRenderer::draw(uint16_t font, std::string_view text, vec2 position, float size, Color color, float max_width, uint16_t layer)
+{
+	ShapedText const &shaped = shape(font, text, max_width > 0.0f ? max_width / size : 0.0f);
+	float const scale = size / glyphs.get_em_size();
+
+	for (ShapedGlyph const &g : shaped.glyphs)
+	{
+		CachedGlyph const *cached = glyphs.find(font, g.glyph);
+
+		if (!cached)
+		{
+			++missing;
+			continue;
+		}
+
+		if (cached->region.size.x == 0)
+			continue;
+
+		vec2 const size_px(cached->region.size.x * scale, cached->region.size.y * scale);
+		batch.draw(cached->region, position + g.position * size + cached->offset * scale, size_px, color, layer);
+	}
+
+	return shaped.size * size;
+}
+
+void TextRenderer::end(Frame &frame)
+{
+	batch.end(frame);
+}
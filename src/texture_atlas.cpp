@@ -0,0 +1,417 @@
+#include "gfxengine/texture_atlas.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static std::shared_ptr<Image> blank_page(ivec2 size)
+{
+	auto image = std::make_shared<Image>();
+	image->width = (size_t)size.x;
+	image->height = (size_t)size.y;
+	image->data.assign(image->width * image->height * 4, 0);
+	return image;
+}
+
+void AtlasPageTexture::push(AtlasUpload upload)
+{
+	std::lock_guard lock(mutex);
+
+	if (upload.position == ivec2(0, 0) && upload.size == upload.page_size)
+	{
+		queue.clear();
+		queued_bytes = 0;
+	}
+
+	queued_bytes += upload.rgba.size();
+	queue.push_back(std::move(upload));
+}
+
+void AtlasPageTexture::take(uint64_t version, std::vector<AtlasUpload> &out)
+{
+	std::lock_guard lock(mutex);
+
+	size_t n = 0;
+
+	for (; n < queue.size() && queue[n].version <= version; ++n)
+	{
+		queued_bytes -= queue[n].rgba.size();
+		out.push_back(std::move(queue[n]));
+	}
+
+	queue.erase(queue.begin(), queue.begin() + (ptrdiff_t)n);
+}
+
+size_t AtlasPageTexture::get_queued_bytes() const
+{
+	std::lock_guard lock(mutex);
+	return queued_bytes;
+}
+
+TextureAtlas::TextureAtlas(ivec2 _max_page_size, int32_t _padding, size_t _max_pages, ivec2 _initial_page_size)
+	: max_page_size{ _max_page_size }
+	, initial_page_size{ std::min(_initial_page_size.x, _max_page_size.x), std::min(_initial_page_size.y, _max_page_size.y) }
+	, padding{ _padding }
+	, max_pages{ _max_pages }
+{
+	if (initial_page_size.x <= 0 || initial_page_size.y <= 0 || padding < 0 || max_pages == 0)
+		throw 1;
+}
+
+Image &TextureAtlas::write_page(uint32_t page)
+{
+	Page &p = pages[page];
+
+	if (p.shared)
+	{
+		p.image = std::make_shared<Image>(*p.image);
+		p.shared = false;
+	}
+
+	return *p.image;
+}
+
+bool TextureAtlas::grow(Page &page)
+{
+	ivec2 size = page.packer.get_size();
+
+	if (size == max_page_size)
+		return false;
+
+	// Shorter side first, pages stay close to square
+	if ((size.x <= size.y && size.x < max_page_size.x) || size.y == max_page_size.y)
+		size.x = std::min(size.x * 2, max_page_size.x);
+	else
+		size.y = std::min(size.y * 2, max_page_size.y);
+
+	page.packer.grow(size);
+	return true;
+}
+
+std::optional<std::pair<uint32_t, ivec2>> TextureAtlas::place(ivec2 padded)
+{
+	if (padded.x > max_page_size.x || padded.y > max_page_size.y)
+		return std::nullopt;
+
+	for (uint32_t i = 0; i < pages.size(); ++i)
+	{
+		if (auto position = pages[i].packer.pack(padded))
+			return std::pair{ i, *position };
+	}
+
+	for (uint32_t i = 0; i < pages.size(); ++i)
+	{
+		while (grow(pages[i]))
+		{
+			if (auto position = pages[i].packer.pack(padded))
+				return std::pair{ i, *position };
+		}
+	}
+
+	if (pages.size() == max_pages)
+		return std::nullopt;
+
+	pages.push_back(Page{ .packer = SkylinePacker(initial_page_size) });
+	uint32_t const page = (uint32_t)(pages.size() - 1);
+
+	// Fits once the page reaches max_page_size at the latest
+	do
+	{
+		if (auto position = pages[page].packer.pack(padded))
+			return std::pair{ page, *position };
+	}
+	while (grow(pages[page]));
+
+	throw 1;
+}
+
+void TextureAtlas::sync_pages()
+{
+	for (uint32_t i = 0; i < pages.size(); ++i)
+	{
+		Page &p = pages[i];
+		ivec2 const size = p.packer.get_size();
+
+		if (!p.texture)
+			p.texture = std::make_shared<AtlasPageTexture>();
+
+		if (!p.image)
+		{
+			p.image = blank_page(size);
+			queue_clear(i);
+			continue;
+		}
+
+		if (p.image->width == (size_t)size.x && p.image->height == (size_t)size.y)
+			continue;
+
+		// Grown, the texture is reallocated and filled again
+		auto image = blank_page(size);
+
+		for (size_t y = 0; y < p.image->height; ++y)
+			memcpy(image->data.data() + y * image->width * 4, p.image->data.data() + y * p.image->width * 4, p.image->width * 4);
+
+		p.image = std::move(image);
+		p.shared = false;
+		queue_upload(i, ivec2(0, 0), size);
+	}
+}
+
+void TextureAtlas::blit(Image &dst, ivec2 position, uint8_t const *src, size_t src_pitch, ivec2 size) const
+{
+	ivec2 const padded(size.x + padding * 2, size.y + padding * 2);
+	size_t const dst_pitch = dst.width * 4;
+
+	// Every padded row copies the nearest source row, the padding columns repeat its first and last texel
+	for (int32_t y = 0; y < padded.y; ++y)
+	{
+		uint8_t const *row_src = src + (size_t)std::clamp(y - padding, 0, size.y - 1) * src_pitch;
+		uint8_t *row = dst.data.data() + (size_t)(position.y + y) * dst_pitch + (size_t)position.x * 4;
+
+		for (int32_t x = 0; x < padding; ++x)
+		{
+			memcpy(row + (size_t)x * 4, row_src, 4);
+			memcpy(row + (size_t)(padding + size.x + x) * 4, row_src + (size_t)(size.x - 1) * 4, 4);
+		}
+
+		memcpy(row + (size_t)padding * 4, row_src, (size_t)size.x * 4);
+	}
+}
+
+void TextureAtlas::queue_upload(uint32_t page, ivec2 position, ivec2 size)
+{
+	Page &p = pages[page];
+	ivec2 const page_size = p.packer.get_size();
+	size_t const page_bytes = (size_t)page_size.x * (size_t)page_size.y * 4;
+
+	// Nothing drew the page for a while, one upload of all of it replaces the queued ones
+	if ((size_t)size.x * (size_t)size.y * 4 + p.texture->get_queued_bytes() > page_bytes)
+	{
+		position = ivec2(0, 0);
+		size = page_size;
+	}
+
+	AtlasUpload upload{ .version = ++p.version, .page_size = page_size, .position = position, .size = size };
+	upload.rgba.resize((size_t)size.x * (size_t)size.y * 4);
+
+	Image const &src = *p.image;
+
+	for (int32_t y = 0; y < size.y; ++y)
+	{
+		uint8_t const *row = src.data.data() + ((size_t)(position.y + y) * src.width + (size_t)position.x) * 4;
+		memcpy(upload.rgba.data() + (size_t)y * (size_t)size.x * 4, row, (size_t)size.x * 4);
+	}
+
+	p.texture->push(std::move(upload));
+}
+
+void TextureAtlas::queue_clear(uint32_t page)
+{
+	Page &p = pages[page];
+	ivec2 const page_size = p.packer.get_size();
+
+	p.texture->push(AtlasUpload{ .version = ++p.version, .page_size = page_size, .position = ivec2(0, 0), .size = page_size });
+}
+
+std::optional<AtlasRegion> TextureAtlas::add(Image const &image)
+{
+	if (image.format != Image::Format::RGBA)
+		throw 1;
+
+	return add(image.data, ivec2((int32_t)image.width, (int32_t)image.height));
+}
+
+std::optional<AtlasRegion> TextureAtlas::add(std::span<const uint8_t> rgba, ivec2 size)
+{
+	if (size.x <= 0 || size.y <= 0 || rgba.size() < (size_t)size.x * (size_t)size.y * 4)
+		throw 1;
+
+	ivec2 const padded(size.x + padding * 2, size.y + padding * 2);
+	auto placed = place(padded);
+
+	// Pages may have grown even when nothing fit
+	sync_pages();
+
+	if (!placed)
+		return std::nullopt;
+
+	auto const [page, position] = *placed;
+
+	blit(write_page(page), position, rgba.data(), (size_t)size.x * 4, size);
+	queue_upload(page, position, padded);
+
+	uint32_t id;
+
+	if (free_ids.empty())
+	{
+		id = (uint32_t)entries.size();
+		entries.emplace_back();
+	}
+	else
+	{
+		id = free_ids.back();
+		free_ids.pop_back();
+	}
+
+	AtlasRegion const region{ .id = id, .page = page, .position = position + padding, .size = size };
+	entries[id] = Entry{ region, true };
+	++pages[page].region_count;
+
+	return region;
+}
+
+void TextureAtlas::remove(uint32_t id)
+{
+	Entry &e = entries.at(id);
+
+	if (!e.used)
+		throw 1;
+
+	e.used = false;
+	free_ids.push_back(id);
+
+	// A skyline can't give back space in the middle, only an empty page is reused right away
+	Page &p = pages[e.region.page];
+
+	if (--p.region_count == 0)
+		p.packer.clear();
+}
+
+AtlasRegion const &TextureAtlas::get_region(uint32_t id) const
+{
+	Entry const &e = entries.at(id);
+
+	if (!e.used)
+		throw 1;
+
+	return e.region;
+}
+
+vec4 TextureAtlas::get_uv(AtlasRegion const &region) const
+{
+	vec2 const page_size(get_page_size(region.page));
+
+	return vec4(
+		(float)region.position.x / page_size.x,
+		(float)region.position.y / page_size.y,
+		(float)(region.position.x + region.size.x) / page_size.x,
+		(float)(region.position.y + region.size.y) / page_size.y);
+}
+
+bool TextureAtlas::defragment()
+{
+	std::vector<uint32_t> ids;
+
+	for (uint32_t id = 0; id < entries.size(); ++id)
+	{
+		if (entries[id].used)
+			ids.push_back(id);
+	}
+
+	std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) {
+		ivec2 const sa = entries[a].region.size;
+		ivec2 const sb = entries[b].region.size;
+		return sa.y != sb.y ? sa.y > sb.y : sa.x > sb.x;
+	});
+
+	std::vector<Page> old = std::move(pages);
+	pages.clear();
+
+	std::vector<std::pair<uint32_t, ivec2>> placed;
+	placed.reserve(ids.size());
+
+	for (uint32_t id : ids)
+	{
+		ivec2 const size = entries[id].region.size;
+		auto p = place(ivec2(size.x + padding * 2, size.y + padding * 2));
+
+		if (!p)
+		{
+			pages = std::move(old);
+			return false;
+		}
+
+		placed.push_back(*p);
+	}
+
+	// Pages keep their textures, materials drawing them stay valid
+	for (uint32_t i = 0; i < pages.size(); ++i)
+	{
+		Page &p = pages[i];
+
+		if (i < old.size())
+		{
+			p.texture = old[i].texture;
+			p.version = old[i].version;
+		}
+		else
+		{
+			p.texture = std::make_shared<AtlasPageTexture>();
+		}
+
+		p.image = blank_page(p.packer.get_size());
+	}
+
+	for (size_t k = 0; k < ids.size(); ++k)
+	{
+		AtlasRegion &region = entries[ids[k]].region;
+		auto const [page, position] = placed[k];
+
+		Image const &src = *old[region.page].image;
+		uint8_t const *texels = src.data.data() + ((size_t)region.position.y * src.width + (size_t)region.position.x) * 4;
+		blit(*pages[page].image, position, texels, src.width * 4, region.size);
+
+		region.page = page;
+		region.position = position + padding;
+		++pages[page].region_count;
+	}
+
+	for (uint32_t i = 0; i < pages.size(); ++i)
+		queue_upload(i, ivec2(0, 0), pages[i].packer.get_size());
+
+	++generation;
+	return true;
+}
+
+ShaderFieldTexture_t TextureAtlas::get_texture(uint32_t page) const
+{
+	Page const &p = pages.at(page);
+	return ShaderFieldTexture_t{ .atlas_page = p.texture, .atlas_version = p.version };
+}
+
+std::shared_ptr<Image> const &TextureAtlas::get_page(uint32_t page)
+{
+	Page &p = pages.at(page);
+	p.shared = true;
+	return p.image;
+}
+
+void TextureAtlas::clear_page(uint32_t page)
+{
+	Page &p = pages.at(page);
+	p.packer.clear();
+	p.region_count = 0;
+
+	// A fresh image rather than a cleared one, get_page() may have handed out the old one
+	p.image = blank_page(p.packer.get_size());
+	p.shared = false;
+
+	for (uint32_t id = 0; id < entries.size(); ++id)
+	{
+		if (entries[id].used && entries[id].region.page == page)
+		{
+			entries[id].used = false;
+			free_ids.push_back(id);
+		}
+	}
+
+	queue_clear(page);
+	++generation;
+}
+
+void TextureAtlas::clear()
+{
+	pages.clear();
+	entries.clear();
+	free_ids.clear();
+	++generation;
+}
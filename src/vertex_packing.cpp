@@ -0,0 +1,318 @@
+#include "gfxengine/vertex_packing.hpp"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define GFXENGINE_PACKING_SSE 1
+#else
+#define GFXENGINE_PACKING_SSE 0
+#endif
+
+static_assert(sizeof(vec3) == 3 * sizeof(float) && sizeof(vec4) == 4 * sizeof(float), "Span encoders read vectors as packed floats");
+
+template <typename TIn, typename TOut>
+static void check_sizes(std::span<TIn> in, std::span<TOut> out)
+{
+	if (in.size() != out.size())
+		throw 1;
+}
+
+#if GFXENGINE_PACKING_SSE
+
+// Same results as the scalar clamps, max comes first so NaN lanes end up at the lowest value
+static __m128 clamp_snorm_x4(__m128 f)
+{
+	return _mm_min_ps(_mm_max_ps(f, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+}
+
+static __m128 clamp_unorm_x4(__m128 f)
+{
+	return _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+static __m128i select_x4(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// All branches of pack_half(float) computed for every lane, then selected. Halves in the low 16 bits of each lane.
+static __m128i pack_half_x4(__m128 f)
+{
+	__m128i x = _mm_castps_si128(f);
+	__m128i const sign = _mm_and_si128(x, _mm_set1_epi32((int)0x80000000u));
+
+	x = _mm_xor_si128(x, sign);
+
+	__m128i const is_nan = _mm_cmpgt_epi32(x, _mm_set1_epi32(255 << 23));
+	__m128i const inf_nan = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(is_nan, _mm_set1_epi32(0x200)));
+
+	__m128 const magic = _mm_castsi128_ps(_mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23));
+	__m128i const denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(x), magic)), _mm_castps_si128(magic));
+
+	__m128i const mantissa_odd = _mm_and_si128(_mm_srli_epi32(x, 13), _mm_set1_epi32(1));
+	__m128i normal = _mm_add_epi32(x, _mm_set1_epi32((int)(((15u - 127u) << 23) + 0xfff)));
+	normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissa_odd), 13);
+
+	__m128i const is_large = _mm_cmpgt_epi32(x, _mm_set1_epi32(((127 + 16) << 23) - 1));
+	__m128i const is_denormal = _mm_cmpgt_epi32(_mm_set1_epi32(113 << 23), x);
+
+	__m128i out = select_x4(is_denormal, denormal, normal);
+	out = select_x4(is_large, inf_nan, out);
+
+	return _mm_or_si128(out, _mm_srli_epi32(sign, 16));
+}
+
+// Eight 16-bit lanes from two registers of values in 0..0xffff, packs_epi32 saturates signed so sign extend first
+static __m128i narrow_u16_x8(__m128i a, __m128i b)
+{
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+
+	return _mm_packs_epi32(a, b);
+}
+
+static void encode_octahedral_x4(vec3 const *n, __m128i &ex, __m128i &ey, float scale)
+{
+	__m128 const x = _mm_setr_ps(n[0].x, n[1].x, n[2].x, n[3].x);
+	__m128 const y = _mm_setr_ps(n[0].y, n[1].y, n[2].y, n[3].y);
+	__m128 const z = _mm_setr_ps(n[0].z, n[1].z, n[2].z, n[3].z);
+
+	__m128 const zero = _mm_setzero_ps();
+	__m128 const one = _mm_set1_ps(1.0f);
+	__m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	__m128 const l1 = _mm_add_ps(_mm_add_ps(_mm_and_ps(x, abs_mask), _mm_and_ps(y, abs_mask)), _mm_and_ps(z, abs_mask));
+	__m128 px = _mm_div_ps(x, l1);
+	__m128 py = _mm_div_ps(y, l1);
+
+	// +-1 the way the scalar version picks it, -0 counts as positive
+	__m128 const sx = _mm_sub_ps(_mm_and_ps(_mm_cmpge_ps(px, zero), _mm_set1_ps(2.0f)), one);
+	__m128 const sy = _mm_sub_ps(_mm_and_ps(_mm_cmpge_ps(py, zero), _mm_set1_ps(2.0f)), one);
+
+	__m128 const fx = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(py, abs_mask)), sx);
+	__m128 const fy = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(px, abs_mask)), sy);
+
+	__m128 const lower = _mm_cmplt_ps(z, zero);
+	px = _mm_or_ps(_mm_and_ps(lower, fx), _mm_andnot_ps(lower, px));
+	py = _mm_or_ps(_mm_and_ps(lower, fy), _mm_andnot_ps(lower, py));
+
+	__m128 const degenerate = _mm_cmpeq_ps(l1, zero);
+	px = _mm_andnot_ps(degenerate, px);
+	py = _mm_andnot_ps(degenerate, py);
+
+	ex = _mm_cvtps_epi32(_mm_mul_ps(clamp_snorm_x4(px), _mm_set1_ps(scale)));
+	ey = _mm_cvtps_epi32(_mm_mul_ps(clamp_snorm_x4(py), _mm_set1_ps(scale)));
+}
+
+// x, y, z and w of four vectors as the lanes of four registers
+static void load_transposed_x4(vec4 const *v, __m128 &x, __m128 &y, __m128 &z, __m128 &w)
+{
+	x = _mm_loadu_ps(&v[0].x);
+	y = _mm_loadu_ps(&v[1].x);
+	z = _mm_loadu_ps(&v[2].x);
+	w = _mm_loadu_ps(&v[3].x);
+
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+}
+
+#endif
+
+void pack_half(std::span<const float> in, std::span<Half> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	for (; i + 8 <= in.size(); i += 8)
+	{
+		__m128i a = pack_half_x4(_mm_loadu_ps(in.data() + i));
+		__m128i b = pack_half_x4(_mm_loadu_ps(in.data() + i + 4));
+		_mm_storeu_si128((__m128i *)(out.data() + i), narrow_u16_x8(a, b));
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_half(in[i]);
+}
+
+void pack_snorm8(std::span<const float> in, std::span<int8_t> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	__m128 const scale = _mm_set1_ps(127.0f);
+
+	for (; i + 16 <= in.size(); i += 16)
+	{
+		__m128i q[4];
+
+		for (size_t j = 0; j < 4; ++j)
+			q[j] = _mm_cvtps_epi32(_mm_mul_ps(clamp_snorm_x4(_mm_loadu_ps(in.data() + i + j * 4)), scale));
+
+		__m128i packed = _mm_packs_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+		_mm_storeu_si128((__m128i *)(out.data() + i), packed);
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_snorm8(in[i]);
+}
+
+void pack_unorm8(std::span<const float> in, std::span<uint8_t> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	__m128 const scale = _mm_set1_ps(255.0f);
+
+	for (; i + 16 <= in.size(); i += 16)
+	{
+		__m128i q[4];
+
+		for (size_t j = 0; j < 4; ++j)
+			q[j] = _mm_cvtps_epi32(_mm_mul_ps(clamp_unorm_x4(_mm_loadu_ps(in.data() + i + j * 4)), scale));
+
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+		_mm_storeu_si128((__m128i *)(out.data() + i), packed);
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_unorm8(in[i]);
+}
+
+void pack_snorm16(std::span<const float> in, std::span<int16_t> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	__m128 const scale = _mm_set1_ps(32767.0f);
+
+	for (; i + 8 <= in.size(); i += 8)
+	{
+		__m128i a = _mm_cvtps_epi32(_mm_mul_ps(clamp_snorm_x4(_mm_loadu_ps(in.data() + i)), scale));
+		__m128i b = _mm_cvtps_epi32(_mm_mul_ps(clamp_snorm_x4(_mm_loadu_ps(in.data() + i + 4)), scale));
+		_mm_storeu_si128((__m128i *)(out.data() + i), _mm_packs_epi32(a, b));
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_snorm16(in[i]);
+}
+
+void pack_unorm16(std::span<const float> in, std::span<uint16_t> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	__m128 const scale = _mm_set1_ps(65535.0f);
+
+	for (; i + 8 <= in.size(); i += 8)
+	{
+		__m128i a = _mm_cvtps_epi32(_mm_mul_ps(clamp_unorm_x4(_mm_loadu_ps(in.data() + i)), scale));
+		__m128i b = _mm_cvtps_epi32(_mm_mul_ps(clamp_unorm_x4(_mm_loadu_ps(in.data() + i + 4)), scale));
+		_mm_storeu_si128((__m128i *)(out.data() + i), narrow_u16_x8(a, b));
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_unorm16(in[i]);
+}
+
+void pack_normals_oct16(std::span<const vec3> in, std::span<std::array<int16_t, 2>> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	for (; i + 4 <= in.size(); i += 4)
+	{
+		__m128i ex, ey;
+		encode_octahedral_x4(in.data() + i, ex, ey, 32767.0f);
+
+		__m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(ex, ey), _mm_unpackhi_epi32(ex, ey));
+		_mm_storeu_si128((__m128i *)out[i].data(), packed);
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_normal_oct16(in[i]);
+}
+
+void pack_normals_oct8(std::span<const vec3> in, std::span<std::array<int8_t, 2>> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	for (; i + 4 <= in.size(); i += 4)
+	{
+		__m128i ex, ey;
+		encode_octahedral_x4(in.data() + i, ex, ey, 127.0f);
+
+		__m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(ex, ey), _mm_unpackhi_epi32(ex, ey));
+		_mm_storel_epi64((__m128i *)out[i].data(), _mm_packs_epi16(packed, packed));
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_normal_oct8(in[i]);
+}
+
+void pack_snorm_2_10_10_10(std::span<const vec4> in, std::span<PackedI2_10_10_10> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	__m128 const scale = _mm_set1_ps(511.0f);
+	__m128i const mask = _mm_set1_epi32(0x3ff);
+
+	for (; i + 4 <= in.size(); i += 4)
+	{
+		__m128 x, y, z, w;
+		load_transposed_x4(in.data() + i, x, y, z, w);
+
+		__m128i qx = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(clamp_snorm_x4(x), scale)), mask);
+		__m128i qy = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(clamp_snorm_x4(y), scale)), mask);
+		__m128i qz = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(clamp_snorm_x4(z), scale)), mask);
+		__m128i qw = _mm_cvtps_epi32(clamp_snorm_x4(w));
+
+		__m128i packed = _mm_or_si128(_mm_or_si128(qx, _mm_slli_epi32(qy, 10)), _mm_or_si128(_mm_slli_epi32(qz, 20), _mm_slli_epi32(qw, 30)));
+		_mm_storeu_si128((__m128i *)(out.data() + i), packed);
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_snorm_2_10_10_10(in[i]);
+}
+
+void pack_unorm_2_10_10_10(std::span<const vec4> in, std::span<PackedU2_10_10_10> out)
+{
+	check_sizes(in, out);
+	size_t i = 0;
+
+#if GFXENGINE_PACKING_SSE
+	__m128 const scale = _mm_set1_ps(1023.0f);
+
+	for (; i + 4 <= in.size(); i += 4)
+	{
+		__m128 x, y, z, w;
+		load_transposed_x4(in.data() + i, x, y, z, w);
+
+		__m128i qx = _mm_cvtps_epi32(_mm_mul_ps(clamp_unorm_x4(x), scale));
+		__m128i qy = _mm_cvtps_epi32(_mm_mul_ps(clamp_unorm_x4(y), scale));
+		__m128i qz = _mm_cvtps_epi32(_mm_mul_ps(clamp_unorm_x4(z), scale));
+		__m128i qw = _mm_cvtps_epi32(_mm_mul_ps(clamp_unorm_x4(w), _mm_set1_ps(3.0f)));
+
+		__m128i packed = _mm_or_si128(_mm_or_si128(qx, _mm_slli_epi32(qy, 10)), _mm_or_si128(_mm_slli_epi32(qz, 20), _mm_slli_epi32(qw, 30)));
+		_mm_storeu_si128((__m128i *)(out.data() + i), packed);
+	}
+#endif
+
+	for (; i < in.size(); ++i)
+		out[i] = pack_unorm_2_10_10_10(in[i]);
+}
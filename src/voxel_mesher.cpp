@@ -0,0 +1,441 @@
+#include "gfxengine/voxel_mesher.hpp"
+
+#include "gfxengine/graphics.hpp"
+#include "gfxengine/worker_pool.hpp"
+
+#include <algorithm>
+
+static constexpr int32_t SIZE = VoxelChunk::SIZE;
+
+// Faces whose four corners differ in ambient occlusion are never merged, their shading would stretch over the whole quad
+static constexpr uint32_t MASK_NO_MERGE = 1u << 24;
+
+static_assert(sizeof(VoxelVertex) == 24, "Update VoxelVertex::attributes");
+
+ShaderValuesInfo VoxelVertex::attributes()
+{
+	ShaderValuesInfo info;
+	info.add({ "position", ShaderFieldType::Vec3, false, 1 });
+	info.add({ "normal", ShaderFieldType::I8, true, 4 });
+	info.add({ "uv", ShaderFieldType::F16, false, 2 });
+	info.add({ "block", ShaderFieldType::U16, false, 1 });
+	info.add({ "ao", ShaderFieldType::U16, true, 1 });
+
+	return info;
+}
+
+VoxelMesher::VoxelMesher()
+	: padded((size_t)PADDED * PADDED * PADDED)
+	, mask((size_t)SIZE * SIZE)
+{
+}
+
+void VoxelMesher::gather(Neighbourhood const &chunks)
+{
+	size_t i = 0;
+
+	for (int32_t z = -1; z <= SIZE; ++z)
+	{
+		int32_t const cz = z < 0 ? 0 : z < SIZE ? 1 : 2;
+		int32_t const lz = (z + SIZE) % SIZE;
+
+		for (int32_t y = -1; y <= SIZE; ++y)
+		{
+			int32_t const cy = y < 0 ? 0 : y < SIZE ? 1 : 2;
+			int32_t const ly = (y + SIZE) % SIZE;
+
+			VoxelChunk const *left = chunks[0 + cy * 3 + cz * 9];
+			VoxelChunk const *center = chunks[1 + cy * 3 + cz * 9];
+			VoxelChunk const *right = chunks[2 + cy * 3 + cz * 9];
+
+			padded[i++] = left ? left->get({ SIZE - 1, ly, lz }) : 0;
+
+			if (center)
+				std::copy_n(center->blocks.data() + VoxelChunk::index({ 0, ly, lz }), SIZE, padded.data() + i);
+			else
+				std::fill_n(padded.data() + i, SIZE, 0);
+
+			i += SIZE;
+			padded[i++] = right ? right->get({ 0, ly, lz }) : 0;
+		}
+	}
+}
+
+void VoxelMesher::mesh(ivec3 chunk, Neighbourhood const &chunks, FrameCacheVertices &out)
+{
+	out.clear();
+	vertices.clear();
+
+	if (!chunks[13])
+		return;
+
+	gather(chunks);
+
+	vec3 const base = vec3(chunk * SIZE);
+
+	for (int32_t d = 0; d < 3; ++d)
+	{
+		int32_t const u = (d + 1) % 3;
+		int32_t const v = (d + 2) % 3;
+
+		ivec3 axis_u{}, axis_v{};
+		axis_u[u] = 1;
+		axis_v[v] = 1;
+
+		for (int32_t side = -1; side <= 1; side += 2)
+		{
+			ivec3 normal{};
+			normal[d] = side;
+
+			for (int32_t k = 0; k < SIZE; ++k)
+			{
+				// Visible faces of the slice: block id, the 2-bit ao of each corner and whether it may merge
+				bool any = false;
+
+				for (int32_t j = 0; j < SIZE; ++j)
+				{
+					for (int32_t i = 0; i < SIZE; ++i)
+					{
+						ivec3 p{};
+						p[d] = k;
+						p[u] = i;
+						p[v] = j;
+
+						uint16_t const block = padded[(size_t)(p.x + 1) + (size_t)(p.y + 1) * PADDED + (size_t)(p.z + 1) * PADDED * PADDED];
+						uint32_t &m = mask[(size_t)i + (size_t)j * SIZE];
+
+						if (block == 0 || solid(p + normal))
+						{
+							m = 0;
+							continue;
+						}
+
+						// Corners in quad order: (-u, -v), (+u, -v), (+u, +v), (-u, +v)
+						static constexpr int32_t corner_u[4]{ -1, 1, 1, -1 };
+						static constexpr int32_t corner_v[4]{ -1, -1, 1, 1 };
+
+						uint32_t ao = 0;
+
+						for (int32_t c = 0; c < 4; ++c)
+						{
+							ivec3 const front = p + normal;
+							bool const side_u = solid(front + axis_u * corner_u[c]);
+							bool const side_v = solid(front + axis_v * corner_v[c]);
+							bool const corner = solid(front + axis_u * corner_u[c] + axis_v * corner_v[c]);
+
+							uint32_t const level = side_u && side_v ? 0 : 3 - ((uint32_t)side_u + (uint32_t)side_v + (uint32_t)corner);
+							ao |= level << (c * 2);
+						}
+
+						bool const uniform = ao == 0x00 || ao == 0x55 || ao == 0xAA || ao == 0xFF;
+						m = block | (ao << 16) | (uniform ? 0 : MASK_NO_MERGE);
+						any = true;
+					}
+				}
+
+				if (!any)
+					continue;
+
+				float const plane = (float)(k + (side > 0 ? 1 : 0));
+
+				for (int32_t j = 0; j < SIZE; ++j)
+				{
+					for (int32_t i = 0; i < SIZE;)
+					{
+						uint32_t const key = mask[(size_t)i + (size_t)j * SIZE];
+
+						if (key == 0)
+						{
+							++i;
+							continue;
+						}
+
+						int32_t w = 1, h = 1;
+
+						if (!(key & MASK_NO_MERGE))
+						{
+							while (i + w < SIZE && mask[(size_t)(i + w) + (size_t)j * SIZE] == key)
+								++w;
+
+							for (; j + h < SIZE; ++h)
+							{
+								uint32_t const *row = mask.data() + (size_t)(j + h) * SIZE + i;
+
+								if (!std::all_of(row, row + w, [&](uint32_t m) { return m == key; }))
+									break;
+							}
+						}
+
+						uint32_t const first = (uint32_t)vertices.size();
+						float ao[4];
+
+						for (int32_t c = 0; c < 4; ++c)
+						{
+							static constexpr int32_t corner_u[4]{ 0, 1, 1, 0 };
+							static constexpr int32_t corner_v[4]{ 0, 0, 1, 1 };
+
+							vec3 pos{};
+							pos[d] = plane;
+							pos[u] = (float)(i + corner_u[c] * w);
+							pos[v] = (float)(j + corner_v[c] * h);
+
+							ao[c] = (float)((key >> (16 + c * 2)) & 3) / 3.0f;
+
+							vertices.push_back({
+								.position = base + pos,
+								.normal = { (int8_t)(normal.x * 127), (int8_t)(normal.y * 127), (int8_t)(normal.z * 127), 0 },
+								.uv = { pack_half((float)(corner_u[c] * w)), pack_half((float)(corner_v[c] * h)) },
+								.block = (uint16_t)(key & 0xFFFF),
+								.ao = pack_unorm16(ao[c]),
+							});
+						}
+
+						// Split along the brighter diagonal, otherwise the interpolated ao is not symmetric
+						bool const flip = ao[0] + ao[2] < ao[1] + ao[3];
+						uint32_t const a = flip ? 1 : 0;
+						uint32_t const b = flip ? 2 : 1;
+						uint32_t const c = flip ? 3 : 2;
+						uint32_t const e = flip ? 0 : 3;
+
+						// Counter-clockwise seen from the side the normal points to
+						if (side > 0)
+							out.indices.insert(out.indices.end(), { first + a, first + b, first + c, first + a, first + c, first + e });
+						else
+							out.indices.insert(out.indices.end(), { first + a, first + c, first + b, first + a, first + e, first + c });
+
+						for (int32_t y = 0; y < h; ++y)
+							std::fill_n(mask.data() + (size_t)(j + y) * SIZE + i, w, 0);
+
+						i += w;
+					}
+				}
+			}
+		}
+	}
+
+	out.vertices.assign((uint8_t const *)vertices.data(), (uint8_t const *)(vertices.data() + vertices.size()));
+}
+
+VoxelWorld::VoxelWorld(WorkerPool &_pool)
+	: pool{ _pool }
+{
+}
+
+void VoxelWorld::mark_dirty(ivec3 chunk)
+{
+	Entry *entry = chunks.find(chunk);
+
+	if (!entry)
+		return;
+
+	entry->version = ++last_version;
+
+	if (!entry->in_dirty_list)
+	{
+		entry->in_dirty_list = true;
+		dirty.push_back(chunk);
+	}
+}
+
+// Neighbours that see voxels in [local_min, local_max] of chunk through their border
+void VoxelWorld::mark_neighbours_dirty(ivec3 chunk, ivec3 local_min, ivec3 local_max)
+{
+	for (int32_t z = -1; z <= 1; ++z)
+	{
+		for (int32_t y = -1; y <= 1; ++y)
+		{
+			for (int32_t x = -1; x <= 1; ++x)
+			{
+				ivec3 const offset(x, y, z);
+				bool touches = offset != ivec3(0, 0, 0);
+
+				for (int32_t a = 0; a < 3 && touches; ++a)
+					touches = offset[a] == 0 || (offset[a] < 0 && local_min[a] == 0) || (offset[a] > 0 && local_max[a] == SIZE - 1);
+
+				if (touches)
+					mark_dirty(chunk + offset);
+			}
+		}
+	}
+}
+
+void VoxelWorld::set_chunk(ivec3 chunk, std::unique_ptr<VoxelChunk> data)
+{
+	if (!data)
+	{
+		remove_chunk(chunk);
+		return;
+	}
+
+	auto [entry, inserted] = chunks.try_emplace(chunk);
+
+	if (inserted)
+		entry->generation = ++last_generation;
+
+	entry->data = std::move(data);
+
+	mark_dirty(chunk);
+	mark_neighbours_dirty(chunk, { 0, 0, 0 }, { SIZE - 1, SIZE - 1, SIZE - 1 });
+}
+
+void VoxelWorld::remove_chunk(ivec3 chunk)
+{
+	if (!chunks.erase(chunk))
+		return;
+
+	// A job may still run for it, its result is dropped by the generation check
+	dirty.erase(std::remove(dirty.begin(), dirty.end(), chunk), dirty.end());
+	mark_neighbours_dirty(chunk, { 0, 0, 0 }, { SIZE - 1, SIZE - 1, SIZE - 1 });
+}
+
+VoxelChunk const *VoxelWorld::get_chunk(ivec3 chunk) const
+{
+	Entry const *entry = chunks.find(chunk);
+	return entry ? entry->data.get() : nullptr;
+}
+
+void VoxelWorld::set_block(ivec3 voxel, uint16_t block)
+{
+	ivec3 const chunk = chunk_of(voxel);
+	ivec3 const local = voxel - chunk * SIZE;
+	Entry *entry = chunks.find(chunk);
+
+	if (!entry || entry->data->get(local) == block)
+		return;
+
+	// Jobs hold the only other references, copy on write instead of waiting for them
+	if (entry->data.use_count() > 1)
+		entry->data = std::make_shared<VoxelChunk>(*entry->data);
+
+	entry->data->set(local, block);
+
+	mark_dirty(chunk);
+	mark_neighbours_dirty(chunk, local, local);
+}
+
+uint16_t VoxelWorld::get_block(ivec3 voxel) const
+{
+	ivec3 const chunk = chunk_of(voxel);
+	VoxelChunk const *data = get_chunk(chunk);
+	return data ? data->get(voxel - chunk * SIZE) : 0;
+}
+
+void VoxelWorld::update(Graphics &graphics, std::shared_ptr<Material> const &material, size_t max_jobs)
+{
+	std::vector<Result> done;
+
+	{
+		std::lock_guard lock(results->mutex);
+		std::swap(done, results->done);
+	}
+
+	for (Result &r : done)
+	{
+		--in_flight;
+		Entry *entry = chunks.find(r.chunk);
+
+		// Started for a removed entry, the one here now may have a job of its own in flight
+		if (!entry || r.generation != entry->generation)
+			continue;
+
+		entry->in_flight = false;
+
+		// Changed while meshing, mark_dirty put it back in the list
+		if (r.version != entry->version)
+			continue;
+
+		entry->meshed_version = r.version;
+
+		if (r.mesh.empty())
+		{
+			entry->cache.reset();
+			continue;
+		}
+
+		if (!entry->cache)
+			entry->cache = graphics.create_cache_vertices(material);
+
+		entry->cache->load(r.mesh);
+	}
+
+	// Chunks still in flight stay in the list until their job is back
+	size_t started = 0;
+	size_t kept = 0;
+
+	for (size_t i = 0; i < dirty.size(); ++i)
+	{
+		ivec3 const chunk = dirty[i];
+		Entry *entry = chunks.find(chunk);
+
+		if (!entry)
+			continue;
+
+		if (entry->meshed_version == entry->version)
+		{
+			entry->in_dirty_list = false;
+			continue;
+		}
+
+		if (entry->in_flight || started == max_jobs)
+		{
+			dirty[kept++] = chunk;
+			continue;
+		}
+
+		auto data = std::make_shared<std::array<std::shared_ptr<VoxelChunk const>, 27>>();
+
+		for (int32_t n = 0; n < 27; ++n)
+		{
+			ivec3 const offset(n % 3 - 1, n / 3 % 3 - 1, n / 9 - 1);
+			Entry const *neighbour = chunks.find(chunk + offset);
+
+			if (neighbour)
+				(*data)[n] = neighbour->data;
+		}
+
+		entry->in_flight = true;
+		entry->in_dirty_list = false;
+		++in_flight;
+		++started;
+
+		pool.submit([chunk, data, generation = entry->generation, version = entry->version, results = results]() {
+			thread_local VoxelMesher mesher;
+
+			VoxelMesher::Neighbourhood neighbourhood;
+
+			for (size_t n = 0; n < 27; ++n)
+				neighbourhood[n] = (*data)[n].get();
+
+			Result r{ chunk, generation, version, {} };
+			mesher.mesh(chunk, neighbourhood, r.mesh);
+
+			std::lock_guard lock(results->mutex);
+			results->done.push_back(std::move(r));
+		});
+	}
+
+	dirty.resize(kept);
+}
+
+void VoxelWorld::draw(Frame &frame)
+{
+	chunks.for_each([&](ivec3 const &, Entry &entry) {
+		if (entry.cache)
+			frame.add_cached_vertices(entry.cache);
+	});
+}
+
+VoxelWorldStats VoxelWorld::get_stats() const
+{
+	VoxelWorldStats stats{};
+	stats.chunks = chunks.size();
+	stats.pending = dirty.size();
+	stats.in_flight = in_flight;
+
+	chunks.for_each([&](ivec3 const &, Entry const &entry) {
+		if (entry.cache)
+			++stats.meshed;
+	});
+
+	return stats;
+}
@@ -4,14 +4,23 @@
 #include "gfxengine/platform.hpp"
 #include "gfxengine/graphics.hpp"
 #include "gfxengine/window_event_handler.hpp"
+#include "gfxengine/frame.hpp"
+
+extern std::unique_ptr<Graphics> _create_graphics(CreateGraphicsParams const &params, GLWorkerContext worker_context);
 
-extern std::unique_ptr<Graphics> _create_graphics();
+void Window::present(Frame &frame)
+{
+	draw(frame);
+	frame.reset();
+}
 
 #if GFXENGINE_PLATFORM_WINDOWS
 
 #include "private/my_windows.hpp"
 #include <glad/glad.h>
 #include "private/wglext.h"
+#include "private/spsc_queue.hpp"
+#include "private/gl_worker_context.hpp"
 
 #pragma comment(lib, "opengl32.lib")
 
@@ -19,14 +28,13 @@ extern std::unique_ptr<Graphics> _create_graphics();
 #include <functional>
 #include <optional>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <atomic>
+#include <new>
+#include <array>
+#include <mutex>
+#include <algorithm>
 
 #if GFXENGINE_EDITOR
-// TODO
-#include "gfxengine/frame.hpp"
-
 #include "imgui.h"
 #include "imgui_impl_opengl3.h"
 #include "imgui_impl_win32.h"
@@ -225,6 +233,9 @@ private:
 	HDC hdc = nullptr;
 	HGLRC hglrc = nullptr;
 
+	// Shares objects with hglrc, used by graphics on its worker thread
+	HGLRC worker_hglrc = nullptr;
+
 	bool closed = false;
 	bool raw_mouse = false;
 	POINT save_mouse_pos{};
@@ -236,6 +247,7 @@ private:
 	WINDOWPLACEMENT save_window_placement{ sizeof(WINDOWPLACEMENT) };
 
 	std::unique_ptr<Graphics> graphics;
+	CreateGraphicsParams graphics_params;
 
 	WindowEventHandler *window_event_handler = nullptr;
 	
@@ -557,10 +569,29 @@ private:
 		return wglCreateContextAttribsARB(hdc, 0, gl_attribs);
 	}
 
+	// Needs a current context for wglGetProcAddress, leaves it current
+	static HGLRC create_shared_gl_context(HDC hdc, HGLRC share, int version_major, int version_minor) noexcept
+	{
+		PFNWGLCREATECONTEXTATTRIBSARBPROC wglCreateContextAttribsARB = reinterpret_cast<PFNWGLCREATECONTEXTATTRIBSARBPROC>(wglGetProcAddress("wglCreateContextAttribsARB"));
+
+		if (!wglCreateContextAttribsARB)
+			return 0;
+
+		int gl_attribs[]{
+			WGL_CONTEXT_MAJOR_VERSION_ARB, version_major,
+			WGL_CONTEXT_MINOR_VERSION_ARB, version_minor,
+			WGL_CONTEXT_PROFILE_MASK_ARB,  WGL_CONTEXT_CORE_PROFILE_BIT_ARB,
+			0, 0,
+		};
+
+		return wglCreateContextAttribsARB(hdc, share, gl_attribs);
+	}
+
 public:
 
 	WindowsWindow(CreateWindowParams const &params)
 		: platform{ params.platform }
+		, graphics_params{ params.graphics }
 	{
 		(void)WindowsWindowStatic::get_singleton();
 
@@ -629,13 +660,9 @@ public:
 	{
 		if (hwnd)
 		{
-#if GFXENGINE_EDITOR
-			ImGui_ImplOpenGL3_Shutdown();
-			ImGui_ImplWin32_Shutdown();
-			ImGui::DestroyContext();
-#endif // GFXENGINE_EDITOR
+			if (graphics)
+				release_graphics();
 
-			graphics.reset();
 			//wglDeleteContext(hglrc);
 			DestroyWindow(hwnd);
 		}
@@ -802,7 +829,42 @@ public:
 
 		wglMakeCurrent(hdc, hglrc);
 
-		graphics = _create_graphics();
+		GLWorkerContext worker_context;
+
+		if (graphics_params.hot_reload_shaders)
+			worker_hglrc = create_shared_gl_context(hdc, hglrc, 4, 6);
+
+		if (worker_hglrc)
+		{
+			worker_context.make_current = [hdc = hdc, worker_hglrc = worker_hglrc]() { return wglMakeCurrent(hdc, worker_hglrc) != FALSE; };
+			worker_context.release = []() { wglMakeCurrent(nullptr, nullptr); };
+		}
+
+		graphics = _create_graphics(graphics_params, std::move(worker_context));
+	}
+
+	// Has to run on the thread that called init_graphics
+	void release_graphics()
+	{
+#if GFXENGINE_EDITOR
+		if (imgui_initialized)
+		{
+			ImGui_ImplOpenGL3_Shutdown();
+			ImGui_ImplWin32_Shutdown();
+			ImGui::DestroyContext();
+			imgui_initialized = false;
+		}
+#endif // GFXENGINE_EDITOR
+
+		graphics.reset();
+		wglMakeCurrent(nullptr, nullptr);
+
+		// Graphics joined its worker, the context is no longer current anywhere
+		if (worker_hglrc)
+		{
+			wglDeleteContext(worker_hglrc);
+			worker_hglrc = nullptr;
+		}
 	}
 
 	bool wait_events()
@@ -857,55 +919,251 @@ class WindowEventHandlerThread : public WindowEventHandler
 {
 private:
 
-	std::mutex mtx;
+	// Window thread -> game thread
+	SpscQueue<WindowEventWrapper, 1024> queue;
+	std::atomic<bool> overflowed = false;
+
+	// Window thread only
+	std::vector<WindowEventWrapper> overflow;
+	std::optional<WindowEventWrapper> pending_move;
+
+	// Game thread only
 	std::vector<WindowEventWrapper> events;
-	std::vector<WindowEventWrapper> events2;
+
+	static MouseEvent *get_locked_move(WindowEventWrapper &event)
+	{
+		if (MouseEvent *mouse = std::get_if<MouseEvent>(&event.data); mouse && mouse->type == MouseEvent::Type::Move && mouse->locked)
+			return mouse;
+
+		return nullptr;
+	}
+
+	// Raw mouse deltas can be summed, absolute positions are kept as is
+	static bool try_merge_move(WindowEventWrapper &into, WindowEventWrapper &event)
+	{
+		MouseEvent *into_mouse = get_locked_move(into);
+		MouseEvent *mouse = get_locked_move(event);
+
+		if (!into_mouse || !mouse)
+			return false;
+
+		into_mouse->pos += mouse->pos;
+		into.time = event.time;
+		return true;
+	}
+
+	void publish(WindowEventWrapper const &event)
+	{
+		if (!overflow.empty())
+			flush_overflow();
+
+		if (!overflow.empty() || !queue.push(event))
+		{
+			// Never block the window thread, keep it until the game thread catches up
+			overflow.push_back(event);
+			overflowed.store(true, std::memory_order_relaxed);
+		}
+	}
+
+	void flush_overflow()
+	{
+		size_t pushed = 0;
+
+		while (pushed < overflow.size() && queue.push(overflow[pushed]))
+			++pushed;
+
+		overflow.erase(overflow.begin(), overflow.begin() + pushed);
+
+		if (overflow.empty())
+			overflowed.store(false, std::memory_order_relaxed);
+	}
+
+	void push(WindowEventWrapper event)
+	{
+		if (get_locked_move(event))
+		{
+			if (!pending_move || !try_merge_move(*pending_move, event))
+				pending_move = event;
+
+			return;
+		}
+
+		if (pending_move)
+		{
+			publish(*pending_move);
+			pending_move.reset();
+		}
+
+		publish(event);
+	}
 
 public:
 
 	WindowEventHandlerThread()
 	{
-		events.reserve(16);
-		events2.reserve(16);
+		overflow.reserve(16);
+		events.reserve(64);
 	}
 
 	virtual void on_keyboard_event(double time, KeyboardEvent event) override
 	{
-		std::unique_lock lck(mtx);
-		events.push_back(WindowEventWrapper(time, event));
+		push(WindowEventWrapper(time, event));
 	}
 
 	virtual void on_mouse_event(double time, MouseEvent event) override
 	{
-		std::unique_lock lck(mtx);
-		events.push_back(WindowEventWrapper(time, event));
+		push(WindowEventWrapper(time, event));
 	}
 
 	virtual void on_mouse_external_unlock(double time, MouseExternalUnlockEvent event) override
 	{
-		std::unique_lock lck(mtx);
-		events.push_back(WindowEventWrapper(time, event));
+		push(WindowEventWrapper(time, event));
 	}
 
 	virtual void on_resize(double time, ResizeEvent event) override
 	{
-		std::unique_lock lck(mtx);
-		events.push_back(WindowEventWrapper(time, event));
+		push(WindowEventWrapper(time, event));
 	}
 
 	virtual void on_close_event(double time, CloseEvent event) override
 	{
-		std::unique_lock lck(mtx);
-		events.push_back(WindowEventWrapper(time, event));
+		push(WindowEventWrapper(time, event));
+	}
+
+	// Window thread, after each batch of window messages
+	void flush()
+	{
+		if (pending_move)
+		{
+			publish(*pending_move);
+			pending_move.reset();
+		}
+
+		if (!overflow.empty())
+			flush_overflow();
+	}
+
+	// Game thread, true if window thread has events it could not queue and needs a wake up
+	[[nodiscard]]
+	bool has_overflow() const
+	{
+		return overflowed.load(std::memory_order_relaxed);
 	}
 
 	[[nodiscard]]
 	std::vector<WindowEventWrapper> const &get_and_release_events()
 	{
-		std::unique_lock lck(mtx);
-		events2.clear();
-		events.swap(events2);
-		return events2;
+		events.clear();
+
+		queue.consume_all([&](WindowEventWrapper &event) {
+			if (events.empty() || !try_merge_move(events.back(), event))
+				events.push_back(event);
+		});
+
+		return events;
+	}
+};
+
+// Type-erased call stored inline, callable has to be trivially copyable (lambdas capturing pointers and values)
+template <typename TArg, size_t N>
+struct InplaceCall
+{
+	alignas(std::max_align_t) uint8_t storage[N];
+	void (*invoke)(void *storage, TArg &arg) = nullptr;
+
+	template <typename TFunc> requires(std::is_trivially_copyable_v<TFunc> && sizeof(TFunc) <= N)
+	static InplaceCall make(TFunc const &func)
+	{
+		InplaceCall result;
+		new (result.storage) TFunc(func);
+		result.invoke = [](void *storage, TArg &arg) { (*(TFunc *)storage)(arg); };
+		return result;
+	}
+
+	void operator () (TArg &arg)
+	{
+		invoke(storage, arg);
+	}
+};
+
+struct WindowCommand
+{
+	enum class Type : uint8_t
+	{
+		LockMouse,
+		Fullscreen,
+		Close,
+		Call,
+	};
+
+	Type type = Type::Close;
+	bool enable = false;
+	std::atomic<uint32_t> *done = nullptr;
+	InplaceCall<WindowsWindow, 32> call{};
+};
+
+class WindowsWindowThread;
+
+// Shared with the deleters of objects handed out in render thread mode, they may outlive the window
+struct RenderThreadLink
+{
+	std::mutex mutex;
+	WindowsWindowThread *owner = nullptr;
+	std::thread::id render_thread;
+};
+
+static void release_on_render_thread(RenderThreadLink &link, std::shared_ptr<void> object);
+
+// Graphics handed to the game when drawing happens on the render thread, every call is forwarded there
+class RenderThreadGraphics : public Graphics
+{
+private:
+
+	WindowsWindowThread &owner;
+
+public:
+
+	RenderThreadGraphics(WindowsWindowThread &owner)
+		: owner{ owner }
+	{
+	}
+
+	// Frames are submitted through Window::draw/present
+	virtual void draw(Frame const &frame) override
+	{
+		throw 1;
+	}
+
+	virtual std::shared_ptr<Material> create_material(CreateMaterialParams const &params) override;
+	virtual std::vector<std::shared_ptr<Material>> create_materials(std::span<const CreateMaterialParams> params) override;
+	virtual std::shared_ptr<GraphicsCacheVertices> create_cache_vertices(std::shared_ptr<Material> material) override;
+	virtual void resize(ivec2 size, float resolution_scale) override;
+	virtual void set_msaa_samples(uint32_t samples) override;
+	virtual uint32_t get_msaa_samples() const override;
+	virtual void set_render_scale(float scale) override;
+	virtual float get_render_scale() const override;
+	virtual double get_gpu_frame_time() const override;
+};
+
+struct RenderThreadCacheVertices : GraphicsCacheVertices
+{
+	WindowsWindowThread &owner;
+	std::shared_ptr<RenderThreadLink> link;
+	std::shared_ptr<GraphicsCacheVertices> inner;
+
+	RenderThreadCacheVertices(WindowsWindowThread &owner, std::shared_ptr<RenderThreadLink> link, std::shared_ptr<GraphicsCacheVertices> inner)
+		: owner{ owner }
+		, link{ std::move(link) }
+		, inner{ std::move(inner) }
+	{
+	}
+
+	virtual ~RenderThreadCacheVertices() override;
+	virtual void load(FrameCacheVertices const &c) override;
+
+	virtual Material const *get_material() const override
+	{
+		return inner->get_material();
 	}
 };
 
@@ -917,97 +1175,256 @@ private:
 	WindowEventHandlerThread event_handler;
 	WindowEventHandler *window_event_handler = nullptr;
 
-	std::mutex mtx;
-	bool cv_notified = false;
-	std::condition_variable cv;
-	bool cv_destroy_notified = false;
-	std::condition_variable cv_destroy;
-	std::vector<std::function<void(WindowsWindow &window)>> tasks;
-	std::vector<std::function<void(WindowsWindow &window)>> tasks2;
+	// Game thread -> window thread, pushes and the window_stopped store are serialized by commands_mutex
+	SpscQueue<WindowCommand, 64> commands;
+	std::mutex commands_mutex;
+	std::atomic<bool> wake_pending = false;
+	int batch_depth = 0;
+	bool batch_has_commands = false;
+
+	std::atomic<bool> window_created = false;
+	std::atomic<bool> window_stopped = false;
+	std::atomic<bool> destroy_allowed = false;
 
 	WindowsWindow *_window = nullptr;
 
+	// Render thread mode, frames go through a mailbox of slots: game fills a free slot, render thread draws ready ones
+	bool use_render_thread = false;
+	uint32_t max_frames_in_flight = 2;
+	uint32_t frames_submitted = 0;
+
+	std::thread render_thread;
+	std::array<Frame, 3> frame_slots;
+	SpscQueue<uint32_t, 4> ready_frames;
+	SpscQueue<uint32_t, 4> free_frames;
+	SpscQueue<WindowCommand, 16> render_commands;
+	std::shared_ptr<RenderThreadLink> link = std::make_shared<RenderThreadLink>();
+
+	std::atomic<uint32_t> render_signal = 0;
+	std::atomic<uint32_t> frames_completed = 0;
+	std::atomic<bool> render_ready = false;
+	std::atomic<bool> render_stop = false;
+
+	// GL objects whose last reference was dropped off the render thread
+	std::vector<std::shared_ptr<void>> release_pending;
+
+	// Any thread pushes to render_commands and release_pending, render_stop is stored under it too
+	std::mutex render_mutex;
+
+	RenderThreadGraphics render_graphics{ *this };
+
 	WindowsWindowThread(WindowsWindowThread const &) = delete;
 	WindowsWindowThread &operator = (WindowsWindowThread const &) = delete;
 	WindowsWindowThread(WindowsWindowThread &&) = delete;
 	WindowsWindowThread &operator = (WindowsWindowThread &&) = delete;
 
-	auto synchronized(auto const &func)
+	void wake_window_thread()
 	{
-		std::unique_lock lck(mtx);
-		return func(lck);
+		if (!wake_pending.exchange(true, std::memory_order_acq_rel))
+			PostMessageW(_window->get_hwnd(), WM_USER, 0, 0);
 	}
 
-	void cv_wait(std::condition_variable &_cv, bool &_cv_notified)
+	// False when the window thread has stopped, a command pushed before that is always run
+	bool push_command(WindowCommand const &command)
 	{
-		synchronized([&](auto &lck) {
-			_cv.wait(lck, [&](){ return _cv_notified; });
-			_cv_notified = false;
-		});
+		{
+			std::lock_guard lock(commands_mutex);
+
+			if (window_stopped.load(std::memory_order_relaxed))
+				return false;
+
+			while (!commands.push(command))
+			{
+				// Full, window thread drains on every wake up and before it stops
+				wake_window_thread();
+				std::this_thread::yield();
+			}
+		}
+
+		if (batch_depth > 0)
+			batch_has_commands = true;
+		else
+			wake_window_thread();
+
+		return true;
+	}
+
+	void push_command_and_wait(WindowCommand command)
+	{
+		std::atomic<uint32_t> done = 0;
+		command.done = &done;
+
+		if (!push_command(command))
+			return;
+
+		if (batch_depth > 0)
+		{
+			batch_has_commands = false;
+			wake_window_thread();
+		}
+
+		done.wait(0, std::memory_order_acquire);
+	}
+
+	static void run_command(WindowsWindow &window, WindowCommand &command)
+	{
+		switch (command.type)
+		{
+			case WindowCommand::Type::LockMouse:
+				window.lock_mouse(command.enable);
+				break;
+
+			case WindowCommand::Type::Fullscreen:
+				window.fullscreen(command.enable);
+				break;
+
+			case WindowCommand::Type::Close:
+				window.close();
+				break;
+
+			case WindowCommand::Type::Call:
+				command.call(window);
+				break;
+		}
+
+		if (command.done)
+		{
+			command.done->store(1, std::memory_order_release);
+			command.done->notify_one();
+		}
 	}
 
-	void cv_notify(std::condition_variable &_cv, bool &_cv_notified)
+	void execute_commands(WindowsWindow &window)
 	{
-		synchronized([&](auto &lck) {
-			_cv_notified = true;
+		wake_pending.store(false, std::memory_order_release);
+
+		commands.consume_all([&](WindowCommand &command) {
+			run_command(window, command);
 		});
-		_cv.notify_one();
 	}
 
-	void push_task(std::function<void(WindowsWindow &window)> task)
+	void execute_render_commands()
 	{
-		synchronized([&](auto &lck) {
-			tasks.push_back(std::move(task));
+		render_commands.consume_all([&](WindowCommand &command) {
+			run_command(*_window, command);
 		});
 
-		// Wake up window thread
-		PostMessageW(_window->get_hwnd(), WM_USER, 0, 0);
+		std::vector<std::shared_ptr<void>> released;
+
+		{
+			std::lock_guard lock(render_mutex);
+			released.swap(release_pending);
+		}
 	}
 
-	template <typename TRet>
-	TRet push_task_and_wait(std::function<TRet(WindowsWindow &window)> task)
+	void wake_render_thread()
+	{
+		render_signal.fetch_add(1, std::memory_order_release);
+		render_signal.notify_one();
+	}
+
+	void render_thread_main()
 	{
-		if constexpr (std::is_same_v<void, TRet>)
 		{
-			push_task([&](WindowsWindow &window) {
-				task(window);
-				cv_notify(cv, cv_notified);
-			});
+			std::lock_guard lock(link->mutex);
+			link->render_thread = std::this_thread::get_id();
+		}
+
+		_window->init_graphics();
+		signal(render_ready);
+
+		while (true)
+		{
+			uint32_t signal_value = render_signal.load(std::memory_order_acquire);
+
+			execute_render_commands();
 
-			cv_wait(cv, cv_notified);
+			uint32_t slot;
+
+			if (ready_frames.pop(slot))
+			{
+				Frame &frame = frame_slots[slot];
+
+				_window->draw(frame);
+				frame.reset();
+
+				(void)free_frames.push(slot);
+
+				frames_completed.fetch_add(1, std::memory_order_release);
+				frames_completed.notify_one();
+				continue;
+			}
+
+			if (render_stop.load(std::memory_order_acquire))
+				break;
+
+			render_signal.wait(signal_value, std::memory_order_acquire);
 		}
-		else
+
+		execute_render_commands();
+		_window->release_graphics();
+	}
+
+	// Blocks while max_frames_in_flight frames are queued or being drawn
+	Frame &acquire_frame_slot(uint32_t &slot)
+	{
+		uint32_t completed = frames_completed.load(std::memory_order_acquire);
+
+		while (frames_submitted - completed >= max_frames_in_flight)
 		{
-			std::optional<TRet> ret;
+			frames_completed.wait(completed, std::memory_order_acquire);
+			completed = frames_completed.load(std::memory_order_acquire);
+		}
+
+		if (!free_frames.pop(slot))
+			throw 1;
+
+		return frame_slots[slot];
+	}
+
+	void submit_frame_slot(uint32_t slot)
+	{
+		Frame &frame = frame_slots[slot];
+
+		// Game holds proxies, the renderer needs the real cache objects
+		for (auto &task : frame.tasks)
+		{
+			auto *content = std::get_if<DrawTaskTypes::DrawCached>(&task);
 
-			push_task([&](WindowsWindow &window) {
-				ret = task(window);
-				cv_notify(cv, cv_notified);
-			});
+			if (!content)
+				continue;
 
-			cv_wait(cv, cv_notified);
+			auto *proxy = dynamic_cast<RenderThreadCacheVertices *>(content->cache.get());
 
-			return ret.value();
+			// Created by another Graphics
+			if (!proxy)
+			{
+				frame.reset();
+				(void)free_frames.push(slot);
+				throw 1;
+			}
+
+			content->cache = proxy->inner;
 		}
+
+		frame.snapshot_uniforms();
+
+		(void)ready_frames.push(slot);
+		++frames_submitted;
+
+		wake_render_thread();
 	}
 
-	[[nodiscard]]
-	std::vector<std::function<void(WindowsWindow &window)>> const &get_and_release_tasks()
+	static void signal(std::atomic<bool> &flag)
 	{
-		synchronized([&](auto &lck) {
-			tasks2.clear();
-			tasks.swap(tasks2);
-		});
-		return tasks2;
+		flag.store(true, std::memory_order_release);
+		flag.notify_one();
 	}
 
 public:
 
 	WindowsWindowThread(CreateWindowParams const &params)
 	{
-		tasks.reserve(16);
-		tasks2.reserve(16);
-
 		CreateWindowParams copy_params = params;
 
 		if (params.window_event_handler)
@@ -1020,42 +1437,103 @@ public:
 			WindowsWindow window(copy_params);
 			_window = &window;
 
-			cv_notify(cv, cv_notified);
+			signal(window_created);
 
 			while (true)
 			{
 				bool stop = window.wait_events();
+				event_handler.flush();
 
-				auto const &ts = get_and_release_tasks();
-
-				for (auto const &t : ts)
-					t(window);
+				execute_commands(window);
 
 				if (stop)
 					break;
 			}
 
-			cv_wait(cv_destroy, cv_destroy_notified);
+			// A producer waiting on a full queue holds the lock, keep draining until it lets go
+			while (!commands_mutex.try_lock())
+			{
+				execute_commands(window);
+				std::this_thread::yield();
+			}
+
+			signal(window_stopped);
+			commands_mutex.unlock();
+
+			// Commands pushed before the stop still have waiters
+			execute_commands(window);
+
+			destroy_allowed.wait(false, std::memory_order_acquire);
 
 			_window = nullptr;
 		});
 
-		cv_wait(cv, cv_notified);
+		window_created.wait(false, std::memory_order_acquire);
 
-		_window->init_graphics();
+		if (params.render_thread)
+		{
+			use_render_thread = true;
+			link->owner = this;
+			max_frames_in_flight = std::clamp<uint32_t>(params.max_frames_in_flight, 1, (uint32_t)frame_slots.size());
+
+			for (uint32_t i = 0; i < max_frames_in_flight; ++i)
+				(void)free_frames.push(i);
+
+			render_thread = std::thread([this]() { render_thread_main(); });
+			render_ready.wait(false, std::memory_order_acquire);
+		}
+		else
+		{
+			_window->init_graphics();
+		}
 	}
 
 	~WindowsWindowThread()
 	{
+		if (use_render_thread)
+		{
+			// Releases queued until here are still run by the render thread before it stops, later ones leak
+			{
+				std::lock_guard lock(link->mutex);
+				link->owner = nullptr;
+			}
+
+			{
+				std::lock_guard lock(render_mutex);
+				render_stop.store(true, std::memory_order_release);
+			}
+
+			wake_render_thread();
+			render_thread.join();
+		}
+
 		close();
-		cv_notify(cv_destroy, cv_destroy_notified);
+		signal(destroy_allowed);
 		window_thread.join();
 	}
 
+	// Window operations issued until the matching end_batch() are delivered with a single wake up
+	virtual void begin_batch() override
+	{
+		++batch_depth;
+	}
+
+	virtual void end_batch() override
+	{
+		if (--batch_depth == 0 && batch_has_commands)
+		{
+			batch_has_commands = false;
+			wake_window_thread();
+		}
+	}
+
 	virtual void poll_events() override
 	{
 		auto const &events = event_handler.get_and_release_events();
 
+		if (event_handler.has_overflow())
+			PostMessageW(_window->get_hwnd(), WM_USER, 0, 0);
+
 		for (auto const &event : events)
 		{
 			std::visit([&](auto &data) {
@@ -1091,41 +1569,239 @@ public:
 
 	virtual void draw(Frame const &frame) override
 	{
-		_window->draw(frame);
+		if (!use_render_thread)
+		{
+			_window->draw(frame);
+			return;
+		}
+
+		uint32_t slot;
+		acquire_frame_slot(slot) = frame;
+		submit_frame_slot(slot);
+	}
+
+	virtual void present(Frame &frame) override
+	{
+		if (!use_render_thread)
+		{
+			Window::present(frame);
+			return;
+		}
+
+		// Slot comes back reset, so the game keeps reusing its allocations
+		uint32_t slot;
+		std::swap(acquire_frame_slot(slot), frame);
+		submit_frame_slot(slot);
 	}
 
 	virtual Graphics &get_graphics() const override
 	{
+		if (use_render_thread)
+			return const_cast<RenderThreadGraphics &>(render_graphics);
+
 		return _window->get_graphics();
 	}
 
+	// Runs task on the thread owning the graphics context and waits for it
+	template <typename TFunc>
+	auto run_on_render_thread(TFunc const &task)
+	{
+		using TRet = std::invoke_result_t<TFunc const &>;
+
+		if (!use_render_thread || std::this_thread::get_id() == render_thread.get_id())
+			return task();
+
+		WindowCommand command{};
+		command.type = WindowCommand::Type::Call;
+
+		std::atomic<uint32_t> done = 0;
+		command.done = &done;
+
+		auto push_and_wait = [&]() {
+			{
+				std::lock_guard lock(render_mutex);
+
+				// Nothing would run the command anymore
+				if (render_stop.load(std::memory_order_relaxed))
+					throw 1;
+
+				while (!render_commands.push(command))
+				{
+					wake_render_thread();
+					std::this_thread::yield();
+				}
+			}
+
+			wake_render_thread();
+			done.wait(0, std::memory_order_acquire);
+		};
+
+		if constexpr (std::is_same_v<void, TRet>)
+		{
+			auto *p_task = &task;
+			command.call = decltype(command.call)::make([p_task](WindowsWindow &) { (*p_task)(); });
+			push_and_wait();
+		}
+		else
+		{
+			std::optional<TRet> ret;
+			auto *p_task = &task;
+			auto *p_ret = &ret;
+			command.call = decltype(command.call)::make([p_task, p_ret](WindowsWindow &) { *p_ret = (*p_task)(); });
+			push_and_wait();
+			return std::move(ret.value());
+		}
+	}
+
+	// Drops the reference on the render thread, where the GL objects can be deleted. Only through the link,
+	// which guarantees the render thread is still running.
+	void release_on_render_thread(std::shared_ptr<void> object)
+	{
+		{
+			std::lock_guard lock(render_mutex);
+			release_pending.push_back(std::move(object));
+		}
+
+		wake_render_thread();
+	}
+
+	[[nodiscard]]
+	std::shared_ptr<RenderThreadLink> const &get_link() const
+	{
+		return link;
+	}
+
+	[[nodiscard]]
+	WindowsWindow &get_window()
+	{
+		return *_window;
+	}
+
 	virtual void lock_mouse(bool lock) override
 	{
-		push_task([lock](WindowsWindow &window) {
-			window.lock_mouse(lock);
-		});
+		WindowCommand command{};
+		command.type = WindowCommand::Type::LockMouse;
+		command.enable = lock;
+		push_command(command);
 	}
 
 	virtual void fullscreen(bool enable) override
 	{
-		if (_window)
-			_window->fullscreen(enable);
+		WindowCommand command{};
+		command.type = WindowCommand::Type::Fullscreen;
+		command.enable = enable;
+		push_command(command);
 	}
 
 	virtual void close() override
 	{
-		push_task([](WindowsWindow &window) {
-			window.close();
-		});
+		WindowCommand command{};
+		command.type = WindowCommand::Type::Close;
+		push_command(command);
 	}
 
 	virtual void set_vsync(bool enable) override
 	{
 		if (_window)
-			_window->set_vsync(enable);
+			run_on_render_thread([&]() { _window->set_vsync(enable); });
 	}
 };
 
+static void release_on_render_thread(RenderThreadLink &link, std::shared_ptr<void> object)
+{
+	std::lock_guard lock(link.mutex);
+
+	if (std::this_thread::get_id() == link.render_thread)
+		return;
+
+	// The context is gone with the window, deleting now would call GL without one
+	if (!link.owner)
+	{
+		(void)new std::shared_ptr<void>(std::move(object));
+		return;
+	}
+
+	link.owner->release_on_render_thread(std::move(object));
+}
+
+// Materials are released on the render thread, where their programs were created
+static std::shared_ptr<Material> wrap_render_thread_material(std::shared_ptr<RenderThreadLink> link, std::shared_ptr<Material> material)
+{
+	Material *p = material.get();
+
+	return std::shared_ptr<Material>(p, [link = std::move(link), material = std::move(material)](Material *) mutable {
+		release_on_render_thread(*link, std::move(material));
+	});
+}
+
+std::shared_ptr<Material> RenderThreadGraphics::create_material(CreateMaterialParams const &params)
+{
+	auto material = owner.run_on_render_thread([&]() { return owner.get_window().get_graphics().create_material(params); });
+	return wrap_render_thread_material(owner.get_link(), std::move(material));
+}
+
+std::vector<std::shared_ptr<Material>> RenderThreadGraphics::create_materials(std::span<const CreateMaterialParams> params)
+{
+	auto materials = owner.run_on_render_thread([&]() { return owner.get_window().get_graphics().create_materials(params); });
+
+	for (auto &material : materials)
+		material = wrap_render_thread_material(owner.get_link(), std::move(material));
+
+	return materials;
+}
+
+std::shared_ptr<GraphicsCacheVertices> RenderThreadGraphics::create_cache_vertices(std::shared_ptr<Material> material)
+{
+	auto inner = owner.run_on_render_thread([&]() { return owner.get_window().get_graphics().create_cache_vertices(material); });
+	return std::make_shared<RenderThreadCacheVertices>(owner, owner.get_link(), std::move(inner));
+}
+
+void RenderThreadGraphics::resize(ivec2 size, float resolution_scale)
+{
+	owner.run_on_render_thread([&]() { owner.get_window().get_graphics().resize(size, resolution_scale); });
+}
+
+void RenderThreadGraphics::set_msaa_samples(uint32_t samples)
+{
+	owner.run_on_render_thread([&]() { owner.get_window().get_graphics().set_msaa_samples(samples); });
+}
+
+uint32_t RenderThreadGraphics::get_msaa_samples() const
+{
+	return owner.run_on_render_thread([&]() { return owner.get_window().get_graphics().get_msaa_samples(); });
+}
+
+// Thread safe in the implementation, no need to wait for the render thread
+void RenderThreadGraphics::set_render_scale(float scale)
+{
+	owner.get_window().get_graphics().set_render_scale(scale);
+}
+
+float RenderThreadGraphics::get_render_scale() const
+{
+	return owner.get_window().get_graphics().get_render_scale();
+}
+
+double RenderThreadGraphics::get_gpu_frame_time() const
+{
+	return owner.get_window().get_graphics().get_gpu_frame_time();
+}
+
+RenderThreadCacheVertices::~RenderThreadCacheVertices()
+{
+	release_on_render_thread(*link, std::move(inner));
+}
+
+void RenderThreadCacheVertices::load(FrameCacheVertices const &c)
+{
+	owner.run_on_render_thread([&]() { inner->load(c); });
+
+	const_cast<size_t &>(stats_vertices_count) = inner->stats_vertices_count;
+	const_cast<size_t &>(stats_indices_count) = inner->stats_indices_count;
+	const_cast<std::optional<AABB3> &>(bounds) = inner->bounds;
+	const_cast<PrimitiveTopology &>(topology) = inner->topology;
+}
+
 std::unique_ptr<Window> _create_window(CreateWindowParams const &params)
 {
 	return std::make_unique<WindowsWindowThread>(params);
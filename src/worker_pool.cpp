@@ -0,0 +1,122 @@
+#include "gfxengine/worker_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+WorkerPool::WorkerPool(size_t thread_count)
+{
+	if (thread_count == 0)
+		thread_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+	threads.reserve(thread_count);
+
+	for (size_t i = 0; i < thread_count; ++i)
+		threads.emplace_back([this]() { thread_main(); });
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+		jobs.clear();
+	}
+
+	wake.notify_all();
+
+	for (auto &t : threads)
+		t.join();
+}
+
+void WorkerPool::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+
+	wake.notify_one();
+}
+
+void WorkerPool::wait_idle()
+{
+	std::unique_lock lock(mutex);
+	idle.wait(lock, [&]() { return jobs.empty() && running == 0; });
+}
+
+void WorkerPool::parallel_for(size_t count, size_t grain, std::function<void(size_t begin, size_t end)> const &body)
+{
+	// A few ranges per thread even out uneven work
+	size_t const ranges = std::min((count + std::max<size_t>(grain, 1) - 1) / std::max<size_t>(grain, 1), (threads.size() + 1) * 4);
+
+	if (ranges <= 1)
+	{
+		if (count > 0)
+			body(0, count);
+
+		return;
+	}
+
+	struct Shared
+	{
+		std::atomic<size_t> next{ 0 };
+		std::mutex mutex;
+		std::condition_variable finished;
+		size_t done = 0;
+	};
+
+	auto shared = std::make_shared<Shared>();
+
+	// Jobs starting after the last range was taken return without touching body
+	auto run = [shared, ranges, count, body = &body]() {
+		for (;;)
+		{
+			size_t const r = shared->next.fetch_add(1);
+
+			if (r >= ranges)
+				return;
+
+			(*body)(count * r / ranges, count * (r + 1) / ranges);
+
+			std::lock_guard lock(shared->mutex);
+
+			if (++shared->done == ranges)
+				shared->finished.notify_all();
+		}
+	};
+
+	for (size_t i = 1; i < std::min(ranges, threads.size() + 1); ++i)
+		submit(run);
+
+	run();
+
+	std::unique_lock lock(shared->mutex);
+	shared->finished.wait(lock, [&]() { return shared->done == ranges; });
+}
+
+void WorkerPool::thread_main()
+{
+	std::unique_lock lock(mutex);
+
+	for (;;)
+	{
+		wake.wait(lock, [&]() { return stopping || !jobs.empty(); });
+
+		if (stopping)
+			return;
+
+		auto job = std::move(jobs.front());
+		jobs.pop_front();
+		++running;
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		--running;
+
+		if (jobs.empty() && running == 0)
+			idle.notify_all();
+	}
+}